@@ -0,0 +1,72 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_ACCESS_WATCHER_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_ACCESS_WATCHER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "sys/types.h"
+
+namespace ds {
+
+// Reports file opens/accesses on watched filesystems through fanotify (requires CAP_SYS_ADMIN).
+// A filesystem that reported an access is muted for `debounce` so a busy disk does not flood us with events.
+// Watches of the same filesystem (or mount, on kernels without filesystem marks) share one mark, the kernel merges
+// them anyway, an access is reported for each of them.
+class AccessWatcher {
+public:
+  AccessWatcher() = delete;
+  explicit AccessWatcher(std::chrono::milliseconds debounce);
+  AccessWatcher(const AccessWatcher&) = delete;
+  AccessWatcher(AccessWatcher&& other) noexcept;
+  AccessWatcher& operator=(const AccessWatcher&) = delete;
+  AccessWatcher& operator=(AccessWatcher&& other) noexcept;
+
+  virtual ~AccessWatcher();
+
+  // false if fanotify could not be initialized
+  [[nodiscard]] bool good() const;
+  // watch the filesystem containing `path` (or its mount if the kernel is too old), index follows call order
+  bool watch(const std::filesystem::path& path);
+  // readable (epoll) when an access is waiting, `wait` with a zero timeout reads it
+  [[nodiscard]] int fd() const;
+  // when a muted filesystem is to be watched again by `wait`, `time_point::max()` if none is muted
+  [[nodiscard]] std::chrono::steady_clock::time_point next_deadline() const;
+  // wait for accesses until `timeout` (negative for infinite), indices of watches that saw an access are stored in
+  // `triggered`, return false on error
+  bool wait(std::chrono::milliseconds timeout, std::vector<std::size_t>& triggered);
+
+protected:
+  struct Mark {
+    // the first path watched on it
+    std::filesystem::path path;
+    dev_t dev;
+    // of `path`, -1 for a filesystem mark
+    int mount_id;
+    unsigned int mark_type;
+    bool armed;
+    std::chrono::steady_clock::time_point rearm_at;
+  };
+
+  static const std::uint64_t EVENT_MASK;
+
+  int fanotify_fd;
+  std::chrono::milliseconds debounce;
+  std::vector<Mark> marks;
+  // index of the mark of each watch
+  std::vector<std::size_t> watches;
+  // marks that saw an access in `read_events`
+  std::vector<std::size_t> fired;
+
+  bool arm(Mark& mark);
+  bool disarm(Mark& mark);
+  void read_events();
+  // mount id of `path`, -1 if unknown
+  static int mount_id(const std::filesystem::path& path);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_ACCESS_WATCHER_H_
@@ -5,29 +5,70 @@
 #include <filesystem>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+
+#include "sys/types.h"
+
+#include "do_not_sleep/file.h"
 
 namespace ds {
 
 class BlockInfo {
 public:
   BlockInfo() = delete;
-  BlockInfo(const BlockInfo&) = default;
+  BlockInfo(const BlockInfo&) = delete;
   BlockInfo(BlockInfo&&) noexcept = default;
-  BlockInfo& operator=(const BlockInfo&) = default;
+  BlockInfo& operator=(const BlockInfo&) = delete;
   BlockInfo& operator=(BlockInfo&&) noexcept = default;
 
   virtual ~BlockInfo() = default;
 
+  // mount point to mount source, e.g. `/mnt/usb_disk` to `/dev/sdb1`
+  using MountList = std::unordered_map<std::filesystem::path, std::filesystem::path>;
+
+  // a line of /proc/self/mountinfo, unescaped
+  struct Mount {
+    dev_t device;
+    // within the filesystem, `/` unless e.g. a btrfs subvolume or a bind mount of a subdirectory
+    std::filesystem::path root;
+    std::filesystem::path mount_point;
+    // e.g. `/dev/sdb1`
+    std::filesystem::path source;
+  };
+
+  // cumulative since the disk appeared, in the order of the stat file (Documentation/block/stat.rst)
+  struct Counters {
+    std::uint64_t read_ios;
+    std::uint64_t read_sectors;
+    std::uint64_t write_ios;
+    std::uint64_t write_sectors;
+  };
+
   static const std::pair<std::uint64_t, std::uint64_t> NO_IO;
 
+  // the filesystems mounted right now, in the order they were mounted
+  static std::vector<Mount> mounts();
+  // the filesystems mounted right now, from /proc/self/mountinfo
+  static MountList mount_list();
   // e.g. `/mnt/usb_disk`
-  static BlockInfo from_mount_path(const std::filesystem::path& mount_path);
+  static BlockInfo from_mount_path(const std::filesystem::path& mount_path, const MountList& mounts = mount_list());
   // e.g. `/dev/sda1`
-  static BlockInfo from_block_path(const std::filesystem::path& block_path);
+  static BlockInfo from_block_path(const std::filesystem::path& block_path, const MountList& mounts = mount_list());
   // e.g. `sda1`
-  static BlockInfo from_block_name(const std::filesystem::path& block_name);
-
-  static std::pair<std::uint64_t, std::uint64_t> self_io_taken();
+  static BlockInfo from_block_name(const std::filesystem::path& block_name, const MountList& mounts = mount_list());
+
+  // read and write syscalls of this process so far, the caller diffs them
+  static std::pair<std::uint64_t, std::uint64_t> self_io_statistics();
+  // whole disk holding the filesystem of `path` (e.g. 8:0 for a file on /dev/sda1), 0 if unknown
+  static dev_t disk_device(const std::filesystem::path& path);
+  // device file of the filesystem of `path` (e.g. `/dev/sda1`), empty if unknown
+  static std::filesystem::path device_node(const std::filesystem::path& path);
+  // stat file of the whole disk holding the filesystem of `path` (e.g. `/sys/dev/block/8:0/stat`), empty if unknown
+  static std::filesystem::path disk_stat_file(const std::filesystem::path& path);
+  // get read I/Os and write I/Os from stat file, return {-1, -1} on error
+  static std::pair<std::uint64_t, std::uint64_t> get_io_statistics(File& stat, const std::filesystem::path& stat_file);
+  // false on error
+  static bool get_counters(File& stat, const std::filesystem::path& stat_file, Counters& out);
 
   // from the stat file
   [[nodiscard]] std::uint64_t total_reads() const;
@@ -39,30 +80,31 @@ public:
   std::uint64_t writes_taken();
   // diff from last call or nullopt if unchanged
   std::pair<std::uint64_t, std::uint64_t> io_taken();
+  // all counters, the next diff is taken from them, false on error
+  bool sample(Counters& out);
+  // statistics the next diff is taken from
+  [[nodiscard]] const std::pair<std::uint64_t, std::uint64_t>& last_io_statistics() const;
+  // e.g. resume from statistics saved before a restart, so I/O in between is not missed
+  void set_last_io_statistics(const std::pair<std::uint64_t, std::uint64_t>& io);
 
 protected:
   static const std::filesystem::path MOUNT_INFO_PATH;
   static const std::filesystem::path SYS_BLOCK_PATH;
   static const std::filesystem::path BLOCK_STAT_NAME;
   static const std::filesystem::path SELF_IO;
+  static const std::filesystem::path SYS_DEV_BLOCK_PATH;
 
-  /* NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables) */
-  static std::unordered_map<std::filesystem::path, std::filesystem::path> mount_list;
-  /* NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables) */
-  static std::pair<std::uint64_t, std::uint64_t> self_last_io;
-
-  static void update_mount_list(const bool& force = false);
   static std::filesystem::path find_block_stat(const std::filesystem::path& block_device);
-  // get read sectors and write sectors from stat file, return {-1, -1} on error
-  static std::pair<std::uint64_t, std::uint64_t> get_io_statistics(const std::filesystem::path& stat_file);
 
-  std::unordered_map<std::filesystem::path, std::filesystem::path>::const_iterator mount_info_iter;
   std::filesystem::path stat_file;
+  // kept open, sysfs renders it again on each read from offset 0
+  mutable File stat_fd;
   std::pair<std::uint64_t, std::uint64_t> last_io;
 
-  explicit BlockInfo(std::unordered_map<std::filesystem::path, std::filesystem::path>::const_iterator mount_info);
+  // e.g. `/dev/sda1`
+  explicit BlockInfo(const std::filesystem::path& mount_source);
 
-  // get read sectors and write sectors from stat file, return {-1, -1} on error
+  // get read I/Os and write I/Os from stat file, return {-1, -1} on error
   [[nodiscard]] std::pair<std::uint64_t, std::uint64_t> get_io_statistics() const;
 };
 
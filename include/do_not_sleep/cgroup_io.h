@@ -0,0 +1,65 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_CGROUP_IO_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_CGROUP_IO_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "sys/types.h"
+
+namespace ds {
+
+// I/O done by a set of cgroups (v2) on a set of disks, from their `io.stat`
+class CgroupIO {
+public:
+  struct Counters {
+    std::uint64_t rbytes;
+    std::uint64_t wbytes;
+    std::uint64_t rios;
+    std::uint64_t wios;
+  };
+
+  CgroupIO() = delete;
+  // e.g. `/sys/fs/cgroup/system.slice/plex.service`
+  explicit CgroupIO(const std::vector<std::filesystem::path>& cgroups);
+  CgroupIO(const CgroupIO&) = delete;
+  CgroupIO(CgroupIO&& other) noexcept;
+  CgroupIO& operator=(const CgroupIO&) = delete;
+  CgroupIO& operator=(CgroupIO&& other) noexcept;
+
+  virtual ~CgroupIO();
+
+  // track I/O on the (whole) disk `disk`, return the index of its counters
+  std::size_t track(const dev_t& disk);
+  // read each `io.stat` once and sum tracked disks over all cgroups, false if none could be read
+  bool scan();
+  [[nodiscard]] const Counters& counters(const std::size_t& index) const;
+
+  static const std::filesystem::path CGROUP_ROOT;
+  // `plex.service` -> `/sys/fs/cgroup/system.slice/plex.service`, `user.slice/x` -> `/sys/fs/cgroup/user.slice/x`
+  static std::filesystem::path resolve(const std::string& unit);
+
+protected:
+  struct Source {
+    std::filesystem::path io_stat;
+    // -1 if not open (e.g. the unit is not running)
+    int fd;
+  };
+
+  static constexpr std::size_t BUF_SIZE{64 * 1024};
+
+  std::vector<Source> sources;
+  std::vector<dev_t> disks;
+  std::vector<Counters> totals;
+  std::array<char, BUF_SIZE> buf;
+
+  // parse one `io.stat` and add tracked disks into `totals`
+  void parse(const char* begin, const char* end);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_CGROUP_IO_H_
@@ -1,35 +1,113 @@
 #ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_CONFIG_H_
 #define DO_NOT_SLEEP_DO_NOT_SLEEP_CONFIG_H_
 
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <filesystem>
+#include <optional>
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "device_class.h"
+#include "device_worker.h"
+#include "discovery.h"
 #include "hms.h"
+#include "io_estimator.h"
+#include "priority.h"
+#include "schedule.h"
 
 namespace ds {
 
 struct Config {
-  enum class Policy : std::uint8_t { INVALID, TIME_RANGE, MONITOR_IO, SERVICE_AVAILABLE };
+  enum class Policy : std::uint8_t {
+    INVALID,
+    TIME_RANGE,
+    SCHEDULE,
+    MONITOR_IO,
+    SERVICE_AVAILABLE,
+    CGROUP_IO,
+    PROCESS_PRESENT,
+    LOCAL_CONNECTION
+  };
+  // how monitor_io notices activity
+  enum class Trigger : std::uint8_t { POLL, FANOTIFY };
+  // how a dir is kept awake: not at all, by rewriting a file in it, or by reading its device past the page cache
+  enum class Keepalive : std::uint8_t { NONE, WRITE, READ };
+  struct ClassPolicy {
+    Keepalive keepalive;
+    // `interval` if zero
+    std::chrono::seconds interval;
+  };
   std::set<std::filesystem::path> dirs;
   std::chrono::seconds interval;
   Policy policy;
   std::pair<HMS, HMS> time_range;
+  // compiled from `time_range` or `schedule`
+  Schedule schedule;
   std::chrono::seconds scan_frequency;
   std::chrono::seconds keep_awake;
+  Trigger trigger;
+  // what I/O counts as activity with the poll trigger
+  IOEstimator::Thresholds activity{.sectors_per_second = 64,
+                                   .ios = 16,
+                                   .half_life = std::chrono::seconds{30},
+                                   .noise_half_life = std::chrono::seconds{3600}};
   std::string service;
+  // cgroup_io
+  std::vector<std::filesystem::path> cgroups;
+  // process_present
+  std::vector<std::string> processes;
+  // local_connection, local TCP ports
+  std::vector<std::uint16_t> ports;
+  // by `DeviceClass::Kind` of the device of each dir
+  std::array<ClassPolicy, DeviceClass::KIND_COUNT> device_classes{DEFAULT_DEVICE_CLASSES};
+  // filesystems on matching devices are added to `dirs` while they are mounted
+  std::vector<Discovery::Rule> discover;
+  // deadline of keepalives and when a device that keeps missing it is retried
+  DeviceWorker::Breaker breaker{.timeout = std::chrono::seconds{60},
+                                .failures = 3,
+                                .backoff = std::chrono::seconds{60},
+                                .max_backoff = std::chrono::seconds{3600}};
+  // no keepalive while the disk of a dir does I/O of its own anyway
+  bool skip_active;
+  // empty if runtime state is not kept across restarts
+  std::filesystem::path state_file;
+  // I/O priority of scheduled keepalives
+  IOPriority keepalive_priority;
+  // I/O priority of keepalives that wake up a disk someone is waiting for
+  IOPriority wake_priority;
+  // SCHED_IDLE, `nice` is ignored if set
+  bool cpu_idle;
+  // unchanged if nullopt
+  std::optional<int> nice;
+  // cgroup v2 to run in, unchanged if empty
+  std::filesystem::path cgroup;
+  // shared memory status page name (shm_open(3)), not published if empty
+  std::string status_page;
+  // spans kept for a dump on SIGUSR1, nothing is recorded if 0
+  std::size_t timeline_spans;
+  // where SIGUSR1 dumps the timeline, nothing is recorded if empty
+  std::filesystem::path timeline_file;
+  // segments of keepalives, skips, I/O and triggers of each dir, nothing is recorded if empty
+  std::filesystem::path history_dir;
+  // older segments are removed
+  std::chrono::hours history_retention;
 
-  static Config from_json(const std::filesystem::path& config_dir = CONFIG_DIR);
+  static Config from_json(const std::filesystem::path& config_dir = default_config_dir());
 
   friend bool operator==(const Config& l, const Config& r);
   friend bool operator!=(const Config& l, const Config& r);
 
   static const Config UNSET;
+  // solid state devices are skipped, zoned ones only read, everything else written
+  static const std::array<ClassPolicy, DeviceClass::KIND_COUNT> DEFAULT_DEVICE_CLASSES;
 
-  static const std::filesystem::path CONFIG_DIR;
+  // resolved on first use, empty if the home directory is unknown
+  static const std::filesystem::path& default_config_dir();
+  static const std::filesystem::path& default_state_file();
 };
 
 } // namespace ds
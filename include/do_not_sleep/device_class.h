@@ -0,0 +1,56 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_DEVICE_CLASS_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_DEVICE_CLASS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+#include "sys/types.h"
+
+namespace ds {
+
+class LogLine;
+
+// What a filesystem is stored on, from sysfs. Virtual devices (loop, dm, md) are classified by the devices below them,
+// e.g. a dm-crypt volume on an SSD is solid state even though the mapper device itself may claim to be rotational.
+struct DeviceClass {
+  // coarse class, picks how and whether a dir is kept awake
+  enum class Kind : std::uint8_t { ROTATIONAL, SOLID_STATE, ZONED, USB, OTHER };
+  enum class Transport : std::uint8_t { UNKNOWN, ATA, SCSI, NVME, USB, VIRTIO, MMC };
+  enum class Zoned : std::uint8_t { NONE, HOST_AWARE, HOST_MANAGED };
+
+  static constexpr std::size_t KIND_COUNT{5};
+
+  Kind kind;
+  bool rotational;
+  Transport transport;
+  Zoned zoned;
+  // loop, dm or md
+  bool is_virtual;
+
+  // class of the device holding the filesystem of `path`, `Kind::OTHER` if it is not a block device (nfs, tmpfs, ...)
+  static DeviceClass of(const std::filesystem::path& path);
+  // e.g. 8:1 for /dev/sda1
+  static DeviceClass of(const dev_t& device);
+
+  // e.g. `solid_state`, as in the config
+  static std::string_view kind_name(const Kind& kind);
+
+  friend LogLine& operator<<(LogLine& line, const DeviceClass& device_class);
+
+protected:
+  // virtual devices stacked deeper than that are not followed
+  static constexpr int MAX_DEPTH{8};
+
+  static const std::filesystem::path SYS_DEV_BLOCK_PATH;
+
+  static DeviceClass of(const dev_t& device, const int& depth);
+  // `block` is a whole disk under /sys/devices
+  static DeviceClass of_disk(const std::filesystem::path& block, const int& depth);
+  void update_kind();
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_DEVICE_CLASS_H_
@@ -0,0 +1,119 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_DEVICE_WORKER_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_DEVICE_WORKER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "do_not_sleep/file.h"
+
+namespace ds {
+
+// Runs the blocking I/O of one device on its own thread and waits for it under a deadline, so a disk stuck in
+// uninterruptible sleep only stalls itself. A job that misses its deadline keeps running (nothing can interrupt it),
+// new jobs are rejected until it returns. After `Breaker::failures` timeouts in a row the device is quarantined and
+// retried after `Breaker::backoff`, doubling up to `Breaker::max_backoff` while it keeps timing out.
+class DeviceWorker {
+public:
+  struct Breaker {
+    std::chrono::seconds timeout;
+    std::uint32_t failures;
+    std::chrono::seconds backoff;
+    std::chrono::seconds max_backoff;
+  };
+
+  enum class Result : std::uint8_t {
+    DONE,
+    // missed its deadline, still running
+    TIMED_OUT,
+    // rejected, the previous job is still running
+    STUCK,
+    // rejected, too many timeouts lately
+    QUARANTINED
+  };
+
+  struct Stats {
+    std::uint64_t done;
+    std::uint64_t timeouts;
+    std::uint64_t rejected;
+    std::uint64_t quarantines;
+    // of the last job that returned
+    std::chrono::nanoseconds last_duration;
+    // longest a job that missed its deadline took to return
+    std::chrono::nanoseconds longest_stuck;
+  };
+
+  DeviceWorker() = delete;
+  // `name` is used in logs, e.g. the dir
+  DeviceWorker(std::string name, const Breaker& breaker);
+  DeviceWorker(const DeviceWorker&) = delete;
+  DeviceWorker(DeviceWorker&& other) noexcept = default;
+  DeviceWorker& operator=(const DeviceWorker&) = delete;
+  DeviceWorker& operator=(DeviceWorker&& other) noexcept;
+
+  // a job still stuck is left behind
+  virtual ~DeviceWorker();
+
+  // start `job` without waiting for it, it must not refer to anything it does not own. DONE if started
+  Result submit(std::function<void()> job);
+  // start the job of the last accepted `submit(job)` again, nothing is copied or allocated
+  Result submit();
+  // wait for the job started by `submit` until `deadline`, returns right away once `running` is false
+  Result wait(const std::chrono::steady_clock::time_point& deadline);
+  // the job started by `submit` has not returned yet
+  [[nodiscard]] bool running() const;
+  // an eventfd(2), maybe shared by several workers, counted up each time a submitted job returns, so a caller can
+  // wait for them in its own event loop; none if null
+  void notify(std::shared_ptr<File> done);
+  // submit and wait for `Breaker::timeout`
+  Result run(std::function<void()> job);
+  // run `job` on the calling thread as if it was submitted and waited for, without a deadline. DONE if it ran
+  Result run_here(const std::function<void()>& job);
+  [[nodiscard]] Stats stats() const;
+  // since when the current job has been running past its deadline, `time_point{}` if none is
+  [[nodiscard]] std::chrono::steady_clock::time_point stuck_since() const;
+  [[nodiscard]] const Breaker& breaker() const;
+
+protected:
+  // outlives the owner if a stuck job is left behind
+  struct Shared {
+    std::mutex mutex;
+    std::condition_variable job_cv;
+    std::condition_variable done_cv;
+    // kept after it returns, `submit()` runs it again
+    std::function<void()> job;
+    // `job` is to be run
+    bool pending;
+    // a job was submitted and has not returned yet
+    bool busy;
+    // the owner stopped waiting for the current job
+    bool abandoned;
+    bool stop;
+    std::chrono::steady_clock::time_point started;
+    Stats stats;
+    // of `notify`, may outlive the owner too
+    std::shared_ptr<File> done;
+  };
+
+  std::string name;
+  Breaker limits;
+  std::shared_ptr<Shared> shared;
+  // started by the first `submit`
+  std::thread thread;
+  // only touched by the owner
+  std::uint32_t failures;
+  std::chrono::seconds backoff;
+  std::chrono::steady_clock::time_point quarantined_until;
+
+  void release();
+  static void loop(const std::shared_ptr<Shared>& shared, const std::string& name);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_DEVICE_WORKER_H_
@@ -0,0 +1,79 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_DISCOVERY_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_DISCOVERY_H_
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sys/types.h"
+
+namespace ds {
+
+// Finds filesystems on devices matching some rules as they come and go. The caller polls `uevents_fd` for kernel
+// uevents (NETLINK_KOBJECT_UEVENT, EPOLLIN) and `mounts_fd` for changes of /proc/self/mountinfo (EPOLLPRI) and calls
+// `changed` when either fired, nothing is read while nothing changes. EPOLLPRI of mountinfo is consumed by the first
+// poll that sees it, which for an epoll nesting `mounts_fd` is whoever polls that epoll, so `changed` asks a second
+// open mountinfo that nobody else polls.
+// Devices are described by the udev database (/run/udev/data), sysfs is used for what udev does not know.
+class Discovery {
+public:
+  // empty fields match anything
+  struct Rule {
+    std::string serial;
+    std::string wwn;
+    std::string model;
+    // filesystem label
+    std::string label;
+  };
+
+  // discovers nothing
+  Discovery();
+  explicit Discovery(std::vector<Rule> rules);
+  Discovery(const Discovery&) = delete;
+  Discovery(Discovery&& other) noexcept;
+  Discovery& operator=(const Discovery&) = delete;
+  Discovery& operator=(Discovery&& other) noexcept;
+
+  virtual ~Discovery();
+
+  [[nodiscard]] bool good() const;
+  // EPOLLPRI when the mount table changed
+  [[nodiscard]] int mounts_fd() const;
+  // EPOLLIN when devices may have changed, -1 if uevents are not available
+  [[nodiscard]] int uevents_fd() const;
+  // when `changed` is to be called at the latest, `time_point::max()` if only the fds tell
+  [[nodiscard]] std::chrono::steady_clock::time_point next_deadline() const;
+  // without blocking, `uevents` if `uevents_fd` fired; true if `scan` may find something new
+  bool changed(const bool& uevents);
+  // mount points of filesystems on matching devices, the first one if a filesystem is mounted more than once
+  [[nodiscard]] std::vector<std::filesystem::path> scan() const;
+
+protected:
+  // udev handles a uevent a little after the kernel sent it, look again after that
+  static const std::chrono::milliseconds SETTLE_TIME;
+  static const std::filesystem::path MOUNT_INFO_PATH;
+  static const std::filesystem::path UDEV_DATA_PATH;
+  static const std::filesystem::path SYS_DEV_BLOCK_PATH;
+
+  std::vector<Rule> rules;
+  int uevent_fd;
+  // only wakes up the caller
+  int mountinfo_fd;
+  // only polled by `changed`
+  int mountinfo_changed_fd;
+  // `time_point{}` if no uevent is waiting for udev
+  std::chrono::steady_clock::time_point settle_at;
+
+  // true if a block device changed
+  bool read_uevents();
+  void close_fds();
+  [[nodiscard]] bool matches(const dev_t& device) const;
+  // `ID_SERIAL`, `ID_FS_LABEL`, ... of `device`
+  static std::unordered_map<std::string, std::string> properties(const dev_t& device);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_DISCOVERY_H_
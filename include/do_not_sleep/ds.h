@@ -1,26 +1,62 @@
 #ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_DS_H_
 #define DO_NOT_SLEEP_DO_NOT_SLEEP_DS_H_
 
+#include <atomic>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
 #include <initializer_list>
 #include <limits>
+#include <memory>
+#include <optional>
 #include <random>
 #include <utility>
+#include <vector>
 
+#include "do_not_sleep/access_watcher.h"
+#include "do_not_sleep/block_info.h"
+#include "do_not_sleep/cgroup_io.h"
 #include "do_not_sleep/config.h"
+#include "do_not_sleep/device_class.h"
+#include "do_not_sleep/device_worker.h"
+#include "do_not_sleep/discovery.h"
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/history.h"
 #include "do_not_sleep/hms.h"
+#include "do_not_sleep/io_estimator.h"
+#include "do_not_sleep/local_connections.h"
+#include "do_not_sleep/priority.h"
+#include "do_not_sleep/proc_watcher.h"
+#include "do_not_sleep/service_probe.h"
+#include "do_not_sleep/state_file.h"
+#include "do_not_sleep/status_writer.h"
+#include "do_not_sleep/timeline.h"
+#include "do_not_sleep/util.h"
 
 namespace ds {
 
 using RandByteEngine
   = std::independent_bits_engine<std::mt19937, std::numeric_limits<std::uint8_t>::digits, std::uint8_t>;
 
+// Keeps the dirs of a config awake. All of its state is its own, several can run in one process; `start` runs one
+// until it stops, or a caller drives it from its own event loop:
+//
+//   if (ds.open()) {
+//     // epoll_ctl(loop_fd, EPOLL_CTL_ADD, ds.fd(), EPOLLIN)
+//     // on EPOLLIN of `ds.fd()` or at `ds.next_deadline()`: if (!ds.process_events()) { /* stopped */ }
+//   }
+//
+// `process_events` never blocks: keepalives run on the workers and are recorded by a later call once `fd` tells they
+// returned (or at their `hung_io.timeout`), a service is resolved and probed in the background. The state file, the
+// history and the status page are locked by the instance that opened them, another one with the same paths refuses to
+// open. `cgroup`, `nice` and `cpu_idle` apply to the calling thread (the cgroup to the whole process) and a timeline
+// dump blocks SIGUSR1, leave them unset when embedding.
 class DoNotSleep {
 public:
+  // from the config file
   DoNotSleep();
+  explicit DoNotSleep(Config config);
   DoNotSleep(std::initializer_list<std::filesystem::path> dirs,
              std::chrono::seconds interval = std::chrono::seconds{30},
              std::pair<HMS, HMS> time_range = {HMS::UNSET, HMS::UNSET});
@@ -28,27 +64,221 @@ public:
              std::chrono::seconds interval = std::chrono::seconds{30},
              std::chrono::seconds scan_frequency = std::chrono::seconds{1},
              std::chrono::seconds keep_awake = std::chrono::seconds{300});
-  DoNotSleep(const DoNotSleep&) = default;
+  DoNotSleep(const DoNotSleep&) = delete;
   DoNotSleep(DoNotSleep&&) noexcept = default;
-  DoNotSleep& operator=(const DoNotSleep&) = default;
+  DoNotSleep& operator=(const DoNotSleep&) = delete;
   DoNotSleep& operator=(DoNotSleep&&) noexcept = default;
 
   virtual ~DoNotSleep() = default;
 
+  // open and process events until the policy stops
   void start();
+  // evaluate the policy, keep awake the dirs it asks for and return (e.g. from a systemd timer), false on errors
+  bool once();
+  // load the state, find the targets and set up the policy, false if there is nothing to do
+  bool open();
+  // readable (epoll) when `process_events` has something to do, -1 before `open`
+  [[nodiscard]] int fd() const;
+  // when `process_events` is to be called at the latest, `time_point::max()` if only `fd` tells
+  [[nodiscard]] std::chrono::steady_clock::time_point next_deadline() const;
+  // handle what `fd` tells and whatever is due, false once the policy stopped (or before `open`)
+  bool process_events();
 
 protected:
+  // what the keepalives of a target use, built once by `add_target` and owned by its worker too (a stuck keepalive
+  // may outlive the target)
+  struct KeepaliveJob {
+    std::filesystem::path dir;
+    // `dir / DS_FILENAME`
+    std::filesystem::path ds_file;
+    // e.g. `/dev/sda1`, only for `Config::Keepalive::READ`
+    std::filesystem::path device_node;
+    Config::Keepalive keepalive;
+    IOPriority keepalive_priority;
+    IOPriority wake_priority;
+    std::shared_ptr<Timeline> timeline;
+    // of the next run, set before it is submitted; a stuck run may still read them
+    std::atomic<std::uint64_t> random;
+    std::atomic<bool> wake;
+  };
+
+  // I/O counters of the disk of a target, its keepalives are skipped while other I/O keeps it awake anyway
+  struct DiskActivity {
+    // kept open, not good if the disk is unknown (nothing is skipped then)
+    File stat;
+    std::filesystem::path stat_file;
+    std::pair<std::uint64_t, std::uint64_t> io;
+    // when `io` was read (unix time in milliseconds), 0 if never
+    std::int64_t sampled_ms;
+    // the disk did I/O at or after this time, 0 if not seen
+    std::int64_t active_ms;
+    std::uint64_t skipped;
+    // a skip is counted once per interval
+    std::int64_t skipped_until_ms;
+  };
+
+  // a target watched by monitor IO with the poll trigger
+  struct MonitorCtx {
+    std::size_t target;
+    // none while replaying
+    std::optional<BlockInfo> block_info;
+    // read and write I/Os of the last sample
+    std::pair<std::uint64_t, std::uint64_t> io;
+    // tells its own I/O from activity
+    IOEstimator estimator;
+    // a keepalive of ours is under way, its I/O is left out once it returned
+    bool rebase;
+    std::chrono::seconds awake_time_remaining;
+    std::chrono::seconds time_until_next_ticktock;
+  };
+
+  // a target watched by monitor IO with the fanotify trigger
+  struct AccessCtx {
+    std::size_t target;
+    bool ticking;
+  };
+
+  // a dir from `config.dirs` and what is known about it
+  struct Target {
+    std::filesystem::path dir;
+    // slot in `state_file`, `StateFile::NO_SLOT` if not persisted
+    std::size_t slot;
+    // of `dir` in `history`
+    std::uint32_t history_id;
+    StateFile::DeviceState state;
+    std::chrono::nanoseconds last_latency;
+    DeviceClass device_class;
+    Config::Keepalive keepalive;
+    // between keepalives, from the policy of `device_class`
+    std::chrono::seconds interval;
+    // all I/O on the dir goes through it
+    DeviceWorker worker;
+    std::shared_ptr<KeepaliveJob> job;
+    // `job` was handed to `worker`, later keepalives restart it without allocating
+    bool job_submitted;
+    DiskActivity activity;
+    // found by `discovery`, not from `config.dirs`
+    bool discovered;
+    // when the keepalive under way is given up on, `time_point{}` if none is
+    std::chrono::steady_clock::time_point keepalive_deadline;
+    bool keepalive_wake;
+  };
+
   Config config;
   RandByteEngine rand_engine;
+  std::vector<Target> targets;
+  StateFile state_file;
+  History history;
+  StatusWriter status_writer;
+  Discovery discovery;
+  LatencyStats keepalive_latency{};
+  LatencyStats wake_latency{};
+  // how late scheduled keepalives ran
+  LatencyStats schedule_jitter{};
+  std::chrono::steady_clock::time_point last_latency_log{};
+  // of `keep_awake_due` and `keep_awake_all`, reused so rounds do not allocate
+  std::vector<std::size_t> due_targets;
+  std::vector<std::size_t> started_targets;
+  // started by `once`, state is only kept in `state_file`
+  bool one_shot{false};
+  // the policy logs nothing to stdout
+  bool quiet{false};
+  // shared with the jobs on the workers, which may outlive us
+  std::shared_ptr<Timeline> timeline{std::make_shared<Timeline>(0)};
+  std::unique_ptr<TimelineDumper> timeline_dumper;
+  // what the policy waits for, kept between `process_events` calls
+  bool opened{false};
+  // epoll over the event sources of the policy, of `discovery` and `keepalives_done`
+  File events;
+  // eventfd(2) counted up by the workers each time a keepalive returns, they may outlive us
+  std::shared_ptr<File> keepalives_done;
+  // when the policy is to be looked at again, `time_point::max()` if only its events tell
+  std::chrono::steady_clock::time_point deadline{};
+  std::vector<MonitorCtx> monitor_blocks;
+  std::optional<AccessWatcher> access_watcher;
+  std::vector<AccessCtx> access_blocks;
+  // of `access_watcher`, reused
+  std::vector<std::size_t> triggered;
+  ServiceProbe service_probe;
+  bool service_up{false};
+  std::optional<CgroupIO> cgroup_io;
+  // counters index and next keepalive (unix time in milliseconds) of each target
+  std::vector<std::pair<std::size_t, std::int64_t>> cgroup_blocks;
+  std::optional<ProcWatcher> proc_watcher;
+  bool processes_running{false};
+  std::optional<LocalConnections> connections;
+  std::size_t connection_count{0};
 
-  void start_time_range();
-  void start_monitor_io();
-  void start_service_available();
+  // load the state, find the targets and publish them, false if there is nothing to do or another instance uses the
+  // same paths
+  bool prepare();
+  // when the policy is to be looked at again, keepalives under way aside
+  [[nodiscard]] std::chrono::steady_clock::time_point next_look() const;
+  // the event sources and state of `config.policy`, false if it cannot run
+  virtual bool open_policy();
+  // the clocks of the policy steps, simulated by a replay
+  [[nodiscard]] virtual std::int64_t wall_ms() const;
+  [[nodiscard]] virtual std::chrono::steady_clock::time_point steady_now() const;
+  // counters of the disk of `block` for monitor IO, false on error
+  virtual bool sample_disk(MonitorCtx& block, BlockInfo::Counters& out);
+  // accesses since the last call into `triggered` for monitor IO with fanotify, false on error
+  virtual bool wait_accesses();
+  // read the counters of the tracked cgroups for cgroup IO, false if none could be read
+  virtual bool scan_cgroups();
+  // of `cgroup_blocks[i].first`, as of the last `scan_cgroups`
+  [[nodiscard]] virtual const CgroupIO::Counters& cgroup_counters(const std::size_t& index) const;
+  // look at the policy once, keep awake what it asks for and `wait` for the next look, false once it stopped
+  bool step_schedule();
+  bool step_monitor_io();
+  bool step_monitor_access();
+  bool step_service_available();
+  bool step_cgroup_io();
+  bool step_process_present();
+  bool step_local_connection();
   bool sanitize_config();
-  void tick_tock(const std::filesystem::path& dir);
+  // false if `dir` cannot be kept awake
+  bool add_target(const std::filesystem::path& dir, const bool& discovered);
+  // add and remove discovered targets
+  void refresh_targets();
+  // look at the policy again in `duration` at the latest, only when its events tell if negative
+  void wait(const std::chrono::milliseconds& duration);
+  static void tick_tock(const KeepaliveJob& job, const std::uint64_t& random);
+  // read a random block of the device with O_DIRECT, never served from a cache in memory
+  static void read_block(const KeepaliveJob& job, const std::uint64_t& random);
+  // on the worker of the target, or in place in a one-shot run
+  static void run_keepalive(const KeepaliveJob& job);
+  // start a tick_tock, remembered once it returned; `wake` if someone is waiting for the disk
+  void keep_awake(Target& target, const bool& wake = false);
+  // keep awake `targets[i]` for each of `indices` in parallel, a one-shot run waits for them
+  void keep_awake_all(const std::vector<std::size_t>& indices, const bool& wake);
+  // remember the keepalives under way that returned or timed out
+  void finish_keepalives();
+  // start a keepalive on the worker of `target` (or run it on this thread if `in_place`), false if it is stuck or
+  // quarantined
+  virtual bool start_keep_awake(Target& target, const bool& wake, const bool& in_place = false);
+  // wait for it until `deadline` and remember it
+  virtual void finish_keep_awake(Target& target,
+                                 const bool& wake,
+                                 const std::chrono::steady_clock::time_point& deadline);
+  void apply_priority();
+  void log_latency();
+  // keep awake targets that are due, return when the next one is due (unix time in milliseconds)
+  std::int64_t keep_awake_due(const std::int64_t& now_ms);
+  // sample the disk activity of `target` and tell whether its keepalive is due
+  bool keepalive_due(Target& target, const std::int64_t& now_ms);
+  // one interval after the last keepalive or the last I/O seen on the disk, whichever is later
+  [[nodiscard]] std::int64_t next_keepalive_ms(const Target& target, const std::int64_t& now_ms) const;
+  // when the disk activity of `target` is to be sampled again, max if it is not sampled
+  [[nodiscard]] std::int64_t next_sample_ms(const Target& target) const;
+  // persist and publish
+  void save(const Target& target);
 
   static const std::filesystem::path DS_FILENAME;
   static const std::size_t DS_RAND_BYTE_COUNT;
+  // O_DIRECT needs aligned buffers and offsets
+  static constexpr std::size_t DS_READ_BLOCK_SIZE{4096};
+  static const std::chrono::seconds MAX_SCHEDULE_SLEEP;
+  static const std::chrono::seconds LATENCY_LOG_PERIOD;
 };
 
 } // namespace ds
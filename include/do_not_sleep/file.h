@@ -0,0 +1,57 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_FILE_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_FILE_H_
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+#include "sys/types.h"
+
+namespace ds {
+
+// A file descriptor, closed on destruction. Thin wrappers over the syscalls used on hot paths (sysfs and procfs
+// reads, keepalive writes), no buffering, no locale, nothing allocated except by `read_all`. Calls are retried on
+// EINTR and short writes; on failure they return false (-1) and `error` tells the errno.
+class File {
+public:
+  // not open
+  File();
+  // open(2) with O_CLOEXEC added
+  File(const std::filesystem::path& path, const int& flags, const mode_t& mode = 0644);
+  // owns `fd` from now on, e.g. from epoll_create1(2); -1 (with errno set) if that failed
+  explicit File(const int& fd);
+  File(const File&) = delete;
+  File(File&& other) noexcept;
+  File& operator=(const File&) = delete;
+  File& operator=(File&& other) noexcept;
+
+  virtual ~File();
+
+  [[nodiscard]] bool good() const;
+  [[nodiscard]] int fd() const;
+  // errno of the last failed call, 0 if none failed
+  [[nodiscard]] int error() const;
+
+  // up to `size` bytes at `offset` in one read(2), fewer at the end of the file (or of a procfs chunk), -1 on errors
+  ssize_t pread(void* buf, const std::size_t& size, const off_t& offset);
+  // all of `size` bytes at `offset`
+  bool pwrite(const void* buf, const std::size_t& size, const off_t& offset);
+  bool truncate(const off_t& size);
+  // data (and the metadata needed to read it back) reaches the device
+  bool fdatasync();
+  // the whole file from offset 0 into `out`, e.g. a sysfs attribute, reusing its capacity
+  bool read_all(std::string& out);
+
+  // `path` into `out`, false (and `out` empty) if it cannot be read
+  static bool read_file(const std::filesystem::path& path, std::string& out);
+
+protected:
+  int file_fd;
+  int last_error;
+
+  void close_fd();
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_FILE_H_
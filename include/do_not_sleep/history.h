@@ -0,0 +1,151 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_HISTORY_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_HISTORY_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "do_not_sleep/device_worker.h"
+
+namespace ds {
+
+// What happened to each disk over months, appended to memory-mapped segment files of a fixed size in a directory.
+// A record is a varint time delta from the previous one, its kind, the device and a few varint fields, most take 4 to
+// 8 bytes; a segment starts with the dirs of the devices it refers to, so each can be read on its own. Segments
+// entirely older than the retention are removed when a new one is started. A record is published by bumping the used
+// size in the header after it is written, a crash loses at most the record being appended. The directory is locked
+// (flock(2)) by the instance appending to it, another one finds it `in_use` and records nothing; readers take no lock.
+class History {
+public:
+  enum class Kind : std::uint8_t {
+    // `device` is `dir` from now on
+    DEVICE,
+    // I/O completed on the disk since the previous one
+    IO,
+    KEEPALIVE,
+    // a keepalive was due, the disk was busy anyway
+    SKIP,
+    // the policy asked for the disk to be awake
+    TRIGGER
+  };
+
+  // by policy: monitor_io with fanotify, monitor_io, process_present, cgroup_io, service_available, local_connection
+  enum class Trigger : std::uint8_t { ACCESS, DISK_IO, PROCESS, CGROUP_IO, SERVICE, CONNECTION };
+
+  struct Event {
+    // unix time in milliseconds
+    std::int64_t time_ms;
+    Kind kind;
+    std::uint32_t device;
+    // of `device`, valid during the visit only
+    std::string_view dir;
+    // `Kind::IO`
+    std::uint64_t reads;
+    std::uint64_t writes;
+    // `Kind::KEEPALIVE`, latency is 0 unless it is done
+    bool wake;
+    DeviceWorker::Result result;
+    std::chrono::microseconds latency;
+    // `Kind::TRIGGER`
+    Trigger trigger;
+  };
+
+  // a keepalive that took this long had to wait for the disk to spin up
+  static constexpr std::chrono::microseconds SPIN_UP{1000000};
+  static constexpr std::size_t SEGMENT_SIZE{1U << 20U};
+
+  // records nothing
+  History();
+  History(std::filesystem::path dir, const std::chrono::hours& retention);
+  History(const History&) = delete;
+  History(History&& other) noexcept;
+  History& operator=(const History&) = delete;
+  History& operator=(History&& other) noexcept;
+
+  virtual ~History();
+
+  [[nodiscard]] bool good() const;
+  // records nothing, another instance appends to `dir`
+  [[nodiscard]] bool in_use() const;
+  // id of `dir` in records, assigned on first use
+  std::uint32_t device(const std::filesystem::path& dir);
+  void io(const std::uint32_t& device, const std::uint64_t& reads, const std::uint64_t& writes);
+  void keepalive(const std::uint32_t& device,
+                 const bool& wake,
+                 const DeviceWorker::Result& result,
+                 const std::chrono::nanoseconds& latency);
+  void skip(const std::uint32_t& device);
+  void trigger(const std::uint32_t& device, const Trigger& trigger);
+
+  // every event but `Kind::DEVICE` in the segments of `dir` from `since_ms` on, in order, false if there are none
+  static bool read(const std::filesystem::path& dir,
+                   const std::int64_t& since_ms,
+                   const std::function<void(const Event&)>& visit);
+  // keepalives, spin-ups and what asked for them, skips and I/O of each device since `since_ms`
+  static bool summarize(const std::filesystem::path& dir, const std::int64_t& since_ms, std::ostream& out);
+  // one line per event since `since_ms`
+  static bool export_csv(const std::filesystem::path& dir, const std::int64_t& since_ms, std::ostream& out);
+
+  // local time, the way the log prints it
+  static void write_time(std::ostream& out, const std::int64_t& time_ms);
+  static std::string_view to_string(const Kind& kind);
+  static std::string_view to_string(const Trigger& trigger);
+
+protected:
+  static constexpr std::uint32_t VERSION{1};
+  static const char MAGIC[8];
+  static const std::filesystem::path SEGMENT_EXTENSION;
+  // dirs are cut to it, like in the state file
+  static constexpr std::size_t DIR_LENGTH{255};
+  // the longest record, a device with the longest dir
+  static constexpr std::size_t MAX_RECORD{64 + DIR_LENGTH};
+
+  struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t size;
+    // unix time in milliseconds, the first record is relative to it
+    std::int64_t start_ms;
+    // bytes of records after the header, only ever grows
+    std::uint32_t used;
+    std::uint32_t reserved;
+  };
+
+  std::filesystem::path dir;
+  std::chrono::hours retention;
+  // of `dir`, holds the lock
+  int lock_fd;
+  bool contended;
+  int fd;
+  Header* header;
+  // time of the last record in the current segment
+  std::int64_t last_ms;
+  // by id
+  std::vector<std::string> devices;
+
+  void append(const Event& event);
+  // start a new segment and remove the expired ones
+  bool rotate(const std::int64_t& now_ms);
+  // continue the newest segment if it has room, recovering its devices
+  bool resume();
+  void unmap();
+  [[nodiscard]] std::uint8_t* records() const;
+
+  // segments of `dir` by start time, oldest first
+  static std::vector<std::pair<std::int64_t, std::filesystem::path>> segments(const std::filesystem::path& dir);
+  static std::size_t encode(const Event& event, const std::int64_t& last_ms, std::uint8_t* out);
+  // bytes of the record at `in`, 0 if it is malformed
+  static std::size_t decode(const std::uint8_t* in, const std::size_t& size, std::int64_t& last_ms, Event& out);
+  // the events of one mapped segment, `Kind::DEVICE` ones too
+  static void scan(const Header& header, const std::function<void(const Event&)>& visit);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_HISTORY_H_
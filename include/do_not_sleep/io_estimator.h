@@ -0,0 +1,94 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_IO_ESTIMATOR_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_IO_ESTIMATOR_H_
+
+#include <chrono>
+#include <cstdint>
+
+#include "do_not_sleep/block_info.h"
+
+namespace ds {
+
+// Tells activity of someone from the I/O a disk does on its own: journal commits, SMART polls, atime updates and our
+// own metadata writes show up in the counters of an otherwise idle disk every few seconds.
+// Read and write rates decay with a half-life, which evens out periodic noise into a steady rate. A floor follows the
+// rates down right away and up slowly, so it settles at the level of the noise between bursts, along with how far the
+// rates usually stray above it. Activity is either rate above both by its threshold: a copy is a lot of sectors in few
+// I/Os, browsing a share many I/Os of few sectors. Each sample updates a few numbers whatever the interval since the
+// previous one, nothing is kept of older samples.
+class IOEstimator {
+public:
+  struct Thresholds {
+    // reads and writes above the noise
+    double sectors_per_second;
+    // I/Os above the noise, as many right away or a few per second for a while
+    double ios;
+    // of the rates, longer evens out more noise and notices activity later
+    std::chrono::seconds half_life;
+    // of the noise floor rising, activity sustained for about this long becomes noise
+    std::chrono::seconds noise_half_life;
+  };
+
+  // what it learned and its last sample, for a later run to go on from there, e.g. in the state file
+  struct State {
+    BlockInfo::Counters last;
+    // of `last`, unix time in milliseconds, 0 if none
+    std::int64_t last_ms;
+    std::uint64_t updates;
+    double read_sectors;
+    double write_sectors;
+    double ios;
+    double sector_floor;
+    double sector_spread;
+    double io_floor;
+    double io_spread;
+    bool measured;
+    bool active;
+  };
+
+  IOEstimator() = delete;
+  explicit IOEstimator(const Thresholds& thresholds);
+
+  // counters read at `now`, whether the disk is active
+  bool update(const BlockInfo::Counters& counters, const std::chrono::steady_clock::time_point& now);
+  // counters after I/O that does not count, e.g. our keepalive
+  void rebase(const BlockInfo::Counters& counters, const std::chrono::steady_clock::time_point& now);
+
+  // `now` and `now_ms` (unix time in milliseconds) are the same instant, the steady clock does not outlive the process
+  [[nodiscard]] State save(const std::chrono::steady_clock::time_point& now, const std::int64_t& now_ms) const;
+  // go on from `state`, I/O since its last sample is taken over the time in between
+  void restore(const State& state, const std::chrono::steady_clock::time_point& now, const std::int64_t& now_ms);
+
+  // as of the last `update`
+  [[nodiscard]] bool active() const;
+  // sectors per second
+  [[nodiscard]] double read_rate() const;
+  // sectors per second
+  [[nodiscard]] double write_rate() const;
+  // sectors per second of reads and writes the disk does on its own
+  [[nodiscard]] double noise_rate() const;
+
+protected:
+  Thresholds thresholds;
+  BlockInfo::Counters last;
+  std::chrono::steady_clock::time_point last_time;
+  // `last` is valid
+  bool sampled;
+  // the rates start at the first one measured rather than decaying from 0
+  bool measured;
+  // quiet ones since `measured`
+  std::uint64_t updates;
+  // per second, decayed
+  double read_sectors;
+  double write_sectors;
+  double ios;
+  // noise, per second
+  double sector_floor;
+  double sector_spread;
+  double io_floor;
+  double io_spread;
+  bool is_active;
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_IO_ESTIMATOR_H_
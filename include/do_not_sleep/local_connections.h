@@ -0,0 +1,47 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_LOCAL_CONNECTIONS_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_LOCAL_CONNECTIONS_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ds {
+
+// Counts established TCP connections on local ports (e.g. clients of our SMB/NFS server) with a NETLINK_SOCK_DIAG
+// dump. Ports are filtered by inet_diag bytecode in the kernel, so a check is one round-trip per address family and
+// only matching sockets are ever copied out, no traffic is sent anywhere.
+class LocalConnections {
+public:
+  LocalConnections() = delete;
+  explicit LocalConnections(const std::vector<std::uint16_t>& ports);
+  LocalConnections(const LocalConnections&) = delete;
+  LocalConnections(LocalConnections&& other) noexcept;
+  LocalConnections& operator=(const LocalConnections&) = delete;
+  LocalConnections& operator=(LocalConnections&& other) noexcept;
+
+  virtual ~LocalConnections();
+
+  [[nodiscard]] bool good() const;
+  // established TCP connections (IPv4 and IPv6) on any of the ports, false on error
+  bool count(std::size_t& out_count);
+
+protected:
+  static constexpr std::size_t BUF_SIZE{16 * 1024};
+
+  int netlink_fd;
+  // netlink header, inet_diag_req_v2 and the bytecode filter, built once
+  std::vector<char> request;
+  std::uint32_t seq;
+  // netlink messages are 4-byte aligned
+  alignas(std::uint32_t) std::array<char, BUF_SIZE> buf;
+
+  // sockets of one address family
+  bool dump(const std::uint8_t& family, std::size_t& out_count);
+  // accepts sockets whose local port is one of `ports`
+  static std::vector<char> bytecode(const std::vector<std::uint16_t>& ports);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_LOCAL_CONNECTIONS_H_
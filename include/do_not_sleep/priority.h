@@ -0,0 +1,46 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_PRIORITY_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_PRIORITY_H_
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+
+namespace ds {
+
+class LogLine;
+
+// see ioprio_set(2), only honored by I/O schedulers that support priorities (bfq)
+struct IOPriority {
+  enum class Class : std::uint8_t { NONE, REALTIME, BEST_EFFORT, IDLE };
+  Class io_class;
+  // 0 (highest) - 7, unused by `IDLE`
+  std::uint8_t level;
+
+  static const IOPriority UNSET;
+
+  friend bool operator==(const IOPriority& l, const IOPriority& r);
+  friend bool operator!=(const IOPriority& l, const IOPriority& r);
+  friend LogLine& operator<<(LogLine& line, const IOPriority& priority);
+};
+
+// I/O priority of the calling thread
+bool set_io_priority(const IOPriority& priority);
+// SCHED_IDLE for the calling thread
+bool set_cpu_idle();
+// nice value of the calling thread
+bool set_nice(const int& nice);
+// move this process into the cgroup v2 at `cgroup` (e.g. `/sys/fs/cgroup/background.slice/do-not-sleep`)
+bool join_cgroup(const std::filesystem::path& cgroup);
+
+struct LatencyStats {
+  std::uint64_t count;
+  std::chrono::nanoseconds total;
+  std::chrono::nanoseconds max;
+
+  void add(const std::chrono::nanoseconds& latency);
+  [[nodiscard]] std::chrono::nanoseconds mean() const;
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_PRIORITY_H_
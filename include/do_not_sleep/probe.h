@@ -0,0 +1,36 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_PROBE_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_PROBE_H_
+
+// USDT probes of the provider `do_not_sleep`, e.g.
+//   bpftrace -e 'usdt:/usr/bin/do-not-sleep:do_not_sleep:keepalive_done { printf("%s %d\n", str(arg0), arg1); }'
+// A probe is a single nop in the code and a note in the ELF file until a tracer attaches to it. Without <sys/sdt.h>
+// (systemtap-sdt-dev, systemtap-sdt-devel) or with `DS_NO_PROBES` defined, probes compile to nothing. Arguments are
+// evaluated either way, keep them cheap: integers and C strings only.
+#if !defined(DS_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define DS_HAS_PROBES 1
+#endif
+#endif
+
+#ifdef DS_HAS_PROBES
+
+#include <sys/sdt.h>
+
+#define DS_PROBE(name) DTRACE_PROBE(do_not_sleep, name)
+#define DS_PROBE1(name, a1) DTRACE_PROBE1(do_not_sleep, name, a1)
+#define DS_PROBE2(name, a1, a2) DTRACE_PROBE2(do_not_sleep, name, a1, a2)
+#define DS_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(do_not_sleep, name, a1, a2, a3)
+#define DS_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(do_not_sleep, name, a1, a2, a3, a4)
+
+#else
+
+#define DS_PROBE(name) static_cast<void>(0)
+#define DS_PROBE1(name, a1) static_cast<void>(a1)
+#define DS_PROBE2(name, a1, a2) (static_cast<void>(a1), static_cast<void>(a2))
+#define DS_PROBE3(name, a1, a2, a3) (static_cast<void>(a1), static_cast<void>(a2), static_cast<void>(a3))
+#define DS_PROBE4(name, a1, a2, a3, a4) \
+  (static_cast<void>(a1), static_cast<void>(a2), static_cast<void>(a3), static_cast<void>(a4))
+
+#endif
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_PROBE_H_
@@ -0,0 +1,60 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_PROC_WATCHER_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_PROC_WATCHER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "sys/types.h"
+
+namespace ds {
+
+// Keeps the set of running processes with one of the given names (as in `/proc/<pid>/comm`) up to date from the
+// netlink proc connector (requires CAP_NET_ADMIN), /proc is only scanned at startup or after lost events.
+class ProcWatcher {
+public:
+  ProcWatcher() = delete;
+  explicit ProcWatcher(const std::vector<std::string>& names);
+  ProcWatcher(const ProcWatcher&) = delete;
+  ProcWatcher(ProcWatcher&& other) noexcept;
+  ProcWatcher& operator=(const ProcWatcher&) = delete;
+  ProcWatcher& operator=(ProcWatcher&& other) noexcept;
+
+  virtual ~ProcWatcher();
+
+  // false if the proc connector is unavailable
+  [[nodiscard]] bool good() const;
+  // number of matching processes running
+  [[nodiscard]] std::size_t running() const;
+  // readable (epoll) when process events are waiting, `wait` with a zero timeout applies them
+  [[nodiscard]] int fd() const;
+  // wait for process events until `timeout` (negative for infinite) and apply them, false on error
+  bool wait(std::chrono::milliseconds timeout);
+
+  // number of processes with one of `names` running right now, from a scan of /proc without the proc connector
+  static std::size_t count_running(const std::vector<std::string>& names);
+
+protected:
+  int netlink_fd;
+  std::vector<std::string> names;
+  // sorted, its capacity is kept so process events do not allocate
+  std::vector<pid_t> pids;
+
+  bool subscribe();
+  // unsubscribe and close
+  void release();
+  void scan_proc();
+  // read pending events without blocking
+  bool read_events();
+  // the pids with one of `names` (truncated as in comm) into `out`, sorted
+  static void scan_proc(const std::vector<std::string>& names, std::vector<pid_t>& out);
+  [[nodiscard]] static bool matches(const pid_t& pid, const std::vector<std::string>& names);
+  [[nodiscard]] bool tracked(const pid_t& pid) const;
+  void track(const pid_t& pid);
+  void untrack(const pid_t& pid);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_PROC_WATCHER_H_
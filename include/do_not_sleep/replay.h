@@ -0,0 +1,101 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_REPLAY_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_REPLAY_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "do_not_sleep/block_info.h"
+#include "do_not_sleep/cgroup_io.h"
+#include "do_not_sleep/config.h"
+#include "do_not_sleep/ds.h"
+#include "do_not_sleep/history.h"
+
+namespace ds {
+
+// Runs the policy of a config over the I/O and triggers recorded in a history instead of over the disks, on a clock
+// of its own, and tells how many keepalives it would have done against the recorded ones: what another `interval`,
+// `keep_awake` or threshold would have done with the same weeks. Nothing is written, to the dirs, the state file or
+// the history.
+//
+// Schedules, monitor_io (both triggers) and cgroup_io are replayed; process_present, service_available and
+// local_connection only record when they start asking for the disks, not when they stop, and are refused.
+class Replay : public DoNotSleep {
+public:
+  Replay() = delete;
+  explicit Replay(Config config);
+  Replay(const Replay&) = delete;
+  Replay(Replay&&) noexcept = default;
+  Replay& operator=(const Replay&) = delete;
+  Replay& operator=(Replay&&) noexcept = default;
+
+  // replay the events in `history_dir` from `since_ms` on and compare per dir into `out`, false if there are none or
+  // the policy cannot be replayed
+  bool run(const std::filesystem::path& history_dir, const std::int64_t& since_ms, std::ostream& out);
+
+protected:
+  // a recorded event, fed to the policy once the clock gets there
+  struct Input {
+    std::int64_t time_ms;
+    std::size_t target;
+    History::Kind kind;
+    History::Trigger trigger;
+    std::uint64_t reads;
+    std::uint64_t writes;
+  };
+
+  // of each target
+  struct Tally {
+    std::uint64_t recorded_keepalives;
+    std::uint64_t recorded_wakes;
+    std::uint64_t recorded_spin_ups;
+    std::uint64_t recorded_skips;
+    std::uint64_t keepalives;
+    std::uint64_t wakes;
+    std::uint64_t io_records;
+    std::uint64_t triggers;
+  };
+
+  static constexpr std::size_t NO_TARGET{std::numeric_limits<std::size_t>::max()};
+
+  // unix time in milliseconds, both clocks of the policy steps
+  std::int64_t clock_ms{0};
+  std::vector<Input> inputs;
+  std::vector<Tally> tallies;
+  // targets by recorded dir, `NO_TARGET` if the config does not keep it awake
+  std::map<std::string, std::size_t, std::less<>> by_dir;
+  // what the disk and the cgroups of each target did so far, as their counters would tell
+  std::vector<BlockInfo::Counters> disks;
+  std::vector<CgroupIO::Counters> cgroups;
+  // targets accessed since the last look
+  std::vector<std::size_t> accessed;
+
+  // of a recorded dir, added on first sight
+  std::size_t target_of(const std::string_view& dir);
+  void feed(const Input& input);
+
+  bool open_policy() override;
+  [[nodiscard]] std::int64_t wall_ms() const override;
+  [[nodiscard]] std::chrono::steady_clock::time_point steady_now() const override;
+  bool sample_disk(MonitorCtx& block, BlockInfo::Counters& out) override;
+  bool wait_accesses() override;
+  bool scan_cgroups() override;
+  [[nodiscard]] const CgroupIO::Counters& cgroup_counters(const std::size_t& index) const override;
+  // counted, nothing is written
+  bool start_keep_awake(Target& target, const bool& wake, const bool& in_place = false) override;
+  void finish_keep_awake(Target& target,
+                         const bool& wake,
+                         const std::chrono::steady_clock::time_point& deadline) override;
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_REPLAY_H_
@@ -0,0 +1,69 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_SCHEDULE_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_SCHEDULE_H_
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "do_not_sleep/hms.h"
+
+namespace ds {
+
+// Weekly schedule compiled into a minute-of-week bitmap, minutes in which the state changes at a later second keep
+// their own per-second mask.
+class Schedule {
+public:
+  // bit 0 is sunday, same as `std::tm::tm_wday`
+  using Days = std::uint8_t;
+
+  // [start, end) on each day of `days`, wraps to the next day if `end` is not later than `start` (so `start == end`
+  // covers a whole day)
+  struct Rule {
+    Days days;
+    HMS start;
+    HMS end;
+  };
+
+  static constexpr Days EVERYDAY{0x7f};
+  static constexpr std::uint32_t MINUTES_PER_WEEK{7 * 24 * 60};
+  static constexpr std::uint32_t SECONDS_PER_WEEK{MINUTES_PER_WEEK * 60};
+  static constexpr std::uint32_t NEVER{std::numeric_limits<std::uint32_t>::max()};
+
+  // never active
+  Schedule();
+  // active in any of `windows` unless also in one of `exceptions`
+  Schedule(const std::vector<Rule>& windows, const std::vector<Rule>& exceptions);
+
+  [[nodiscard]] bool contains(const std::uint32_t& second_of_week) const;
+  // seconds from `second_of_week` until `contains` changes, `NEVER` if it never does
+  [[nodiscard]] std::uint32_t next_transition(const std::uint32_t& second_of_week) const;
+
+  // local time
+  static std::uint32_t now();
+  // local time at `time_ms` (unix time in milliseconds), e.g. of a recorded event
+  static std::uint32_t at(const std::int64_t& time_ms);
+
+  friend bool operator==(const Schedule& l, const Schedule& r);
+  friend bool operator!=(const Schedule& l, const Schedule& r);
+
+protected:
+  static constexpr std::uint32_t WORD_BITS{64};
+  static constexpr std::uint32_t WORDS{(MINUTES_PER_WEEK + WORD_BITS - 1) / WORD_BITS};
+
+  // state at the first second of each minute
+  std::array<std::uint64_t, WORDS> active;
+  // minutes in which the state changes
+  std::array<std::uint64_t, WORDS> edges;
+  // per-second state (bit 0 is the first second) of each minute in `edges`, sorted by minute
+  std::vector<std::pair<std::uint32_t, std::uint64_t>> edge_seconds;
+
+  [[nodiscard]] bool minute_active(const std::uint32_t& minute) const;
+  [[nodiscard]] bool minute_edge(const std::uint32_t& minute) const;
+  [[nodiscard]] std::uint64_t minute_seconds(const std::uint32_t& minute) const;
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_SCHEDULE_H_
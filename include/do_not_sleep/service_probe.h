@@ -0,0 +1,77 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_SERVICE_PROBE_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_SERVICE_PROBE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "do_not_sleep/device_worker.h"
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+// Tells whether a TCP service accepts connections without ever blocking its caller: a host name is resolved on a
+// thread of its own (a numeric address right away) and each address is connected to without blocking, one after the
+// other until one accepts. `fd` tells when the probe under way can go on.
+class ServiceProbe {
+public:
+  enum class Result : std::uint8_t {
+    // under way, `advance` again once `fd` is readable or at `next_deadline`
+    PENDING,
+    AVAILABLE,
+    UNAVAILABLE
+  };
+
+  // probes nothing
+  ServiceProbe();
+  // `<HOST>:<PORT>`, each address gets `timeout` to accept
+  explicit ServiceProbe(std::string service,
+                        const std::chrono::milliseconds& timeout = std::chrono::milliseconds{1000});
+  ServiceProbe(const ServiceProbe&) = delete;
+  ServiceProbe(ServiceProbe&& other) noexcept = default;
+  ServiceProbe& operator=(const ServiceProbe&) = delete;
+  ServiceProbe& operator=(ServiceProbe&& other) noexcept = default;
+
+  // a resolution under way is left behind
+  virtual ~ServiceProbe() = default;
+
+  [[nodiscard]] bool good() const;
+  // readable (epoll) when the probe under way can go on, -1 if not `good`
+  [[nodiscard]] int fd() const;
+  // when the probe under way times out, `time_point::max()` if none is
+  [[nodiscard]] std::chrono::steady_clock::time_point next_deadline() const;
+  // start a probe if none is under way and take it as far as it goes without blocking
+  Result advance(const std::chrono::steady_clock::time_point& now);
+
+protected:
+  enum class Stage : std::uint8_t { IDLE, RESOLVING, CONNECTING };
+
+  std::string service;
+  std::chrono::milliseconds timeout;
+  // over `resolved` and `connection`
+  File events;
+  // counted up by `resolver` once it returns
+  std::shared_ptr<File> resolved;
+  DeviceWorker resolver;
+  // written by `resolver`, which may outlive us
+  std::shared_ptr<ResolvedService> resolving;
+  // `resolver` was started and what it found is not taken yet, it may return after the probe gave up on it
+  bool resolution_pending;
+  ResolvedService addresses;
+  // the connection under way
+  File connection;
+  std::size_t next_address;
+  Stage stage;
+  std::chrono::steady_clock::time_point deadline;
+
+  // connect to the next address without blocking: PENDING if it is under way (or there is another address to try)
+  Result connect_next(const std::chrono::steady_clock::time_point& now);
+  Result finish(const bool& available);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_SERVICE_PROBE_H_
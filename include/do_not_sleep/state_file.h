@@ -0,0 +1,90 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_STATE_FILE_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_STATE_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+
+#include "do_not_sleep/io_estimator.h"
+
+namespace ds {
+
+// Runtime state of each dir kept in a memory-mapped file so a restarted daemon resumes where it left off.
+// Every slot holds two copies of its state, a store overwrites the older one and a checksum tells whether a copy
+// was written completely, so a crash in the middle of a store loses at most that store. The file is locked (flock(2))
+// while open, an instance that finds it locked by another one leaves it alone and tells `in_use`.
+class StateFile {
+public:
+  struct DeviceState {
+    // unix time in milliseconds, 0 if never
+    std::int64_t last_keepalive_ms;
+    // unix time in milliseconds, 0 if not awake
+    std::int64_t awake_until_ms;
+    // unix time in milliseconds of the last I/O or access noticed, 0 if never
+    std::int64_t last_activity_ms;
+    // I/O counters at the last scan
+    std::uint64_t last_reads;
+    std::uint64_t last_writes;
+    // of monitor IO, so a restart or the next one-shot run goes on with the noise it learned
+    IOEstimator::State estimator;
+  };
+
+  static constexpr std::size_t NO_SLOT{std::numeric_limits<std::size_t>::max()};
+  static constexpr std::size_t SLOT_COUNT{64};
+
+  // not persisted
+  StateFile();
+  explicit StateFile(const std::filesystem::path& path);
+  StateFile(const StateFile&) = delete;
+  StateFile(StateFile&& other) noexcept;
+  StateFile& operator=(const StateFile&) = delete;
+  StateFile& operator=(StateFile&& other) noexcept;
+
+  virtual ~StateFile();
+
+  [[nodiscard]] bool good() const;
+  // not opened, another instance has it
+  [[nodiscard]] bool in_use() const;
+  // slot of `dir`, a free slot is claimed if `dir` has none, `NO_SLOT` if the file is full or not mapped
+  std::size_t slot(const std::filesystem::path& dir);
+  // false if nothing was stored in `slot`
+  bool load(const std::size_t& slot, DeviceState& out_state) const;
+  void store(const std::size_t& slot, const DeviceState& state);
+
+protected:
+  static constexpr std::uint32_t VERSION{4};
+  static constexpr std::size_t DIR_LENGTH{256};
+  static const char MAGIC[8];
+
+  struct Record {
+    // 0 if never written
+    std::uint64_t seq;
+    DeviceState state;
+    std::uint64_t checksum;
+  };
+
+  struct Slot {
+    // NUL-terminated, empty if free
+    char dir[DIR_LENGTH];
+    Record records[2];
+  };
+
+  struct Layout {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t slot_count;
+    Slot slots[SLOT_COUNT];
+  };
+
+  int fd;
+  Layout* layout;
+  bool contended;
+
+  static std::uint64_t checksum(const std::uint64_t& seq, const DeviceState& state);
+  static bool valid(const Record& record);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_STATE_FILE_H_
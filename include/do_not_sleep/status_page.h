@@ -0,0 +1,125 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_STATUS_PAGE_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_STATUS_PAGE_H_
+
+// Status of each dir published by the daemon in a POSIX shared memory segment (`/dev/shm/do_not_sleep` by default).
+// Each device is guarded by a seqlock: the writer never waits for readers, readers retry if the writer was busy.
+// Self-contained so monitoring agents can copy it, reading a snapshot takes no syscalls once the page is mapped:
+//
+//   const ds::status::Page* page = ds::status::open_page();
+//   ds::status::DeviceSnapshot snapshot;
+//   for (std::uint32_t i = 0; page != nullptr && i < page->device_count.load(); i++) {
+//     if (ds::status::read_device(*page, i, snapshot)) { /* snapshot.dir, snapshot.awake_until_ms, ... */ }
+//   }
+//   ds::status::close_page(page);
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "fcntl.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "unistd.h"
+
+namespace ds::status {
+
+constexpr char DEFAULT_NAME[]{"/do_not_sleep"};
+constexpr char MAGIC[8]{'D', 'S', 'S', 'T', 'A', 'T', 'U', 'S'};
+constexpr std::uint32_t VERSION{1};
+constexpr std::size_t MAX_DEVICES{64};
+constexpr std::size_t DIR_LENGTH{256};
+
+// a consistent copy of a `Device`, times are unix time in milliseconds, 0 if never
+struct DeviceSnapshot {
+  // NUL-terminated
+  char dir[DIR_LENGTH];
+  std::int64_t last_keepalive_ms;
+  // the disk is kept awake until then
+  std::int64_t awake_until_ms;
+  // last I/O or access seen on the disk
+  std::int64_t last_activity_ms;
+  std::uint64_t last_keepalive_latency_ns;
+};
+
+struct Device {
+  // odd while the writer is updating this device
+  std::atomic<std::uint32_t> seq;
+  std::uint32_t reserved;
+  char dir[DIR_LENGTH];
+  std::atomic<std::int64_t> last_keepalive_ms;
+  std::atomic<std::int64_t> awake_until_ms;
+  std::atomic<std::int64_t> last_activity_ms;
+  std::atomic<std::uint64_t> last_keepalive_latency_ns;
+};
+
+struct Page {
+  char magic[8];
+  std::uint32_t version;
+  // pid of the daemon, 0 after it exited
+  std::atomic<std::int32_t> writer_pid;
+  std::atomic<std::uint32_t> device_count;
+  std::uint32_t reserved;
+  Device devices[MAX_DEVICES];
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free && std::atomic<std::int64_t>::is_always_lock_free,
+              "the status page needs address-free atomics");
+
+// read-only mapping of the status page, nullptr if it does not exist or is not compatible
+inline const Page* open_page(const char* name = DEFAULT_NAME) {
+  const int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat page_stat {};
+  void* mapped = MAP_FAILED;
+  if (fstat(fd, &page_stat) == 0 && page_stat.st_size >= static_cast<off_t>(sizeof(Page))) {
+    mapped = mmap(nullptr, sizeof(Page), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return nullptr;
+  }
+  const Page* page = static_cast<const Page*>(mapped);
+  if (std::memcmp(page->magic, MAGIC, sizeof(MAGIC)) != 0 || page->version != VERSION) {
+    munmap(mapped, sizeof(Page));
+    return nullptr;
+  }
+  return page;
+}
+
+inline void close_page(const Page* page) {
+  if (page != nullptr) {
+    munmap(const_cast<Page*>(page), sizeof(Page));
+  }
+}
+
+// false if the device does not exist or the writer kept updating it for all `retries`
+inline bool read_device(const Page& page, const std::size_t& index, DeviceSnapshot& out, int retries = 1000) {
+  if (index >= MAX_DEVICES || index >= page.device_count.load(std::memory_order_acquire)) {
+    return false;
+  }
+  const Device& device = page.devices[index];
+  for (; retries > 0; retries--) {
+    const std::uint32_t begin = device.seq.load(std::memory_order_acquire);
+    if ((begin & 1U) != 0) {
+      continue;
+    }
+    std::memcpy(out.dir, device.dir, DIR_LENGTH);
+    out.last_keepalive_ms = device.last_keepalive_ms.load(std::memory_order_relaxed);
+    out.awake_until_ms = device.awake_until_ms.load(std::memory_order_relaxed);
+    out.last_activity_ms = device.last_activity_ms.load(std::memory_order_relaxed);
+    out.last_keepalive_latency_ns = device.last_keepalive_latency_ns.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (device.seq.load(std::memory_order_relaxed) == begin) {
+      out.dir[DIR_LENGTH - 1] = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace ds::status
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_STATUS_PAGE_H_
@@ -0,0 +1,43 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_STATUS_WRITER_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_STATUS_WRITER_H_
+
+#include <cstddef>
+#include <string>
+
+#include "do_not_sleep/status_page.h"
+
+namespace ds {
+
+// Publishes device status in the shared memory page described in `status_page.h`. The page is locked (flock(2)) by
+// its writer, another instance finds it `in_use` and publishes nothing.
+class StatusWriter {
+public:
+  // publishes nothing
+  StatusWriter();
+  // `name` as in shm_open(3), e.g. `/do_not_sleep`
+  explicit StatusWriter(const std::string& name);
+  StatusWriter(const StatusWriter&) = delete;
+  StatusWriter(StatusWriter&& other) noexcept;
+  StatusWriter& operator=(const StatusWriter&) = delete;
+  StatusWriter& operator=(StatusWriter&& other) noexcept;
+
+  virtual ~StatusWriter();
+
+  [[nodiscard]] bool good() const;
+  // publishes nothing, another instance has the page
+  [[nodiscard]] bool in_use() const;
+  void set_device_count(const std::size_t& count);
+  void publish(const std::size_t& index, const status::DeviceSnapshot& snapshot);
+
+protected:
+  // of the page, holds the lock
+  int fd;
+  status::Page* page;
+  bool contended;
+
+  void release();
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_STATUS_WRITER_H_
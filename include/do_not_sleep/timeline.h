@@ -0,0 +1,105 @@
+#ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_TIMELINE_H_
+#define DO_NOT_SLEEP_DO_NOT_SLEEP_TIMELINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace ds {
+
+// The last spans (what ran, on which thread, from when to when) in a fixed-size ring buffer, dumped as Chrome
+// trace-event JSON for Perfetto (ui.perfetto.dev) or chrome://tracing. Any thread records without locks or allocations:
+// a slot is claimed with one atomic increment and guarded by a sequence number, so a dump skips a slot being
+// overwritten instead of waiting for it.
+class Timeline {
+public:
+  // steady clock
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  // records from its construction to its destruction
+  class Span {
+  public:
+    Span() = delete;
+    // `name` must outlive the timeline (a string literal), `detail` the span
+    Span(Timeline& timeline, const char* name, std::string_view detail = {});
+    Span(const Span&) = delete;
+    Span(Span&&) noexcept = delete;
+    Span& operator=(const Span&) = delete;
+    Span& operator=(Span&&) noexcept = delete;
+
+    virtual ~Span();
+
+  protected:
+    Timeline& timeline;
+    const char* name;
+    std::string_view detail;
+    TimePoint start;
+  };
+
+  static constexpr std::size_t DETAIL_LENGTH{47};
+
+  // records nothing if `capacity` is 0
+  explicit Timeline(const std::size_t& capacity);
+  Timeline(const Timeline&) = delete;
+  Timeline(Timeline&&) noexcept = delete;
+  Timeline& operator=(const Timeline&) = delete;
+  Timeline& operator=(Timeline&&) noexcept = delete;
+
+  virtual ~Timeline() = default;
+
+  // `name` must outlive the timeline (a string literal), `detail` is copied and truncated to `DETAIL_LENGTH`
+  void record(const char* name, const std::string_view& detail, const TimePoint& start, const TimePoint& end);
+  // write the recorded spans to `path` (replaced atomically), false on errors
+  bool dump(const std::filesystem::path& path) const;
+
+protected:
+  struct Slot {
+    // 2n+1 while the n-th span is written, 2n+2 once it is complete
+    std::atomic<std::uint64_t> seq;
+    const char* name;
+    std::int64_t start_ns;
+    std::int64_t end_ns;
+    std::uint32_t tid;
+    char detail[DETAIL_LENGTH + 1];
+  };
+
+  std::vector<Slot> slots;
+  std::atomic<std::uint64_t> head;
+};
+
+// Dumps a timeline to a file on SIGUSR1, read from a signalfd by a thread of its own. SIGUSR1 is blocked in the
+// constructing thread and in every thread it starts afterwards, construct it before any other thread.
+class TimelineDumper {
+public:
+  TimelineDumper() = delete;
+  TimelineDumper(std::shared_ptr<const Timeline> timeline, std::filesystem::path path);
+  TimelineDumper(const TimelineDumper&) = delete;
+  TimelineDumper(TimelineDumper&&) noexcept = delete;
+  TimelineDumper& operator=(const TimelineDumper&) = delete;
+  TimelineDumper& operator=(TimelineDumper&&) noexcept = delete;
+
+  virtual ~TimelineDumper();
+
+  [[nodiscard]] bool good() const;
+
+protected:
+  int signal_fd;
+  // written to stop the thread
+  int stop_fd;
+  std::thread thread;
+
+  static void loop(const int& signal_fd,
+                   const int& stop_fd,
+                   const std::shared_ptr<const Timeline>& timeline,
+                   const std::filesystem::path& path);
+};
+
+} // namespace ds
+
+#endif // DO_NOT_SLEEP_DO_NOT_SLEEP_TIMELINE_H_
@@ -1,16 +1,25 @@
 #ifndef DO_NOT_SLEEP_DO_NOT_SLEEP_UTIL_H_
 #define DO_NOT_SLEEP_DO_NOT_SLEEP_UTIL_H_
 
+#include <charconv>
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <ctime>
+#include <filesystem>
 #include <optional>
-#include <ostream>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#define DS_LOGERR ds::log_error(__FILE__, __LINE__, true)
-#define DS_LOG ds::log_error(__FILE__, __LINE__, false)
+#include "sys/socket.h"
+
+#define DS_LOGERR ds::LogLine(__FILE__, __LINE__, true)
+#define DS_LOG ds::LogLine(__FILE__, __LINE__, false)
+// dropped while `muted`, e.g. when the program prints a report of its own to stdout
+#define DS_LOG_UNLESS(muted) ds::LogLine(__FILE__, __LINE__, false, muted)
 
 namespace ds {
 
@@ -19,10 +28,66 @@ std::int64_t current_time_ms(const std::chrono::system_clock::time_point& t);
 
 const std::tm& localtime_safe(const std::time_t& t);
 std::optional<std::string> getenv_safe(std::string_view key);
+std::string strerror_safe(const int& errnum);
+
+// a `<IP>:<PORT>` service resolved once, to be probed many times
+struct ResolvedService {
+  std::string host;
+  std::string port;
+  std::vector<std::pair<sockaddr_storage, socklen_t>> addresses;
+};
 
+// no addresses if `service` cannot be parsed or resolved; `numeric` never asks DNS, a host name has none then
+ResolvedService resolve_service(const std::string_view& service, const bool& numeric = false);
+// whether a TCP connection to one of its addresses can be established, without allocating
+bool service_available(const ResolvedService& service, const std::int64_t& time_out = 1000);
 bool service_available(const std::string_view& service, const std::int64_t& time_out = 1000);
 
-std::ostream& log_error(const std::string_view& file, const std::uint_fast32_t& line, const bool& err);
+// `[YYYY-MM-DDThh:mm:ss.sss](file:line): ` and what is put into it, to stderr or stdout with a single write(2) once it
+// goes out of scope, so lines of different threads do not interleave. No iostreams, no locale, nothing allocated;
+// numbers and paths read as iostreams would print them.
+class LogLine {
+public:
+  LogLine() = delete;
+  LogLine(const std::string_view& file, const std::uint_fast32_t& line, const bool& err, const bool& muted = false);
+  LogLine(const LogLine&) = delete;
+  LogLine(LogLine&&) = delete;
+  LogLine& operator=(const LogLine&) = delete;
+  LogLine& operator=(LogLine&&) = delete;
+
+  virtual ~LogLine();
+
+  LogLine& operator<<(const std::string_view& str);
+  LogLine& operator<<(const std::string& str);
+  LogLine& operator<<(const char* str);
+  LogLine& operator<<(const char& c);
+  // `1` or `0`
+  LogLine& operator<<(const bool& b);
+  LogLine& operator<<(const double& value);
+  // quoted and escaped
+  LogLine& operator<<(const std::filesystem::path& path);
+
+  template <typename T,
+            std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>, int> = 0>
+  LogLine& operator<<(const T& value) {
+    char digits[24];
+    const std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    append(digits, static_cast<std::size_t>(result.ptr - digits));
+    return *this;
+  }
+
+protected:
+  // a longer line is written in pieces
+  static constexpr std::size_t CAPACITY{1024};
+
+  // -1 if muted
+  int out_fd;
+  std::size_t size;
+  char buf[CAPACITY];
+
+  void append(const char* data, std::size_t length);
+  void flush();
+};
 
 } // namespace ds
 
@@ -0,0 +1,242 @@
+#include "do_not_sleep/access_watcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#include "fcntl.h"
+#include "poll.h"
+#include "sys/fanotify.h"
+#include "sys/stat.h"
+#include "unistd.h"
+
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+const std::uint64_t AccessWatcher::EVENT_MASK{FAN_OPEN | FAN_ACCESS};
+
+AccessWatcher::AccessWatcher(std::chrono::milliseconds debounce)
+  : fanotify_fd(fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_CLOEXEC | O_LARGEFILE))
+  , debounce(debounce) {
+  if (fanotify_fd == -1) {
+    DS_LOGERR << "failed to initialize fanotify: " << strerror_safe(errno) << '\n';
+  }
+}
+
+AccessWatcher::AccessWatcher(AccessWatcher&& other) noexcept
+  : fanotify_fd(std::exchange(other.fanotify_fd, -1))
+  , debounce(other.debounce)
+  , marks(std::move(other.marks))
+  , watches(std::move(other.watches))
+  , fired(std::move(other.fired)) {
+}
+
+AccessWatcher& AccessWatcher::operator=(AccessWatcher&& other) noexcept {
+  if (this != &other) {
+    if (fanotify_fd != -1) {
+      close(fanotify_fd);
+    }
+    fanotify_fd = std::exchange(other.fanotify_fd, -1);
+    debounce = other.debounce;
+    marks = std::move(other.marks);
+    watches = std::move(other.watches);
+    fired = std::move(other.fired);
+  }
+  return *this;
+}
+
+AccessWatcher::~AccessWatcher() {
+  if (fanotify_fd != -1) {
+    close(fanotify_fd);
+  }
+}
+
+[[nodiscard]] bool AccessWatcher::good() const {
+  return fanotify_fd != -1;
+}
+
+bool AccessWatcher::watch(const std::filesystem::path& path) {
+  if (!good()) {
+    return false;
+  }
+  struct stat path_stat {};
+  if (stat(path.c_str(), &path_stat) == -1) {
+    DS_LOGERR << "failed to stat " << path << ": " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  const int path_mount_id = mount_id(path);
+  for (std::size_t i = 0; i < marks.size(); i++) {
+    if (marks[i].dev == path_stat.st_dev && (marks[i].mount_id == -1 || marks[i].mount_id == path_mount_id)) {
+      // marking it again would be merged into the same mark
+      watches.emplace_back(i);
+      return true;
+    }
+  }
+  Mark mark{.path = path, .dev = path_stat.st_dev, .mount_id = -1, .mark_type = 0, .armed = false, .rearm_at = {}};
+#ifdef FAN_MARK_FILESYSTEM
+  // whole filesystem (linux 4.20+), also catches accesses through other mounts of the same disk
+  mark.mark_type = FAN_MARK_FILESYSTEM;
+  if (!arm(mark)) {
+    mark.mark_type = FAN_MARK_MOUNT;
+    mark.mount_id = path_mount_id;
+  }
+#else
+  mark.mark_type = FAN_MARK_MOUNT;
+  mark.mount_id = path_mount_id;
+#endif
+  if (!mark.armed && !arm(mark)) {
+    DS_LOGERR << "failed to watch " << path << ": " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  marks.emplace_back(std::move(mark));
+  watches.emplace_back(marks.size() - 1);
+  fired.reserve(marks.size());
+  return true;
+}
+
+[[nodiscard]] int AccessWatcher::fd() const {
+  return fanotify_fd;
+}
+
+[[nodiscard]] std::chrono::steady_clock::time_point AccessWatcher::next_deadline() const {
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+  for (const Mark& mark : marks) {
+    // one that failed to be armed again is retried on the next `wait`, whenever that is
+    if (!mark.armed && mark.rearm_at > now) {
+      deadline = std::min(deadline, mark.rearm_at);
+    }
+  }
+  return deadline;
+}
+
+bool AccessWatcher::wait(std::chrono::milliseconds timeout, std::vector<std::size_t>& triggered) {
+  triggered.clear();
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  for (Mark& mark : marks) {
+    if (mark.armed) {
+      continue;
+    }
+    if (mark.rearm_at <= now) {
+      arm(mark);
+      continue;
+    }
+    std::chrono::milliseconds until_rearm
+      = std::chrono::ceil<std::chrono::milliseconds>(mark.rearm_at - now);
+    if (timeout < std::chrono::milliseconds::zero() || until_rearm < timeout) {
+      timeout = until_rearm;
+    }
+  }
+
+  pollfd fanotify_pollfd{.fd = fanotify_fd, .events = POLLIN, .revents = 0};
+  int ret = poll(&fanotify_pollfd, 1, timeout < std::chrono::milliseconds::zero() ? -1 : timeout.count());
+  if (ret == -1) {
+    if (errno == EINTR) {
+      return true;
+    }
+    DS_LOGERR << "failed to poll fanotify: " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  if (ret == 0) {
+    // timed out
+    return true;
+  }
+  read_events();
+  for (std::size_t i = 0; i < watches.size(); i++) {
+    if (std::find(fired.begin(), fired.end(), watches[i]) != fired.end()) {
+      triggered.emplace_back(i);
+    }
+  }
+
+  if (debounce > std::chrono::milliseconds::zero()) {
+    now = std::chrono::steady_clock::now();
+    for (const std::size_t& i : fired) {
+      disarm(marks[i]);
+      marks[i].rearm_at = now + debounce;
+    }
+  }
+  return true;
+}
+
+bool AccessWatcher::arm(Mark& mark) {
+  mark.armed
+    = (fanotify_mark(fanotify_fd, FAN_MARK_ADD | mark.mark_type, EVENT_MASK, AT_FDCWD, mark.path.c_str()) == 0);
+  return mark.armed;
+}
+
+bool AccessWatcher::disarm(Mark& mark) {
+  if (fanotify_mark(fanotify_fd, FAN_MARK_REMOVE | mark.mark_type, EVENT_MASK, AT_FDCWD, mark.path.c_str()) == -1) {
+    DS_LOGERR << "failed to unwatch " << mark.path << ": " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  mark.armed = false;
+  return true;
+}
+
+int AccessWatcher::mount_id(const std::filesystem::path& path) {
+  // only the mount id is wanted, a handle with no room fails with EOVERFLOW after filling it in
+  struct file_handle handle {};
+  int id{-1};
+  if (name_to_handle_at(AT_FDCWD, path.c_str(), &handle, &id, 0) == -1 && errno != EOVERFLOW) {
+    return -1;
+  }
+  return id;
+}
+
+void AccessWatcher::read_events() {
+  fired.clear();
+  const pid_t self = getpid();
+  const auto fire = [&](const std::size_t& i) {
+    if (marks[i].armed && std::find(fired.begin(), fired.end(), i) == fired.end()) {
+      fired.emplace_back(i);
+    }
+  };
+  alignas(fanotify_event_metadata) char buf[4096];
+  ssize_t len{0};
+  while ((len = read(fanotify_fd, buf, sizeof(buf))) > 0) {
+    const fanotify_event_metadata* event = reinterpret_cast<const fanotify_event_metadata*>(buf);
+    for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+      if (event->vers != FANOTIFY_METADATA_VERSION) {
+        DS_LOGERR << "unexpected fanotify metadata version " << static_cast<int>(event->vers) << '\n';
+        // the fds of this event and of the rest of the buffer are ours all the same
+        for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+          if (event->fd >= 0) {
+            close(event->fd);
+          }
+        }
+        return;
+      }
+      if ((event->mask & FAN_Q_OVERFLOW) != 0) {
+        // lost events, assume every filesystem was accessed
+        for (std::size_t i = 0; i < marks.size(); i++) {
+          fire(i);
+        }
+        continue;
+      }
+      if (event->fd < 0) {
+        continue;
+      }
+      struct stat event_stat {};
+      // accesses made by ourselves (keepalives) are not activity
+      if (event->pid != self && fstat(event->fd, &event_stat) == 0) {
+        for (std::size_t i = 0; i < marks.size(); i++) {
+          if (marks[i].dev == event_stat.st_dev) {
+            fire(i);
+          }
+        }
+      }
+      close(event->fd);
+    }
+  }
+  if (len == -1 && errno != EAGAIN) {
+    DS_LOGERR << "failed to read fanotify events: " << strerror_safe(errno) << '\n';
+  }
+}
+
+} // namespace ds
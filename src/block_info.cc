@@ -1,85 +1,211 @@
 #include "do_not_sleep/block_info.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
 #include <cstdint>
 #include <filesystem>
-#include <fstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "fcntl.h"
+#include "sys/stat.h"
+#include "sys/sysmacros.h"
+#include "sys/types.h"
+
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/probe.h"
 #include "do_not_sleep/util.h"
 
 namespace ds {
 
+namespace {
+
+// next whitespace separated unsigned number of `str`, consumed, false if there is none
+bool next_number(std::string_view& str, std::uint64_t& out) {
+  const std::size_t start = str.find_first_not_of(" \t\n");
+  if (start == std::string_view::npos) {
+    return false;
+  }
+  const std::from_chars_result result = std::from_chars(str.data() + start, str.data() + str.size(), out);
+  if (result.ec != std::errc{}) {
+    return false;
+  }
+  str.remove_prefix(result.ptr - str.data());
+  return true;
+}
+
+// next whitespace separated field of `str`, consumed
+std::string_view next_field(std::string_view& str) {
+  const std::size_t start = std::min(str.find_first_not_of(' '), str.size());
+  const std::size_t end = std::min(str.find(' ', start), str.size());
+  const std::string_view field = str.substr(start, end - start);
+  str.remove_prefix(end);
+  return field;
+}
+
+// mountinfo escapes spaces and such as `\040`
+std::string unescape(const std::string_view& escaped) {
+  std::string result;
+  for (std::size_t i = 0; i < escaped.size(); i++) {
+    unsigned int c{0};
+    if (escaped[i] == '\\' && i + 3 < escaped.size()
+        && std::from_chars(escaped.data() + i + 1, escaped.data() + i + 4, c, 8).ptr == escaped.data() + i + 4) {
+      result += static_cast<char>(c);
+      i += 3;
+    } else {
+      result += escaped[i];
+    }
+  }
+  return result;
+}
+
+} // namespace
+
 const std::pair<std::uint64_t, std::uint64_t> BlockInfo::NO_IO{0, 0};
 const std::filesystem::path BlockInfo::MOUNT_INFO_PATH{"/proc/self/mountinfo"};
 const std::filesystem::path BlockInfo::SYS_BLOCK_PATH{"/sys/block"};
 const std::filesystem::path BlockInfo::BLOCK_STAT_NAME{"stat"};
 const std::filesystem::path BlockInfo::SELF_IO{"/proc/self/io"};
+const std::filesystem::path BlockInfo::SYS_DEV_BLOCK_PATH{"/sys/dev/block"};
 
-/* NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables) */
-std::unordered_map<std::filesystem::path, std::filesystem::path> BlockInfo::mount_list;
-/* NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables) */
-std::pair<std::uint64_t, std::uint64_t> BlockInfo::self_last_io;
-
-BlockInfo BlockInfo::from_mount_path(const std::filesystem::path& mount_path) {
+BlockInfo BlockInfo::from_mount_path(const std::filesystem::path& mount_path, const MountList& mounts) {
   if (!std::filesystem::is_directory(mount_path)) {
     throw std::runtime_error{"mount path `" + mount_path.string() + "` is not a directory"};
   }
-  update_mount_list();
-  std::unordered_map<std::filesystem::path, std::filesystem::path>::const_iterator mount_info
-    = mount_list.find(mount_path);
-  if (mount_info == mount_list.end()) {
+  MountList::const_iterator mount_info = mounts.find(mount_path);
+  if (mount_info == mounts.end()) {
     // not found
     throw std::runtime_error{"Could not find mount source of `" + mount_path.string() + "`"};
   }
-  return BlockInfo{mount_info};
+  return BlockInfo{mount_info->second};
 }
 
-BlockInfo BlockInfo::from_block_path(const std::filesystem::path& block_path) {
+BlockInfo BlockInfo::from_block_path(const std::filesystem::path& block_path, const MountList& mounts) {
   if (!std::filesystem::is_directory(block_path)) {
     throw std::runtime_error{"block path `" + block_path.string() + "` is not a directory"};
   }
-  update_mount_list();
-  std::unordered_map<std::filesystem::path, std::filesystem::path>::const_iterator mount_info = mount_list.begin();
-  for (; mount_info != mount_list.end(); mount_info++) {
-    if (mount_info->second == block_path) {
-      return BlockInfo{mount_info};
+  for (const auto& [mount_point, mount_source] : mounts) {
+    if (mount_source == block_path) {
+      return BlockInfo{mount_source};
     }
   }
   throw std::runtime_error{"could not find info about `" + block_path.string() + "` in " + MOUNT_INFO_PATH.string()};
 }
 
-BlockInfo BlockInfo::from_block_name(const std::filesystem::path& block_name) {
-  update_mount_list();
-  std::unordered_map<std::filesystem::path, std::filesystem::path>::const_iterator mount_info = mount_list.begin();
-  for (; mount_info != mount_list.end(); mount_info++) {
-    if (mount_info->first.filename() == block_name) {
-      return BlockInfo{mount_info};
+BlockInfo BlockInfo::from_block_name(const std::filesystem::path& block_name, const MountList& mounts) {
+  for (const auto& [mount_point, mount_source] : mounts) {
+    if (mount_point.filename() == block_name) {
+      return BlockInfo{mount_source};
     }
   }
   throw std::runtime_error{"could not find info about `" + block_name.string() + "` in " + MOUNT_INFO_PATH.string()};
 }
 
-std::pair<std::uint64_t, std::uint64_t> BlockInfo::self_io_taken() {
+std::pair<std::uint64_t, std::uint64_t> BlockInfo::self_io_statistics() {
   std::pair<std::uint64_t, std::uint64_t> result;
-  std::uint64_t count{0};
-  std::string label;
-  std::ifstream self_io(SELF_IO);
-  while (!self_io.eof()) {
-    self_io >> label >> count;
-    if (label == "syscr:") {
-      result.first = count - self_last_io.first;
-      self_last_io.first = count;
-    } else if (label == "syscw:") {
-      result.second = count - self_last_io.second;
-      self_last_io.second = count;
+  std::string self_io;
+  if (!File::read_file(SELF_IO, self_io)) {
+    DS_LOGERR << "failed to read " << SELF_IO << ".\n";
+    return result;
+  }
+  // `rchar: 123\nwchar: 456\nsyscr: 7\nsyscw: 8\n...`, each label once
+  for (std::string_view rest{self_io}; !rest.empty();) {
+    const std::size_t end = std::min(rest.find('\n'), rest.size());
+    std::string_view line = rest.substr(0, end);
+    rest.remove_prefix(std::min(end + 1, rest.size()));
+    const std::size_t colon = line.find(':');
+    std::uint64_t count{0};
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    const std::string_view label = line.substr(0, colon);
+    line.remove_prefix(colon + 1);
+    if (!next_number(line, count)) {
+      continue;
+    }
+    if (label == "syscr") {
+      result.first = count;
+    } else if (label == "syscw") {
+      result.second = count;
     }
   }
   return result;
 }
 
+dev_t BlockInfo::disk_device(const std::filesystem::path& path) {
+  struct stat path_stat {};
+  if (stat(path.c_str(), &path_stat) == -1) {
+    DS_LOGERR << "failed to stat " << path << ": " << strerror_safe(errno) << '\n';
+    return 0;
+  }
+  std::error_code ec;
+  std::filesystem::path block = std::filesystem::canonical(
+    SYS_DEV_BLOCK_PATH / (std::to_string(major(path_stat.st_dev)) + ':' + std::to_string(minor(path_stat.st_dev))),
+    ec);
+  if (ec) {
+    DS_LOGERR << path << " is not on a block device.\n";
+    return 0;
+  }
+  if (!std::filesystem::exists(block / "partition")) {
+    return path_stat.st_dev;
+  }
+  // e.g. /sys/devices/.../block/sda/sda1 -> /sys/devices/.../block/sda/dev, `8:0`
+  std::string dev;
+  File::read_file(block.parent_path() / "dev", dev);
+  const std::size_t colon = dev.find(':');
+  std::uint64_t disk_major{0};
+  std::uint64_t disk_minor{0};
+  std::string_view dev_major{dev.data(), std::min(colon, dev.size())};
+  std::string_view dev_minor{std::string_view{dev}.substr(std::min(colon + 1, dev.size()))};
+  if (colon == std::string::npos || !next_number(dev_major, disk_major) || !next_number(dev_minor, disk_minor)) {
+    DS_LOGERR << "failed to read the disk of " << block << ".\n";
+    return 0;
+  }
+  return makedev(disk_major, disk_minor);
+}
+
+std::filesystem::path BlockInfo::device_node(const std::filesystem::path& path) {
+  struct stat path_stat {};
+  if (stat(path.c_str(), &path_stat) == -1) {
+    DS_LOGERR << "failed to stat " << path << ": " << strerror_safe(errno) << '\n';
+    return {};
+  }
+  // DEVNAME is relative to /dev, e.g. `sda1` or `dm-0`
+  std::string uevent;
+  File::read_file(SYS_DEV_BLOCK_PATH
+                    / (std::to_string(major(path_stat.st_dev)) + ':' + std::to_string(minor(path_stat.st_dev)))
+                    / "uevent",
+                  uevent);
+  const std::string_view key{"\nDEVNAME="};
+  const std::size_t found = ('\n' + uevent).find(key);
+  if (found == std::string::npos) {
+    return {};
+  }
+  const std::size_t start = found + key.size() - 1;
+  return std::filesystem::path{"/dev"} / uevent.substr(start, uevent.find('\n', start) - start);
+}
+
+std::filesystem::path BlockInfo::disk_stat_file(const std::filesystem::path& path) {
+  const dev_t disk = disk_device(path);
+  if (disk == 0) {
+    return {};
+  }
+  std::filesystem::path stat_file
+    = SYS_DEV_BLOCK_PATH / (std::to_string(major(disk)) + ':' + std::to_string(minor(disk))) / BLOCK_STAT_NAME;
+  std::error_code ec;
+  if (!std::filesystem::exists(stat_file, ec)) {
+    return {};
+  }
+  return stat_file;
+}
+
 [[nodiscard]] std::uint64_t BlockInfo::total_reads() const {
   return get_io_statistics().first;
 }
@@ -110,6 +236,7 @@ std::uint64_t BlockInfo::writes_taken() {
 
 std::pair<std::uint64_t, std::uint64_t> BlockInfo::io_taken() {
   std::pair<std::uint64_t, std::uint64_t> io = get_io_statistics();
+  DS_PROBE3(block_info_sample, stat_file.c_str(), io.first, io.second);
   std::pair<std::uint64_t, std::uint64_t> result;
   if (io.first == last_io.first) {
     result.first = 0;
@@ -126,25 +253,73 @@ std::pair<std::uint64_t, std::uint64_t> BlockInfo::io_taken() {
   return result;
 }
 
-void BlockInfo::update_mount_list(const bool& force) {
-  if (!mount_list.empty() && !force) {
-    return;
+bool BlockInfo::sample(Counters& out) {
+  if (!get_counters(stat_fd, stat_file, out)) {
+    return false;
   }
-  std::ifstream mount_info_file(MOUNT_INFO_PATH);
-  std::string mount_point;
-  std::string mount_source;
-  while (!mount_info_file.eof()) {
-    for (int i = 0; i < 5; i++) {
-      mount_info_file >> mount_point;
+  DS_PROBE3(block_info_sample, stat_file.c_str(), out.read_ios, out.write_ios);
+  last_io = {out.read_ios, out.write_ios};
+  return true;
+}
+
+[[nodiscard]] const std::pair<std::uint64_t, std::uint64_t>& BlockInfo::last_io_statistics() const {
+  return last_io;
+}
+
+void BlockInfo::set_last_io_statistics(const std::pair<std::uint64_t, std::uint64_t>& io) {
+  last_io = io;
+}
+
+std::vector<BlockInfo::Mount> BlockInfo::mounts() {
+  std::vector<Mount> result;
+  std::string mount_info;
+  if (!File::read_file(MOUNT_INFO_PATH, mount_info)) {
+    DS_LOGERR << "failed to read " << MOUNT_INFO_PATH << ".\n";
+    return result;
+  }
+  // 36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+  // the number of optional fields (`master:1`) before `-` varies
+  for (std::string_view rest{mount_info}; !rest.empty();) {
+    const std::size_t end = std::min(rest.find('\n'), rest.size());
+    std::string_view line = rest.substr(0, end);
+    rest.remove_prefix(std::min(end + 1, rest.size()));
+    next_field(line);
+    next_field(line);
+    std::string_view dev = next_field(line);
+    const std::size_t colon = dev.find(':');
+    std::uint64_t dev_major{0};
+    std::uint64_t dev_minor{0};
+    std::string_view dev_major_str{dev.substr(0, std::min(colon, dev.size()))};
+    std::string_view dev_minor_str{dev.substr(std::min(colon + 1, dev.size()))};
+    if (colon == std::string_view::npos || !next_number(dev_major_str, dev_major)
+        || !next_number(dev_minor_str, dev_minor)) {
+      continue;
     }
-    for (int i = 0; i < 5; i++) {
-      mount_info_file >> mount_source;
+    const std::string_view root = next_field(line);
+    const std::string_view mount_point = next_field(line);
+    const std::size_t separator = line.find(" - ");
+    if (mount_point.empty() || separator == std::string_view::npos) {
+      continue;
     }
-    mount_list[mount_point] = mount_source;
-    mount_info_file >> mount_source;
-    mount_info_file >> std::ws;
+    line.remove_prefix(separator + 3);
+    // file system type
+    next_field(line);
+    const std::string_view source = next_field(line);
+    result.emplace_back(Mount{.device = makedev(dev_major, dev_minor),
+                              .root = unescape(root),
+                              .mount_point = unescape(mount_point),
+                              .source = unescape(source)});
+  }
+  return result;
+}
+
+BlockInfo::MountList BlockInfo::mount_list() {
+  MountList mount_list;
+  for (Mount& mount : mounts()) {
+    mount_list[std::move(mount.mount_point)] = std::move(mount.source);
   }
-  mount_info_file.close();
+  DS_PROBE1(mount_table_reload, mount_list.size());
+  return mount_list;
 }
 
 std::filesystem::path BlockInfo::find_block_stat(const std::filesystem::path& block) {
@@ -152,7 +327,7 @@ std::filesystem::path BlockInfo::find_block_stat(const std::filesystem::path& bl
   std::filesystem::path block_path = SYS_BLOCK_PATH / block_name;
   if (std::filesystem::exists(block_path)) {
     // it is a disk
-    return /* disk */ block_path;
+    return /* disk */ block_path / BLOCK_STAT_NAME;
   }
   // it is a device of a disk
   const std::string& device_name = block_name;
@@ -186,30 +361,39 @@ std::filesystem::path BlockInfo::find_block_stat(const std::filesystem::path& bl
   throw std::runtime_error{"could not find stat file of `" + disk_path.string() + "`"};
 }
 
-std::pair<std::uint64_t, std::uint64_t> BlockInfo::get_io_statistics(const std::filesystem::path& stat_file) {
-  std::ifstream stat(stat_file);
-  if (!stat.good()) {
-    DS_LOGERR << "failed to read stat file " << stat_file << '\n';
+std::pair<std::uint64_t, std::uint64_t> BlockInfo::get_io_statistics(File& stat,
+                                                                     const std::filesystem::path& stat_file) {
+  Counters counters{};
+  if (!get_counters(stat, stat_file, counters)) {
     return {-1, -1};
   }
-  std::uint64_t reads{0};
-  std::uint64_t writes{0};
-  stat >> reads;
-  for (int i = 0; i < 4; i++) {
-    stat >> writes;
+  return {counters.read_ios, counters.write_ios};
+}
+
+bool BlockInfo::get_counters(File& stat, const std::filesystem::path& stat_file, Counters& out) {
+  // one line of 11 to 17 numbers
+  char buf[512];
+  const ssize_t len = stat.good() ? stat.pread(buf, sizeof(buf), 0) : -1;
+  std::string_view fields{buf, static_cast<std::size_t>(std::max<ssize_t>(len, 0))};
+  // read I/Os, read merges, read sectors, read ticks, write I/Os, write merges, write sectors
+  std::uint64_t ignored{0};
+  if (!next_number(fields, out.read_ios) || !next_number(fields, ignored) || !next_number(fields, out.read_sectors)
+      || !next_number(fields, ignored) || !next_number(fields, out.write_ios) || !next_number(fields, ignored)
+      || !next_number(fields, out.write_sectors)) {
+    DS_LOGERR << "failed to read stat file " << stat_file << '\n';
+    return false;
   }
-  stat.close();
-  return {reads, writes};
+  return true;
 }
 
-BlockInfo::BlockInfo(std::unordered_map<std::filesystem::path, std::filesystem::path>::const_iterator mount_info)
-  : mount_info_iter(mount_info) {
-  stat_file = find_block_stat(mount_info_iter->second);
+BlockInfo::BlockInfo(const std::filesystem::path& mount_source) {
+  stat_file = find_block_stat(mount_source);
+  stat_fd = File{stat_file, O_RDONLY};
   last_io = get_io_statistics();
 }
 
 [[nodiscard]] std::pair<std::uint64_t, std::uint64_t> BlockInfo::get_io_statistics() const {
-  return get_io_statistics(stat_file);
+  return get_io_statistics(stat_fd, stat_file);
 }
 
 } // namespace ds
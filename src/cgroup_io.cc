@@ -0,0 +1,160 @@
+#include "do_not_sleep/cgroup_io.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "fcntl.h"
+#include "sys/sysmacros.h"
+#include "unistd.h"
+
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+// parse digits at `p`, advancing it
+std::uint64_t parse_uint(const char*& p, const char* end) {
+  std::uint64_t value{0};
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    value = value * 10 + static_cast<std::uint64_t>(*p - '0');
+  }
+  return value;
+}
+
+} // namespace
+
+const std::filesystem::path CgroupIO::CGROUP_ROOT{"/sys/fs/cgroup"};
+
+CgroupIO::CgroupIO(const std::vector<std::filesystem::path>& cgroups) : buf{} {
+  for (const std::filesystem::path& cgroup : cgroups) {
+    sources.emplace_back(Source{.io_stat = cgroup / "io.stat", .fd = -1});
+  }
+}
+
+CgroupIO::CgroupIO(CgroupIO&& other) noexcept
+  : sources(std::move(other.sources))
+  , disks(std::move(other.disks))
+  , totals(std::move(other.totals))
+  , buf{} {
+  other.sources.clear();
+}
+
+CgroupIO& CgroupIO::operator=(CgroupIO&& other) noexcept {
+  if (this != &other) {
+    for (Source& source : sources) {
+      if (source.fd != -1) {
+        close(source.fd);
+      }
+    }
+    sources = std::move(other.sources);
+    disks = std::move(other.disks);
+    totals = std::move(other.totals);
+    other.sources.clear();
+  }
+  return *this;
+}
+
+CgroupIO::~CgroupIO() {
+  for (Source& source : sources) {
+    if (source.fd != -1) {
+      close(source.fd);
+    }
+  }
+}
+
+std::size_t CgroupIO::track(const dev_t& disk) {
+  std::vector<dev_t>::const_iterator found = std::find(disks.begin(), disks.end(), disk);
+  if (found != disks.end()) {
+    return found - disks.begin();
+  }
+  disks.emplace_back(disk);
+  totals.emplace_back(Counters{});
+  return disks.size() - 1;
+}
+
+bool CgroupIO::scan() {
+  std::fill(totals.begin(), totals.end(), Counters{});
+  bool any{false};
+  for (Source& source : sources) {
+    if (source.fd == -1) {
+      // (re)started units get a new cgroup
+      source.fd = open(source.io_stat.c_str(), O_RDONLY | O_CLOEXEC);
+      if (source.fd == -1) {
+        continue;
+      }
+    }
+    std::size_t len{0};
+    ssize_t ret{0};
+    while (len < buf.size() && (ret = pread(source.fd, buf.data() + len, buf.size() - len, len)) > 0) {
+      len += ret;
+    }
+    if (ret == -1) {
+      // the cgroup is gone (ENODEV), reopen next time
+      close(source.fd);
+      source.fd = -1;
+      continue;
+    }
+    parse(buf.data(), buf.data() + len);
+    any = true;
+  }
+  return any;
+}
+
+[[nodiscard]] const CgroupIO::Counters& CgroupIO::counters(const std::size_t& index) const {
+  return totals[index];
+}
+
+std::filesystem::path CgroupIO::resolve(const std::string& unit) {
+  if (unit.find('/') == std::string::npos) {
+    return CGROUP_ROOT / "system.slice" / unit;
+  }
+  return CGROUP_ROOT / std::filesystem::path{unit}.relative_path();
+}
+
+void CgroupIO::parse(const char* begin, const char* end) {
+  // 8:16 rbytes=1459200 wbytes=314773504 rios=192 wios=353 dbytes=0 dios=0
+  const char* p = begin;
+  while (p < end) {
+    const char* line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+    const unsigned int major = parse_uint(p, line_end);
+    const unsigned int minor = (p < line_end && *p == ':') ? parse_uint(++p, line_end) : 0;
+    std::vector<dev_t>::const_iterator disk = std::find(disks.begin(), disks.end(), makedev(major, minor));
+    if (disk != disks.end()) {
+      Counters& total = totals[disk - disks.begin()];
+      while (p < line_end) {
+        const char* key = ++p;
+        const char* eq = static_cast<const char*>(std::memchr(key, '=', line_end - key));
+        if (eq == nullptr) {
+          break;
+        }
+        p = eq + 1;
+        const std::uint64_t value = parse_uint(p, line_end);
+        const std::string_view name{key, static_cast<std::size_t>(eq - key)};
+        if (name == "rbytes") {
+          total.rbytes += value;
+        } else if (name == "wbytes") {
+          total.wbytes += value;
+        } else if (name == "rios") {
+          total.rios += value;
+        } else if (name == "wios") {
+          total.wios += value;
+        }
+      }
+    }
+    p = line_end + 1;
+  }
+}
+
+} // namespace ds
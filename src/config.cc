@@ -1,28 +1,52 @@
 #include "do_not_sleep/config.h"
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "pwd.h"
 #include "unistd.h"
 
 #include "json/json.h"
 
+#include "do_not_sleep/cgroup_io.h"
+#include "do_not_sleep/device_class.h"
+#include "do_not_sleep/discovery.h"
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/hms.h"
+#include "do_not_sleep/priority.h"
+#include "do_not_sleep/schedule.h"
+#include "do_not_sleep/status_page.h"
 #include "do_not_sleep/util.h"
 
 namespace ds {
 
+// as jsoncpp prints it to a stream
+static LogLine& operator<<(LogLine& line, const Json::Value& value) {
+  return line << Json::writeString(Json::StreamWriterBuilder{}, value);
+}
+
 Config::Policy policy_from_string(std::string_view str) {
   static const std::unordered_map<std::string_view, Config::Policy> str2policy{
     {"time_range",        Config::Policy::TIME_RANGE       },
+    {"schedule",          Config::Policy::SCHEDULE         },
     {"monitor_io",        Config::Policy::MONITOR_IO       },
-    {"service_available", Config::Policy::SERVICE_AVAILABLE}
+    {"service_available", Config::Policy::SERVICE_AVAILABLE},
+    {"cgroup_io",         Config::Policy::CGROUP_IO        },
+    {"process_present",   Config::Policy::PROCESS_PRESENT  },
+    {"local_connection",  Config::Policy::LOCAL_CONNECTION }
   };
   std::unordered_map<std::string_view, Config::Policy>::const_iterator policy_iter = str2policy.find(str);
   if (policy_iter == str2policy.end()) {
@@ -43,14 +67,14 @@ bool jsoncpp_load_json(const std::filesystem::path& json_dir, Json::Value& out_j
     DS_LOGERR << json_dir << " is not a regular file.\n";
     return false;
   }
-  std::ifstream conf_file{json_dir, std::ios::binary};
-  if (conf_file.bad()) {
-    DS_LOGERR << "failed to open file " << json_dir << ".\n";
+  std::string conf;
+  if (!File::read_file(json_dir, conf)) {
+    DS_LOGERR << "failed to read file " << json_dir << ".\n";
     return false;
   }
-  Json::CharReaderBuilder crb;
+  const std::unique_ptr<Json::CharReader> reader{Json::CharReaderBuilder{}.newCharReader()};
   std::string errs;
-  if (!Json::parseFromStream(crb, conf_file, &out_json, &errs)) {
+  if (!reader->parse(conf.data(), conf.data() + conf.size(), &out_json, &errs)) {
     DS_LOGERR << "failed to parse json from " << json_dir << "!\n" << errs << ".\n";
     return false;
   }
@@ -71,7 +95,174 @@ constexpr std::string_view jsoncpp_valuetype_str(const Json::ValueType& value_ty
   }
 }
 
+bool jsoncpp_load_hms(const Json::Value& hms_json,
+                      const std::string& key,
+                      const std::filesystem::path& config_dir,
+                      HMS& out_hms) {
+  if (hms_json == Json::Value::null) {
+    DS_LOGERR << "failed to read key `" << key << "` from " << config_dir << ".\n";
+    return false;
+  }
+  if (!hms_json.isArray() || hms_json.size() != 3) {
+    DS_LOGERR << '`' << key << "` should be an array of 3 items, got `" << hms_json << "` from " << config_dir
+              << ".\n";
+    return false;
+  }
+  static const char* const names[3]{"hour (0-24)", "minute (0-59)", "second (0-59)"};
+  static const unsigned int limits[3]{24, 59, 59};
+  unsigned int values[3]{};
+  for (Json::ArrayIndex i = 0; i < 3; i++) {
+    if (!hms_json[i].isUInt()) {
+      DS_LOGERR << '`' << key << '.' << i << "` should be unsigned integer, got `" << hms_json[i] << "` which is "
+                << jsoncpp_valuetype_str(hms_json[i].type()) << ", from " << config_dir << ".\n";
+      return false;
+    }
+    values[i] = hms_json[i].asUInt();
+    if (values[i] > limits[i]) {
+      DS_LOGERR << '`' << key << '.' << i << "` represents the " << names[i] << ", got " << hms_json[i] << " from "
+                << config_dir << ".\n";
+      return false;
+    }
+  }
+  out_hms = HMS{.hours = static_cast<std::uint_fast8_t>(values[0]),
+                .minutes = static_cast<std::uint_fast8_t>(values[1]),
+                .seconds = static_cast<std::uint_fast8_t>(values[2])};
+  return true;
+}
+
+bool jsoncpp_load_schedule_rules(const Json::Value& rules_json,
+                                 const std::string& key,
+                                 const std::filesystem::path& config_dir,
+                                 std::vector<Schedule::Rule>& out_rules) {
+  static const std::unordered_map<std::string_view, Schedule::Days> str2days{
+    {"sun",      0x01},
+    {"mon",      0x02},
+    {"tue",      0x04},
+    {"wed",      0x08},
+    {"thu",      0x10},
+    {"fri",      0x20},
+    {"sat",      0x40},
+    {"weekdays", 0x3e},
+    {"weekends", 0x41}
+  };
+  if (!rules_json.isArray()) {
+    DS_LOGERR << '`' << key << "` should be array, got `" << rules_json << "` which is "
+              << jsoncpp_valuetype_str(rules_json.type()) << ", from " << config_dir << ".\n";
+    return false;
+  }
+  for (Json::ArrayIndex i = 0; i < rules_json.size(); i++) {
+    const std::string rule_key = key + '.' + std::to_string(i);
+    const Json::Value& rule_json = rules_json[i];
+    if (!rule_json.isObject()) {
+      DS_LOGERR << '`' << rule_key << "` should be object, got `" << rule_json << "` which is "
+                << jsoncpp_valuetype_str(rule_json.type()) << ", from " << config_dir << ".\n";
+      return false;
+    }
+    Schedule::Rule rule{.days = Schedule::EVERYDAY, .start = HMS::UNSET, .end = HMS::UNSET};
+    const Json::Value& days_json = rule_json["days"];
+    if (days_json != Json::Value::null) {
+      if (!days_json.isArray()) {
+        DS_LOGERR << '`' << rule_key << ".days` should be array, got `" << days_json << "` which is "
+                  << jsoncpp_valuetype_str(days_json.type()) << ", from " << config_dir << ".\n";
+        return false;
+      }
+      rule.days = 0;
+      for (const Json::Value& day_json : days_json) {
+        std::unordered_map<std::string_view, Schedule::Days>::const_iterator day_iter
+          = day_json.isString() ? str2days.find(day_json.asString()) : str2days.end();
+        if (day_iter == str2days.end()) {
+          DS_LOGERR << '`' << rule_key << ".days.*` should be one of `sun` `mon` `tue` `wed` `thu` `fri` `sat` "
+                    << "`weekdays` `weekends`, got `" << day_json << "` from " << config_dir << ".\n";
+          return false;
+        }
+        rule.days |= day_iter->second;
+      }
+    }
+    if (!jsoncpp_load_hms(rule_json["start"], rule_key + ".start", config_dir, rule.start)
+        || !jsoncpp_load_hms(rule_json["end"], rule_key + ".end", config_dir, rule.end)) {
+      return false;
+    }
+    out_rules.emplace_back(rule);
+  }
+  return true;
+}
+
+bool jsoncpp_load_io_priority(const Json::Value& priority_json,
+                              const std::string& key,
+                              const std::filesystem::path& config_dir,
+                              IOPriority& out_priority) {
+  static const std::unordered_map<std::string_view, IOPriority::Class> str2class{
+    {"none",        IOPriority::Class::NONE       },
+    {"realtime",    IOPriority::Class::REALTIME   },
+    {"best_effort", IOPriority::Class::BEST_EFFORT},
+    {"idle",        IOPriority::Class::IDLE       }
+  };
+  // "idle" or {"class": "best_effort", "level": 0}
+  const Json::Value& class_json = priority_json.isObject() ? priority_json["class"] : priority_json;
+  std::unordered_map<std::string_view, IOPriority::Class>::const_iterator class_iter
+    = class_json.isString() ? str2class.find(class_json.asString()) : str2class.end();
+  if (class_iter == str2class.end()) {
+    DS_LOGERR << '`' << key << "` should be one of `none` `realtime` `best_effort` `idle`, got `" << class_json
+              << "` from " << config_dir << ".\n";
+    return false;
+  }
+  out_priority = IOPriority{.io_class = class_iter->second, .level = 4};
+  if (!priority_json.isObject() || priority_json["level"] == Json::Value::null) {
+    return true;
+  }
+  const Json::Value& level_json = priority_json["level"];
+  if (!level_json.isUInt() || level_json.asUInt() > 7) {
+    DS_LOGERR << '`' << key << ".level` should be 0-7, got `" << level_json << "` from " << config_dir << ".\n";
+    return false;
+  }
+  out_priority.level = static_cast<std::uint8_t>(level_json.asUInt());
+  return true;
+}
+
+// e.g. {"keepalive": "read", "interval": 60}
+bool jsoncpp_load_class_policy(const Json::Value& class_json,
+                               const std::string& key,
+                               const std::filesystem::path& config_dir,
+                               Config::ClassPolicy& out_policy) {
+  static const std::unordered_map<std::string_view, Config::Keepalive> str2keepalive{
+    {"none",  Config::Keepalive::NONE },
+    {"write", Config::Keepalive::WRITE},
+    {"read",  Config::Keepalive::READ }
+  };
+  if (!class_json.isObject()) {
+    DS_LOGERR << '`' << key << "` should be object, got `" << class_json << "` which is "
+              << jsoncpp_valuetype_str(class_json.type()) << ", from " << config_dir << ".\n";
+    return false;
+  }
+  const Json::Value& keepalive_json = class_json["keepalive"];
+  if (keepalive_json != Json::Value::null) {
+    std::unordered_map<std::string_view, Config::Keepalive>::const_iterator keepalive_iter
+      = keepalive_json.isString() ? str2keepalive.find(keepalive_json.asString()) : str2keepalive.end();
+    if (keepalive_iter == str2keepalive.end()) {
+      DS_LOGERR << '`' << key << ".keepalive` should be one of `none` `write` `read`, got `" << keepalive_json
+                << "` from " << config_dir << ".\n";
+      return false;
+    }
+    out_policy.keepalive = keepalive_iter->second;
+  }
+  const Json::Value& interval_json = class_json["interval"];
+  if (interval_json != Json::Value::null) {
+    if (!interval_json.isUInt() || interval_json.asUInt() == 0) {
+      DS_LOGERR << '`' << key << ".interval` should be positive integer, got `" << interval_json << "` from "
+                << config_dir << ".\n";
+      return false;
+    }
+    out_policy.interval = std::chrono::seconds{interval_json.asUInt()};
+  }
+  return true;
+}
+
 static const std::filesystem::path CONFIG_FILE = std::filesystem::path{".config"} / "do_not_sleep" / "conf";
+static const std::filesystem::path STATE_FILE_NAME = std::filesystem::path{"do_not_sleep"} / "state";
+// hours of keepalives, or minutes of per-second scans of a few disks, 1.4M of memory
+static const std::size_t TIMELINE_SPANS{16384};
+// a few MiB for a handful of disks
+static const std::uint32_t HISTORY_RETENTION_DAYS{90};
 
 /* NOLINTNEXTLINE(readability-function-cognitive-complexity) */
 Config Config::from_json(const std::filesystem::path& config_dir) {
@@ -137,158 +328,404 @@ Config Config::from_json(const std::filesystem::path& config_dir) {
       return UNSET;
     }
 
-    Json::Value time_range_start_json = time_range_json["start"];
-    if (time_range_start_json == Json::Value::null) {
-      DS_LOGERR << "failed to read key `time_range.start` from " << config_dir << ".\n";
+    if (!jsoncpp_load_hms(time_range_json["start"], "time_range.start", config_dir, conf.time_range.first)
+        || !jsoncpp_load_hms(time_range_json["end"], "time_range.end", config_dir, conf.time_range.second)) {
       return UNSET;
     }
-    if (time_range_start_json.size() != 3) {
-      DS_LOGERR << "`time_range.start` should contain 3 items, got " << time_range_start_json.size() << " from "
-                << config_dir << ".\n";
+    conf.schedule = Schedule{
+      {Schedule::Rule{.days = Schedule::EVERYDAY, .start = conf.time_range.first, .end = conf.time_range.second}},
+      {}
+    };
+  } else if (conf.policy == Policy::SCHEDULE) {
+    Json::Value schedule_json = conf_json["schedule"];
+    if (schedule_json == Json::Value::null) {
+      DS_LOGERR << "failed to read key `schedule` from " << config_dir << ".\n";
+      return UNSET;
+    }
+    Json::Value windows_json = schedule_json["windows"];
+    if (windows_json == Json::Value::null) {
+      DS_LOGERR << "failed to read key `schedule.windows` from " << config_dir << ".\n";
+      return UNSET;
+    }
+    std::vector<Schedule::Rule> windows;
+    if (!jsoncpp_load_schedule_rules(windows_json, "schedule.windows", config_dir, windows)) {
+      return UNSET;
+    }
+    std::vector<Schedule::Rule> exceptions;
+    Json::Value exceptions_json = schedule_json["exceptions"];
+    if (exceptions_json != Json::Value::null
+        && !jsoncpp_load_schedule_rules(exceptions_json, "schedule.exceptions", config_dir, exceptions)) {
+      return UNSET;
+    }
+    conf.schedule = Schedule{windows, exceptions};
+  } else if (conf.policy == Policy::MONITOR_IO) {
+    Json::Value monitor_io_json = conf_json["monitor_io"];
+    if (monitor_io_json == Json::Value::null) {
+      DS_LOGERR << "failed to read key `monitor_io` from " << config_dir << ".\n";
       return UNSET;
     }
 
-    Json::Value time_range_start_0_json = time_range_start_json[0];
-    if (!time_range_start_0_json.isUInt()) {
-      DS_LOGERR << "`time_range.start.0` should be unsigned integer, got `" << time_range_start_0_json << "` which is "
-                << jsoncpp_valuetype_str(time_range_start_0_json.type()) << ", from " << config_dir << ".\n";
+    Json::Value scan_frequency_json = monitor_io_json["scan_frequency"];
+    if (scan_frequency_json == Json::Value::null) {
+      DS_LOGERR << "failed to read key `monitor_io.scan_frequency` from " << config_dir << ".\n";
       return UNSET;
     }
-    conf.time_range.first.hours = time_range_start_0_json.asUInt();
-    if (conf.time_range.first.hours > 24) {
-      DS_LOGERR << "`time_range.start.0` represents the hour (0-24), got " << time_range_start_0_json << " from "
-                << config_dir << ".\n";
+    if (!scan_frequency_json.isUInt()) {
+      DS_LOGERR << "`monitor_io.scan_frequency` should be unsigned integer, got `" << scan_frequency_json
+                << "` which is " << jsoncpp_valuetype_str(scan_frequency_json.type()) << ", from " << config_dir
+                << ".\n";
+      return UNSET;
+    }
+    conf.scan_frequency = std::chrono::seconds{scan_frequency_json.asUInt()};
+    if (conf.scan_frequency > conf.interval) {
+      DS_LOGERR << "scan_frequency should not be greater than interval (" << conf.scan_frequency.count() << " > "
+                << conf.interval.count() << ").\n";
       return UNSET;
     }
 
-    Json::Value time_range_start_1_json = time_range_start_json[1];
-    if (!time_range_start_1_json.isUInt()) {
-      DS_LOGERR << "`time_range.start.1` should be unsigned integer, got `" << time_range_start_1_json << "` which is "
-                << jsoncpp_valuetype_str(time_range_start_1_json.type()) << ", from " << config_dir << ".\n";
+    Json::Value keep_awake_json = monitor_io_json["keep_awake"];
+    if (keep_awake_json == Json::Value::null) {
+      DS_LOGERR << "failed to read key `monitor_io.keep_awake` from " << config_dir << ".\n";
       return UNSET;
     }
-    conf.time_range.first.minutes = time_range_start_1_json.asUInt();
-    if (conf.time_range.first.minutes > 60) {
-      DS_LOGERR << "`time_range.start.1` represents the minute (0-60), got " << time_range_start_1_json << " from "
-                << config_dir << ".\n";
+    if (!keep_awake_json.isUInt()) {
+      DS_LOGERR << "`monitor_io.keep_awake` should be unsigned integer, got `" << keep_awake_json << "` which is "
+                << jsoncpp_valuetype_str(keep_awake_json.type()) << ", from " << config_dir << ".\n";
+      return UNSET;
+    }
+    conf.keep_awake = std::chrono::seconds{keep_awake_json.asUInt()};
+
+    Json::Value trigger_json = monitor_io_json["trigger"];
+    if (trigger_json == Json::Value::null) {
+      conf.trigger = Trigger::POLL;
+    } else if (!trigger_json.isString()) {
+      DS_LOGERR << "`monitor_io.trigger` should be string, got `" << trigger_json << "` which is "
+                << jsoncpp_valuetype_str(trigger_json.type()) << ", from " << config_dir << ".\n";
+      return UNSET;
+    } else if (trigger_json.asString() == "poll") {
+      conf.trigger = Trigger::POLL;
+    } else if (trigger_json.asString() == "fanotify") {
+      conf.trigger = Trigger::FANOTIFY;
+    } else {
+      DS_LOGERR << "`monitor_io.trigger` should be `poll` or `fanotify`, got `" << trigger_json.asString()
+                << "` from " << config_dir << ".\n";
       return UNSET;
     }
 
-    Json::Value time_range_start_2_json = time_range_start_json[2];
-    if (!time_range_start_2_json.isUInt()) {
-      DS_LOGERR << "`time_range.start.2` should be unsigned integer, got `" << time_range_start_2_json << "` which is "
-                << jsoncpp_valuetype_str(time_range_start_2_json.type()) << ", from " << config_dir << ".\n";
+    if (conf.trigger == Trigger::POLL && conf.scan_frequency == std::chrono::seconds::zero()) {
+      DS_LOGERR << "`monitor_io.scan_frequency` should be positive with `poll` trigger, from " << config_dir << ".\n";
       return UNSET;
     }
-    conf.time_range.first.seconds = time_range_start_2_json.asUInt();
-    if (conf.time_range.first.seconds > 60) {
-      DS_LOGERR << "`time_range.start.2` represents the second (0-60), got " << time_range_start_2_json << " from "
-                << config_dir << ".\n";
+    for (const char* key : {"sectors_per_second", "ios"}) {
+      const Json::Value value_json = monitor_io_json.get(key, Json::Value::null);
+      if (value_json != Json::Value::null && (!value_json.isNumeric() || value_json.asDouble() < 0)) {
+        DS_LOGERR << "`monitor_io." << key << "` should be non-negative number, got `" << value_json << "` from "
+                  << config_dir << ".\n";
+        return UNSET;
+      }
+    }
+    for (const char* key : {"half_life", "noise_half_life"}) {
+      const Json::Value value_json = monitor_io_json.get(key, Json::Value::null);
+      if (value_json != Json::Value::null && (!value_json.isUInt() || value_json.asUInt() == 0)) {
+        DS_LOGERR << "`monitor_io." << key << "` should be positive integer, got `" << value_json << "` from "
+                  << config_dir << ".\n";
+        return UNSET;
+      }
+    }
+    conf.activity.sectors_per_second = monitor_io_json.get("sectors_per_second", 64).asDouble();
+    conf.activity.ios = monitor_io_json.get("ios", 16).asDouble();
+    conf.activity.half_life = std::chrono::seconds{monitor_io_json.get("half_life", 30).asUInt()};
+    conf.activity.noise_half_life = std::chrono::seconds{monitor_io_json.get("noise_half_life", 3600).asUInt()};
+  } else if (conf.policy == Policy::SERVICE_AVAILABLE) {
+    Json::Value service_available_json = conf_json["service_available"];
+    if (service_available_json == Json::Value::null) {
+      DS_LOGERR << "failed to read key `service_available` from " << config_dir << ".\n";
+      return UNSET;
+    }
+    if (!service_available_json.isString()) {
+      DS_LOGERR << "`service_available` should be string, got `" << service_available_json << "` which is "
+                << jsoncpp_valuetype_str(service_available_json.type()) << ", from " << config_dir << ".\n";
+      return UNSET;
+    }
+    conf.service = service_available_json.asString();
+  } else if (conf.policy == Policy::CGROUP_IO) {
+    Json::Value cgroup_io_json = conf_json["cgroup_io"];
+    if (cgroup_io_json == Json::Value::null) {
+      DS_LOGERR << "failed to read key `cgroup_io` from " << config_dir << ".\n";
+      return UNSET;
     }
 
-    Json::Value time_range_end_json = time_range_json["end"];
-    if (time_range_end_json == Json::Value::null) {
-      DS_LOGERR << "failed to read key `time_range.end` from " << config_dir << ".\n";
+    Json::Value units_json = cgroup_io_json["units"];
+    if (!units_json.isArray() || units_json.empty()) {
+      DS_LOGERR << "`cgroup_io.units` should be a non-empty array, got `" << units_json << "` from " << config_dir
+                << ".\n";
       return UNSET;
     }
-    if (time_range_end_json.size() != 3) {
-      DS_LOGERR << "`time_range.end` should contain 3 items, got " << time_range_end_json.size() << " from "
+    for (const Json::Value& unit_json : units_json) {
+      if (!unit_json.isString()) {
+        DS_LOGERR << "`cgroup_io.units.*` should be string, got `" << unit_json << "` which is "
+                  << jsoncpp_valuetype_str(unit_json.type()) << ", from " << config_dir << ".\n";
+        return UNSET;
+      }
+      conf.cgroups.emplace_back(CgroupIO::resolve(unit_json.asString()));
+    }
+
+    Json::Value scan_frequency_json = cgroup_io_json["scan_frequency"];
+    if (!scan_frequency_json.isUInt() || scan_frequency_json.asUInt() == 0) {
+      DS_LOGERR << "`cgroup_io.scan_frequency` should be positive integer, got `" << scan_frequency_json << "` from "
                 << config_dir << ".\n";
       return UNSET;
     }
+    conf.scan_frequency = std::chrono::seconds{scan_frequency_json.asUInt()};
 
-    Json::Value time_range_end_0_json = time_range_end_json[0];
-    if (!time_range_end_0_json.isUInt()) {
-      DS_LOGERR << "`time_range.end.0` should be unsigned integer, got `" << time_range_end_0_json << "` which is "
-                << jsoncpp_valuetype_str(time_range_end_0_json.type()) << ", from " << config_dir << ".\n";
+    Json::Value keep_awake_json = cgroup_io_json["keep_awake"];
+    if (!keep_awake_json.isUInt()) {
+      DS_LOGERR << "`cgroup_io.keep_awake` should be unsigned integer, got `" << keep_awake_json << "` from "
+                << config_dir << ".\n";
       return UNSET;
     }
-    conf.time_range.second.hours = time_range_end_0_json.asUInt();
-    if (conf.time_range.second.hours > 24) {
-      DS_LOGERR << "`time_range.end.0` represents the hour (0-24), got " << time_range_end_0_json << " from "
+    conf.keep_awake = std::chrono::seconds{keep_awake_json.asUInt()};
+  } else if (conf.policy == Policy::PROCESS_PRESENT) {
+    Json::Value process_present_json = conf_json["process_present"];
+    if (!process_present_json.isArray() || process_present_json.empty()) {
+      DS_LOGERR << "`process_present` should be a non-empty array, got `" << process_present_json << "` from "
                 << config_dir << ".\n";
       return UNSET;
     }
+    for (const Json::Value& process_json : process_present_json) {
+      if (!process_json.isString() || process_json.asString().empty()) {
+        DS_LOGERR << "`process_present.*` should be a process name, got `" << process_json << "` from " << config_dir
+                  << ".\n";
+        return UNSET;
+      }
+      conf.processes.emplace_back(process_json.asString());
+    }
+  } else if (conf.policy == Policy::LOCAL_CONNECTION) {
+    Json::Value local_connection_json = conf_json["local_connection"];
+    if (!local_connection_json.isArray() || local_connection_json.empty()) {
+      DS_LOGERR << "`local_connection` should be a non-empty array, got `" << local_connection_json << "` from "
+                << config_dir << ".\n";
+      return UNSET;
+    }
+    for (const Json::Value& port_json : local_connection_json) {
+      if (!port_json.isUInt() || port_json.asUInt() == 0
+          || port_json.asUInt() > std::numeric_limits<std::uint16_t>::max()) {
+        DS_LOGERR << "`local_connection.*` should be a TCP port, got `" << port_json << "` from " << config_dir
+                  << ".\n";
+        return UNSET;
+      }
+      conf.ports.emplace_back(static_cast<std::uint16_t>(port_json.asUInt()));
+    }
+  }
 
-    Json::Value time_range_end_1_json = time_range_end_json[1];
-    if (!time_range_end_1_json.isUInt()) {
-      DS_LOGERR << "`time_range.end.1` should be unsigned integer, got `" << time_range_end_1_json << "` which is "
-                << jsoncpp_valuetype_str(time_range_end_1_json.type()) << ", from " << config_dir << ".\n";
+  Json::Value skip_active_json = conf_json["skip_active"];
+  if (skip_active_json == Json::Value::null) {
+    conf.skip_active = true;
+  } else if (!skip_active_json.isBool()) {
+    DS_LOGERR << "`skip_active` should be boolean, got `" << skip_active_json << "` which is "
+              << jsoncpp_valuetype_str(skip_active_json.type()) << ", from " << config_dir << ".\n";
+    return UNSET;
+  } else {
+    conf.skip_active = skip_active_json.asBool();
+  }
+
+  Json::Value state_file_json = conf_json["state_file"];
+  if (state_file_json == Json::Value::null) {
+    conf.state_file = default_state_file();
+  } else if (!state_file_json.isString()) {
+    DS_LOGERR << "`state_file` should be string, got `" << state_file_json << "` which is "
+              << jsoncpp_valuetype_str(state_file_json.type()) << ", from " << config_dir << ".\n";
+    return UNSET;
+  } else {
+    conf.state_file = state_file_json.asString();
+  }
+
+  Json::Value status_page_json = conf_json["status_page"];
+  if (status_page_json == Json::Value::null) {
+    conf.status_page = status::DEFAULT_NAME;
+  } else if (!status_page_json.isString()) {
+    DS_LOGERR << "`status_page` should be string, got `" << status_page_json << "` which is "
+              << jsoncpp_valuetype_str(status_page_json.type()) << ", from " << config_dir << ".\n";
+    return UNSET;
+  } else {
+    conf.status_page = status_page_json.asString();
+  }
+
+  // next to the state file by default
+  conf.timeline_spans = TIMELINE_SPANS;
+  conf.timeline_file = conf.state_file.empty() ? std::filesystem::path{} : conf.state_file.parent_path() / "trace.json";
+  Json::Value timeline_json = conf_json["timeline"];
+  if (timeline_json != Json::Value::null) {
+    if (!timeline_json.isObject()) {
+      DS_LOGERR << "`timeline` should be object, got `" << timeline_json << "` which is "
+                << jsoncpp_valuetype_str(timeline_json.type()) << ", from " << config_dir << ".\n";
       return UNSET;
     }
-    conf.time_range.second.minutes = time_range_end_1_json.asUInt();
-    if (conf.time_range.second.minutes > 24) {
-      DS_LOGERR << "`time_range.end.1` represents the minute (0-60), got " << time_range_end_1_json << " from "
-                << config_dir << ".\n";
+    Json::Value spans_json = timeline_json["spans"];
+    if (spans_json.isUInt()) {
+      conf.timeline_spans = spans_json.asUInt();
+    } else if (spans_json != Json::Value::null) {
+      DS_LOGERR << "`timeline.spans` should be unsigned integer, got `" << spans_json << "` from " << config_dir
+                << ".\n";
+      return UNSET;
+    }
+    Json::Value file_json = timeline_json["file"];
+    if (file_json.isString()) {
+      conf.timeline_file = file_json.asString();
+    } else if (file_json != Json::Value::null) {
+      DS_LOGERR << "`timeline.file` should be string, got `" << file_json << "` from " << config_dir << ".\n";
       return UNSET;
     }
+  }
 
-    Json::Value time_range_end_2_json = time_range_end_json[2];
-    if (!time_range_end_2_json.isUInt()) {
-      DS_LOGERR << "`time_range.end.1` should be unsigned integer, got `" << time_range_end_2_json << "` which is "
-                << jsoncpp_valuetype_str(time_range_end_2_json.type()) << ", from " << config_dir << ".\n";
+  conf.history_dir = conf.state_file.empty() ? std::filesystem::path{} : conf.state_file.parent_path() / "history";
+  conf.history_retention = std::chrono::hours{24 * HISTORY_RETENTION_DAYS};
+  Json::Value history_json = conf_json["history"];
+  if (history_json != Json::Value::null) {
+    if (!history_json.isObject()) {
+      DS_LOGERR << "`history` should be object, got `" << history_json << "` which is "
+                << jsoncpp_valuetype_str(history_json.type()) << ", from " << config_dir << ".\n";
+      return UNSET;
+    }
+    Json::Value dir_json = history_json["dir"];
+    if (dir_json.isString()) {
+      conf.history_dir = dir_json.asString();
+    } else if (dir_json != Json::Value::null) {
+      DS_LOGERR << "`history.dir` should be string, got `" << dir_json << "` from " << config_dir << ".\n";
       return UNSET;
     }
-    conf.time_range.second.seconds = time_range_end_2_json.asUInt();
-    if (conf.time_range.second.seconds > 24) {
-      DS_LOGERR << "`time_range.end.2` represents the second (0-60), got " << time_range_end_2_json << " from "
+    Json::Value retention_json = history_json["retention"];
+    if (retention_json.isUInt() && retention_json.asUInt() > 0) {
+      conf.history_retention = std::chrono::hours{24 * retention_json.asUInt()};
+    } else if (retention_json != Json::Value::null) {
+      DS_LOGERR << "`history.retention` should be positive integer (days), got `" << retention_json << "` from "
                 << config_dir << ".\n";
       return UNSET;
     }
-  } else if (conf.policy == Policy::MONITOR_IO) {
-    // ============================================================
-    // TODO(rayalto): fix this shit
-    DS_LOGERR << "monitor_io policy is currently unavailable.\n";
-    return UNSET;
-    // ============================================================
+  }
 
-    Json::Value monitor_io_json = conf_json["monitor_io"];
-    if (monitor_io_json == Json::Value::null) {
-      DS_LOGERR << "failed to read key `monitor_io` from " << config_dir << ".\n";
+  Json::Value device_classes_json = conf_json["device_classes"];
+  if (device_classes_json != Json::Value::null) {
+    if (!device_classes_json.isObject()) {
+      DS_LOGERR << "`device_classes` should be object, got `" << device_classes_json << "` which is "
+                << jsoncpp_valuetype_str(device_classes_json.type()) << ", from " << config_dir << ".\n";
       return UNSET;
     }
+    for (const std::string& name : device_classes_json.getMemberNames()) {
+      std::size_t kind{0};
+      while (kind < DeviceClass::KIND_COUNT && DeviceClass::kind_name(static_cast<DeviceClass::Kind>(kind)) != name) {
+        kind++;
+      }
+      if (kind == DeviceClass::KIND_COUNT) {
+        DS_LOGERR << "`device_classes." << name
+                  << "` is not a device class ( `rotational` `solid_state` `zoned` `usb` `other` ), from "
+                  << config_dir << ".\n";
+        return UNSET;
+      }
+      if (!jsoncpp_load_class_policy(
+            device_classes_json[name], "device_classes." + name, config_dir, conf.device_classes[kind])) {
+        return UNSET;
+      }
+    }
+  }
 
-    Json::Value scan_frequency_json = monitor_io_json["scan_frequency"];
-    if (scan_frequency_json == Json::Value::null) {
-      DS_LOGERR << "failed to read key `monitor_io.scan_frequency` from " << config_dir << ".\n";
+  Json::Value discover_json = conf_json["discover"];
+  if (discover_json != Json::Value::null) {
+    if (!discover_json.isArray()) {
+      DS_LOGERR << "`discover` should be array, got `" << discover_json << "` which is "
+                << jsoncpp_valuetype_str(discover_json.type()) << ", from " << config_dir << ".\n";
       return UNSET;
     }
-    if (!scan_frequency_json.isUInt()) {
-      DS_LOGERR << "`monitor_io.scan_frequency` should be unsigned integer, got `" << scan_frequency_json
-                << "` which is " << jsoncpp_valuetype_str(scan_frequency_json.type()) << ", from " << config_dir
-                << ".\n";
+    for (const Json::Value& rule_json : discover_json) {
+      Discovery::Rule rule{};
+      for (std::pair<const char*, std::string*> field : {std::make_pair("serial", &rule.serial),
+                                                         std::make_pair("wwn", &rule.wwn),
+                                                         std::make_pair("model", &rule.model),
+                                                         std::make_pair("label", &rule.label)}) {
+        const Json::Value& field_json = rule_json.isObject() ? rule_json[field.first] : Json::Value::null;
+        if (field_json.isString()) {
+          *field.second = field_json.asString();
+        } else if (field_json != Json::Value::null) {
+          DS_LOGERR << "`discover.*." << field.first << "` should be string, got `" << field_json << "` from "
+                    << config_dir << ".\n";
+          return UNSET;
+        }
+      }
+      if (rule.serial.empty() && rule.wwn.empty() && rule.model.empty() && rule.label.empty()) {
+        DS_LOGERR << "`discover.*` should be an object with some of `serial` `wwn` `model` `label`, got `" << rule_json
+                  << "` from " << config_dir << ".\n";
+        return UNSET;
+      }
+      conf.discover.emplace_back(std::move(rule));
+    }
+    if (conf.policy != Policy::TIME_RANGE && conf.policy != Policy::SCHEDULE
+        && conf.policy != Policy::SERVICE_AVAILABLE && conf.policy != Policy::LOCAL_CONNECTION) {
+      DS_LOGERR << "`discover` is only supported with `time_range` `schedule` `service_available` "
+                << "`local_connection` policies, from " << config_dir << ".\n";
       return UNSET;
     }
-    conf.scan_frequency = std::chrono::seconds{scan_frequency_json.asUInt()};
-    if (conf.scan_frequency > conf.interval) {
-      DS_LOGERR << "scan_frequency should not be greater than interval (" << conf.scan_frequency.count() << " > "
-                << conf.interval.count() << ").\n";
+  }
+
+  Json::Value hung_io_json = conf_json["hung_io"];
+  if (hung_io_json != Json::Value::null) {
+    if (!hung_io_json.isObject()) {
+      DS_LOGERR << "`hung_io` should be object, got `" << hung_io_json << "` which is "
+                << jsoncpp_valuetype_str(hung_io_json.type()) << ", from " << config_dir << ".\n";
       return UNSET;
     }
+    for (const char* key : {"timeout", "failures", "backoff", "max_backoff"}) {
+      const Json::Value value_json = hung_io_json.get(key, Json::Value::null);
+      if (value_json != Json::Value::null && (!value_json.isUInt() || value_json.asUInt() == 0)) {
+        DS_LOGERR << "`hung_io." << key << "` should be positive integer, got `" << value_json << "` from "
+                  << config_dir << ".\n";
+        return UNSET;
+      }
+    }
+    conf.breaker.timeout = std::chrono::seconds{hung_io_json.get("timeout", 60).asUInt()};
+    conf.breaker.failures = hung_io_json.get("failures", 3).asUInt();
+    conf.breaker.backoff = std::chrono::seconds{hung_io_json.get("backoff", 60).asUInt()};
+    conf.breaker.max_backoff
+      = std::max(conf.breaker.backoff, std::chrono::seconds{hung_io_json.get("max_backoff", 3600).asUInt()});
+  }
 
-    Json::Value keep_awake_json = monitor_io_json["keep_awake"];
-    if (keep_awake_json == Json::Value::null) {
-      DS_LOGERR << "failed to read key `monitor_io.keep_awake` from " << config_dir << ".\n";
+  // background keepalives never compete with real work, wakes someone waits for do
+  conf.keepalive_priority = IOPriority{.io_class = IOPriority::Class::IDLE, .level = 0};
+  conf.wake_priority = IOPriority{.io_class = IOPriority::Class::BEST_EFFORT, .level = 0};
+  conf.cpu_idle = false;
+  Json::Value priority_json = conf_json["priority"];
+  if (priority_json != Json::Value::null) {
+    if (!priority_json.isObject()) {
+      DS_LOGERR << "`priority` should be object, got `" << priority_json << "` which is "
+                << jsoncpp_valuetype_str(priority_json.type()) << ", from " << config_dir << ".\n";
       return UNSET;
     }
-    if (!keep_awake_json.isUInt()) {
-      DS_LOGERR << "`monitor_io.keep_awake` should be unsigned integer, got `" << keep_awake_json << "` which is "
-                << jsoncpp_valuetype_str(keep_awake_json.type()) << ", from " << config_dir << ".\n";
+    if (priority_json["keepalive"] != Json::Value::null
+        && !jsoncpp_load_io_priority(
+          priority_json["keepalive"], "priority.keepalive", config_dir, conf.keepalive_priority)) {
       return UNSET;
     }
-    conf.keep_awake = std::chrono::seconds{keep_awake_json.asUInt()};
-  } else if (conf.policy == Policy::SERVICE_AVAILABLE) {
-    Json::Value service_available_json = conf_json["service_available"];
-    if (service_available_json == Json::Value::null) {
-      DS_LOGERR << "failed to read key `service_available` from " << config_dir << ".\n";
+    if (priority_json["wake"] != Json::Value::null
+        && !jsoncpp_load_io_priority(priority_json["wake"], "priority.wake", config_dir, conf.wake_priority)) {
       return UNSET;
     }
-    if (!service_available_json.isString()) {
-      DS_LOGERR << "`service_available` should be string, got `" << service_available_json << "` which is "
-                << jsoncpp_valuetype_str(service_available_json.type()) << ", from " << config_dir << ".\n";
+    Json::Value cpu_json = priority_json["cpu"];
+    if (cpu_json.isString() && cpu_json.asString() == "idle") {
+      conf.cpu_idle = true;
+    } else if (cpu_json.isInt() && cpu_json.asInt() >= -20 && cpu_json.asInt() <= 19) {
+      conf.nice = cpu_json.asInt();
+    } else if (cpu_json != Json::Value::null) {
+      DS_LOGERR << "`priority.cpu` should be `idle` or a nice value (-20-19), got `" << cpu_json << "` from "
+                << config_dir << ".\n";
+      return UNSET;
+    }
+    Json::Value cgroup_json = priority_json["cgroup"];
+    if (cgroup_json.isString()) {
+      conf.cgroup = cgroup_json.asString();
+    } else if (cgroup_json != Json::Value::null) {
+      DS_LOGERR << "`priority.cgroup` should be string, got `" << cgroup_json << "` which is "
+                << jsoncpp_valuetype_str(cgroup_json.type()) << ", from " << config_dir << ".\n";
       return UNSET;
     }
-    conf.service = service_available_json.asString();
   }
   return conf;
 }
@@ -304,26 +741,65 @@ bool operator!=(const Config& l, const Config& r) {
   return !(l == r);
 }
 
+// before `UNSET`, which copies it
+const std::array<Config::ClassPolicy, DeviceClass::KIND_COUNT> Config::DEFAULT_DEVICE_CLASSES{
+  {/* ROTATIONAL */ {.keepalive = Keepalive::WRITE, .interval = std::chrono::seconds::zero()},
+   /* SOLID_STATE */ {.keepalive = Keepalive::NONE, .interval = std::chrono::seconds::zero()},
+   /* ZONED */ {.keepalive = Keepalive::READ, .interval = std::chrono::seconds::zero()},
+   /* USB */ {.keepalive = Keepalive::WRITE, .interval = std::chrono::seconds::zero()},
+   /* OTHER */ {.keepalive = Keepalive::WRITE, .interval = std::chrono::seconds::zero()}}
+};
+
 const Config Config::UNSET{};
 
-const std::filesystem::path Config::CONFIG_DIR{[]() -> std::filesystem::path {
-  std::size_t pwd_buf_len = sysconf(_SC_GETPW_R_SIZE_MAX);
+// empty if unknown
+static std::filesystem::path user_home() {
+  long pwd_buf_len = sysconf(_SC_GETPW_R_SIZE_MAX);
   if (pwd_buf_len == -1) {
     pwd_buf_len = 4096;
   }
-  char pwd_buf[pwd_buf_len];
+  std::vector<char> pwd_buf(pwd_buf_len);
   passwd pwd_result{};
   passwd* pwd_resultp = nullptr;
-  int e = getpwuid_r(getuid(), &pwd_result, pwd_buf, pwd_buf_len, &pwd_resultp);
-  if (e == 0) {
-    return std::filesystem::path{pwd_result.pw_dir} / CONFIG_FILE;
+  int e{0};
+  while ((e = getpwuid_r(getuid(), &pwd_result, pwd_buf.data(), pwd_buf.size(), &pwd_resultp)) == ERANGE) {
+    pwd_buf.resize(pwd_buf.size() * 2);
+  }
+  if (e == 0 && pwd_resultp != nullptr) {
+    return pwd_result.pw_dir;
   }
   std::optional<std::string> env_home = getenv_safe("HOME");
   if (env_home.has_value()) {
-    return std::filesystem::path{env_home.value()} / CONFIG_FILE;
+    return env_home.value();
   }
-  DS_LOGERR << "failed to derive user directory, `ds::Config::CONFIG_DIR` need to be initialized manually!\n";
   return {};
-}()};
+}
+
+const std::filesystem::path& Config::default_config_dir() {
+  static const std::filesystem::path config_dir{[]() -> std::filesystem::path {
+    std::filesystem::path home = user_home();
+    if (!home.empty()) {
+      return home / CONFIG_FILE;
+    }
+    DS_LOGERR << "failed to derive user directory, pass the config path to `ds::Config::from_json`!\n";
+    return {};
+  }()};
+  return config_dir;
+}
+
+const std::filesystem::path& Config::default_state_file() {
+  static const std::filesystem::path state_file{[]() -> std::filesystem::path {
+    std::optional<std::string> env_state_home = getenv_safe("XDG_STATE_HOME");
+    if (env_state_home.has_value() && !env_state_home.value().empty()) {
+      return std::filesystem::path{env_state_home.value()} / STATE_FILE_NAME;
+    }
+    std::filesystem::path home = user_home();
+    if (!home.empty()) {
+      return home / ".local" / "state" / STATE_FILE_NAME;
+    }
+    return {};
+  }()};
+  return state_file;
+}
 
 } // namespace ds
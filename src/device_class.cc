@@ -0,0 +1,194 @@
+#include "do_not_sleep/device_class.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "sys/stat.h"
+#include "sys/sysmacros.h"
+#include "sys/types.h"
+
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+constexpr DeviceClass UNKNOWN_DEVICE{.kind = DeviceClass::Kind::OTHER,
+                                     .rotational = true,
+                                     .transport = DeviceClass::Transport::UNKNOWN,
+                                     .zoned = DeviceClass::Zoned::NONE,
+                                     .is_virtual = false};
+
+// first line of a sysfs attribute, empty if it does not exist
+std::string read_attribute(const std::filesystem::path& path) {
+  std::string value;
+  File::read_file(path, value);
+  value.erase(std::min(value.find('\n'), value.size()));
+  return value;
+}
+
+// from where the device sits in /sys/devices, e.g. `/sys/devices/pci0000:00/.../usb2/.../block/sdb`
+DeviceClass::Transport transport_of(const std::filesystem::path& block) {
+  const std::string& path = block.native();
+  if (path.find("/usb") != std::string::npos) {
+    // usb-storage and uas are scsi too, check it first
+    return DeviceClass::Transport::USB;
+  }
+  if (path.find("/nvme") != std::string::npos) {
+    return DeviceClass::Transport::NVME;
+  }
+  if (path.find("/ata") != std::string::npos) {
+    return DeviceClass::Transport::ATA;
+  }
+  if (path.find("/virtio") != std::string::npos) {
+    return DeviceClass::Transport::VIRTIO;
+  }
+  if (path.find("/mmc") != std::string::npos) {
+    return DeviceClass::Transport::MMC;
+  }
+  if (path.find("/host") != std::string::npos && path.find("/target") != std::string::npos) {
+    return DeviceClass::Transport::SCSI;
+  }
+  return DeviceClass::Transport::UNKNOWN;
+}
+
+std::string_view transport_name(const DeviceClass::Transport& transport) {
+  switch (transport) {
+    case DeviceClass::Transport::ATA: return "ata";
+    case DeviceClass::Transport::SCSI: return "scsi";
+    case DeviceClass::Transport::NVME: return "nvme";
+    case DeviceClass::Transport::USB: return "usb";
+    case DeviceClass::Transport::VIRTIO: return "virtio";
+    case DeviceClass::Transport::MMC: return "mmc";
+    default: return "unknown";
+  }
+}
+
+} // namespace
+
+const std::filesystem::path DeviceClass::SYS_DEV_BLOCK_PATH{"/sys/dev/block"};
+
+DeviceClass DeviceClass::of(const std::filesystem::path& path) {
+  struct stat path_stat {};
+  if (stat(path.c_str(), &path_stat) == -1) {
+    return UNKNOWN_DEVICE;
+  }
+  return of(path_stat.st_dev);
+}
+
+DeviceClass DeviceClass::of(const dev_t& device) {
+  return of(device, 0);
+}
+
+std::string_view DeviceClass::kind_name(const Kind& kind) {
+  switch (kind) {
+    case Kind::ROTATIONAL: return "rotational";
+    case Kind::SOLID_STATE: return "solid_state";
+    case Kind::ZONED: return "zoned";
+    case Kind::USB: return "usb";
+    default: return "other";
+  }
+}
+
+LogLine& operator<<(LogLine& line, const DeviceClass& device_class) {
+  line << DeviceClass::kind_name(device_class.kind) << " ("
+       << (device_class.rotational ? "rotational" : "non-rotational") << ", " << transport_name(device_class.transport);
+  if (device_class.zoned == DeviceClass::Zoned::HOST_AWARE) {
+    line << ", host-aware zoned";
+  } else if (device_class.zoned == DeviceClass::Zoned::HOST_MANAGED) {
+    line << ", host-managed zoned";
+  }
+  if (device_class.is_virtual) {
+    line << ", virtual";
+  }
+  return line << ')';
+}
+
+DeviceClass DeviceClass::of(const dev_t& device, const int& depth) {
+  if (depth > MAX_DEPTH) {
+    return UNKNOWN_DEVICE;
+  }
+  std::error_code ec;
+  std::filesystem::path block = std::filesystem::canonical(
+    SYS_DEV_BLOCK_PATH / (std::to_string(major(device)) + ':' + std::to_string(minor(device))), ec);
+  if (ec) {
+    // not a block device
+    return UNKNOWN_DEVICE;
+  }
+  if (std::filesystem::exists(block / "partition")) {
+    // e.g. /sys/devices/.../block/sda/sda1 -> /sys/devices/.../block/sda
+    block = block.parent_path();
+  }
+  return of_disk(block, depth);
+}
+
+DeviceClass DeviceClass::of_disk(const std::filesystem::path& block, const int& depth) {
+  std::error_code ec;
+  const std::string backing_file = read_attribute(block / "loop" / "backing_file");
+  if (!backing_file.empty()) {
+    // a loop device is whatever its backing file is on
+    struct stat backing_stat {};
+    DeviceClass result = stat(backing_file.c_str(), &backing_stat) == 0 ? of(backing_stat.st_dev, depth + 1)
+                                                                         : UNKNOWN_DEVICE;
+    result.is_virtual = true;
+    return result;
+  }
+  std::filesystem::directory_iterator slaves{block / "slaves", ec};
+  if (!ec && slaves != std::filesystem::directory_iterator{}) {
+    // dm or md, rotational if any member is, so a mirror of an SSD and an HDD still gets kept awake
+    DeviceClass result{.kind = Kind::OTHER,
+                       .rotational = false,
+                       .transport = Transport::UNKNOWN,
+                       .zoned = Zoned::NONE,
+                       .is_virtual = true};
+    bool first{true};
+    for (const std::filesystem::directory_entry& slave : slaves) {
+      std::filesystem::path slave_block = std::filesystem::canonical(slave.path(), ec);
+      if (ec) {
+        continue;
+      }
+      if (std::filesystem::exists(slave_block / "partition")) {
+        slave_block = slave_block.parent_path();
+      }
+      const DeviceClass slave_class = of_disk(slave_block, depth + 1);
+      result.rotational = result.rotational || slave_class.rotational;
+      result.zoned = std::max(result.zoned, slave_class.zoned);
+      result.transport = first || result.transport == slave_class.transport ? slave_class.transport
+                                                                             : Transport::UNKNOWN;
+      first = false;
+    }
+    if (first) {
+      return UNKNOWN_DEVICE;
+    }
+    result.update_kind();
+    return result;
+  }
+  const std::string zoned = read_attribute(block / "queue" / "zoned");
+  DeviceClass result{.kind = Kind::OTHER,
+                     .rotational = read_attribute(block / "queue" / "rotational") != "0",
+                     .transport = transport_of(block),
+                     .zoned = zoned == "host-managed" ? Zoned::HOST_MANAGED
+                              : zoned == "host-aware" ? Zoned::HOST_AWARE
+                                                      : Zoned::NONE,
+                     .is_virtual = block.native().find("/virtual/") != std::string::npos};
+  result.update_kind();
+  return result;
+}
+
+void DeviceClass::update_kind() {
+  if (!rotational) {
+    kind = Kind::SOLID_STATE;
+  } else if (zoned != Zoned::NONE) {
+    kind = Kind::ZONED;
+  } else if (transport == Transport::USB) {
+    kind = Kind::USB;
+  } else {
+    kind = Kind::ROTATIONAL;
+  }
+}
+
+} // namespace ds
@@ -0,0 +1,228 @@
+#include "do_not_sleep/device_worker.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "unistd.h"
+
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/probe.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+DeviceWorker::DeviceWorker(std::string name, const Breaker& breaker)
+  : name(std::move(name))
+  , limits(breaker)
+  , shared(std::make_shared<Shared>())
+  , failures(0)
+  , backoff(breaker.backoff)
+  , quarantined_until() {
+  shared->pending = false;
+  shared->busy = false;
+  shared->abandoned = false;
+  shared->stop = false;
+  shared->stats = Stats{};
+}
+
+DeviceWorker& DeviceWorker::operator=(DeviceWorker&& other) noexcept {
+  if (this != &other) {
+    release();
+    name = std::move(other.name);
+    limits = other.limits;
+    shared = std::move(other.shared);
+    thread = std::move(other.thread);
+    failures = other.failures;
+    backoff = other.backoff;
+    quarantined_until = other.quarantined_until;
+  }
+  return *this;
+}
+
+DeviceWorker::~DeviceWorker() {
+  release();
+}
+
+DeviceWorker::Result DeviceWorker::submit(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock{shared->mutex};
+    if (shared->busy) {
+      shared->stats.rejected++;
+      return Result::STUCK;
+    }
+    // the worker only touches it while busy
+    shared->job = std::move(job);
+  }
+  return submit();
+}
+
+DeviceWorker::Result DeviceWorker::submit() {
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock{shared->mutex};
+  if (shared->busy) {
+    shared->stats.rejected++;
+    return Result::STUCK;
+  }
+  if (now < quarantined_until) {
+    shared->stats.rejected++;
+    return Result::QUARANTINED;
+  }
+  if (!thread.joinable()) {
+    // waits for the lock
+    thread = std::thread{loop, shared, name};
+  }
+  shared->pending = true;
+  shared->busy = true;
+  shared->abandoned = false;
+  shared->started = now;
+  shared->job_cv.notify_one();
+  return Result::DONE;
+}
+
+DeviceWorker::Result DeviceWorker::wait(const std::chrono::steady_clock::time_point& deadline) {
+  std::unique_lock<std::mutex> lock{shared->mutex};
+  if (shared->done_cv.wait_until(lock, deadline, [this]() { return !shared->busy; })) {
+    failures = 0;
+    backoff = limits.backoff;
+    return Result::DONE;
+  }
+  shared->abandoned = true;
+  shared->stats.timeouts++;
+  failures++;
+  DS_PROBE2(worker_timeout, name.c_str(), failures);
+  DS_LOGERR << name << ": I/O did not finish in "
+            << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - shared->started)
+                 .count()
+            << "s (" << failures << " timeout(s) in a row).\n";
+  if (failures >= limits.failures) {
+    shared->stats.quarantines++;
+    DS_PROBE2(worker_quarantine, name.c_str(), backoff.count());
+    quarantined_until = std::chrono::steady_clock::now() + backoff;
+    DS_LOGERR << name << ": quarantined for " << backoff.count() << "s.\n";
+    backoff = std::min(backoff * 2, limits.max_backoff);
+  }
+  return Result::TIMED_OUT;
+}
+
+[[nodiscard]] bool DeviceWorker::running() const {
+  std::lock_guard<std::mutex> lock{shared->mutex};
+  return shared->busy;
+}
+
+void DeviceWorker::notify(std::shared_ptr<File> done) {
+  std::lock_guard<std::mutex> lock{shared->mutex};
+  shared->done = std::move(done);
+}
+
+DeviceWorker::Result DeviceWorker::run(std::function<void()> job) {
+  const Result result = submit(std::move(job));
+  if (result != Result::DONE) {
+    return result;
+  }
+  return wait(std::chrono::steady_clock::now() + limits.timeout);
+}
+
+DeviceWorker::Result DeviceWorker::run_here(const std::function<void()>& job) {
+  {
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock{shared->mutex};
+    if (shared->busy) {
+      shared->stats.rejected++;
+      return Result::STUCK;
+    }
+    if (now < quarantined_until) {
+      shared->stats.rejected++;
+      return Result::QUARANTINED;
+    }
+    shared->busy = true;
+    shared->abandoned = false;
+    shared->started = now;
+  }
+  job();
+  const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock{shared->mutex};
+  shared->stats.done++;
+  shared->stats.last_duration = end - shared->started;
+  shared->busy = false;
+  failures = 0;
+  backoff = limits.backoff;
+  return Result::DONE;
+}
+
+[[nodiscard]] DeviceWorker::Stats DeviceWorker::stats() const {
+  std::lock_guard<std::mutex> lock{shared->mutex};
+  return shared->stats;
+}
+
+[[nodiscard]] std::chrono::steady_clock::time_point DeviceWorker::stuck_since() const {
+  std::lock_guard<std::mutex> lock{shared->mutex};
+  return shared->busy && shared->abandoned ? shared->started : std::chrono::steady_clock::time_point{};
+}
+
+[[nodiscard]] const DeviceWorker::Breaker& DeviceWorker::breaker() const {
+  return limits;
+}
+
+void DeviceWorker::release() {
+  if (shared == nullptr) {
+    // moved from
+    return;
+  }
+  bool busy{false};
+  {
+    std::lock_guard<std::mutex> lock{shared->mutex};
+    shared->stop = true;
+    busy = shared->busy;
+    shared->job_cv.notify_one();
+  }
+  if (busy) {
+    // joining would hang on a stuck disk, the thread holds its own reference to `shared`
+    thread.detach();
+  } else if (thread.joinable()) {
+    // not if it was never submitted to
+    thread.join();
+  }
+  shared.reset();
+}
+
+void DeviceWorker::loop(const std::shared_ptr<Shared>& shared, const std::string& name) {
+  std::unique_lock<std::mutex> lock{shared->mutex};
+  while (true) {
+    shared->job_cv.wait(lock, [&shared]() { return shared->stop || shared->pending; });
+    if (!shared->pending) {
+      return;
+    }
+    shared->pending = false;
+    lock.unlock();
+    // nobody replaces it while busy
+    shared->job();
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    lock.lock();
+    shared->stats.done++;
+    shared->stats.last_duration = end - shared->started;
+    if (shared->abandoned) {
+      shared->stats.longest_stuck = std::max(shared->stats.longest_stuck, shared->stats.last_duration);
+      DS_LOG << name << ": stuck I/O returned after "
+             << std::chrono::duration_cast<std::chrono::seconds>(shared->stats.last_duration).count() << "s.\n";
+    }
+    shared->busy = false;
+    if (shared->done != nullptr) {
+      // under the lock, whoever it wakes up finds the job returned
+      const std::uint64_t one{1};
+      if (write(shared->done->fd(), &one, sizeof(one)) == -1) {
+        DS_LOGERR << name << ": failed to tell the job returned: " << strerror_safe(errno) << '\n';
+      }
+    }
+    shared->done_cv.notify_all();
+  }
+}
+
+} // namespace ds
@@ -0,0 +1,267 @@
+#include "do_not_sleep/discovery.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "fcntl.h"
+#include "linux/netlink.h"
+#include "poll.h"
+#include "sys/socket.h"
+#include "sys/sysmacros.h"
+#include "sys/types.h"
+#include "unistd.h"
+
+#include "do_not_sleep/block_info.h"
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/probe.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+// first line of a sysfs attribute without trailing spaces, empty if it does not exist
+std::string read_attribute(const std::filesystem::path& path) {
+  std::string value;
+  File::read_file(path, value);
+  value.erase(std::min(value.find('\n'), value.size()));
+  value.erase(value.find_last_not_of(' ') + 1);
+  return value;
+}
+
+// `0x5000c500a1b2c3d4`, `naa.5000c500a1b2c3d4` -> `5000c500a1b2c3d4`
+std::string normalize_wwn(std::string wwn) {
+  std::transform(wwn.begin(), wwn.end(), wwn.begin(), [](const unsigned char& c) { return std::tolower(c); });
+  for (const std::string_view prefix : {"0x", "naa.", "eui.", "t10."}) {
+    if (wwn.rfind(prefix, 0) == 0) {
+      return wwn.substr(prefix.size());
+    }
+  }
+  return wwn;
+}
+
+// udev replaces spaces in `ID_MODEL` with `_`
+std::string normalize_model(std::string model) {
+  model.erase(model.find_last_not_of(' ') + 1);
+  std::replace(model.begin(), model.end(), ' ', '_');
+  return model;
+}
+
+const std::string& property(const std::unordered_map<std::string, std::string>& properties, const std::string& key) {
+  static const std::string EMPTY;
+  std::unordered_map<std::string, std::string>::const_iterator iter = properties.find(key);
+  return iter == properties.end() ? EMPTY : iter->second;
+}
+
+} // namespace
+
+const std::chrono::milliseconds Discovery::SETTLE_TIME{500};
+const std::filesystem::path Discovery::MOUNT_INFO_PATH{"/proc/self/mountinfo"};
+const std::filesystem::path Discovery::UDEV_DATA_PATH{"/run/udev/data"};
+const std::filesystem::path Discovery::SYS_DEV_BLOCK_PATH{"/sys/dev/block"};
+
+Discovery::Discovery() : uevent_fd(-1), mountinfo_fd(-1), mountinfo_changed_fd(-1), settle_at() {
+}
+
+Discovery::Discovery(std::vector<Rule> rules)
+  : rules(std::move(rules))
+  , uevent_fd(socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT))
+  , mountinfo_fd(open(MOUNT_INFO_PATH.c_str(), O_RDONLY | O_CLOEXEC))
+  , mountinfo_changed_fd(open(MOUNT_INFO_PATH.c_str(), O_RDONLY | O_CLOEXEC))
+  , settle_at() {
+  if (mountinfo_fd == -1 || mountinfo_changed_fd == -1) {
+    DS_LOGERR << "failed to watch " << MOUNT_INFO_PATH << ": " << strerror_safe(errno) << '\n';
+    close_fds();
+    return;
+  }
+  sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  // kernel events, udev may not be running
+  addr.nl_groups = 1;
+  if (uevent_fd == -1 || bind(uevent_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1) {
+    // mount changes still work
+    DS_LOGERR << "failed to listen to uevents: " << strerror_safe(errno) << '\n';
+    if (uevent_fd != -1) {
+      close(uevent_fd);
+      uevent_fd = -1;
+    }
+  }
+}
+
+Discovery::Discovery(Discovery&& other) noexcept
+  : rules(std::move(other.rules))
+  , uevent_fd(std::exchange(other.uevent_fd, -1))
+  , mountinfo_fd(std::exchange(other.mountinfo_fd, -1))
+  , mountinfo_changed_fd(std::exchange(other.mountinfo_changed_fd, -1))
+  , settle_at(other.settle_at) {
+}
+
+Discovery& Discovery::operator=(Discovery&& other) noexcept {
+  if (this != &other) {
+    close_fds();
+    rules = std::move(other.rules);
+    uevent_fd = std::exchange(other.uevent_fd, -1);
+    mountinfo_fd = std::exchange(other.mountinfo_fd, -1);
+    mountinfo_changed_fd = std::exchange(other.mountinfo_changed_fd, -1);
+    settle_at = other.settle_at;
+  }
+  return *this;
+}
+
+Discovery::~Discovery() {
+  close_fds();
+}
+
+[[nodiscard]] bool Discovery::good() const {
+  return mountinfo_fd != -1;
+}
+
+[[nodiscard]] int Discovery::mounts_fd() const {
+  return mountinfo_fd;
+}
+
+[[nodiscard]] int Discovery::uevents_fd() const {
+  return uevent_fd;
+}
+
+[[nodiscard]] std::chrono::steady_clock::time_point Discovery::next_deadline() const {
+  return settle_at == std::chrono::steady_clock::time_point{} ? std::chrono::steady_clock::time_point::max()
+                                                              : settle_at;
+}
+
+bool Discovery::changed(const bool& uevents) {
+  if (!good()) {
+    return false;
+  }
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  pollfd mountinfo_pollfd{.fd = mountinfo_changed_fd, .events = POLLPRI, .revents = 0};
+  bool changed = poll(&mountinfo_pollfd, 1, 0) == 1 && (mountinfo_pollfd.revents & POLLPRI) != 0;
+  if (uevents && uevent_fd != -1 && read_uevents()) {
+    settle_at = now + SETTLE_TIME;
+    changed = true;
+  }
+  if (settle_at != std::chrono::steady_clock::time_point{} && now >= settle_at) {
+    settle_at = {};
+    changed = true;
+  }
+  return changed;
+}
+
+[[nodiscard]] std::vector<std::filesystem::path> Discovery::scan() const {
+  std::vector<std::filesystem::path> mount_points;
+  std::unordered_set<dev_t> seen;
+  for (BlockInfo::Mount& mount : BlockInfo::mounts()) {
+    // the first mount of each filesystem, whatever its root: a btrfs subvolume is the only one of its device
+    if (!seen.emplace(mount.device).second) {
+      continue;
+    }
+    if (matches(mount.device)) {
+      mount_points.emplace_back(std::move(mount.mount_point));
+    }
+  }
+  DS_PROBE1(discovery_scan, mount_points.size());
+  return mount_points;
+}
+
+bool Discovery::read_uevents() {
+  char buf[8192];
+  bool block{false};
+  ssize_t len{0};
+  while ((len = recv(uevent_fd, buf, sizeof(buf), 0)) > 0) {
+    // `add@/devices/...\0ACTION=add\0DEVPATH=/devices/...\0SUBSYSTEM=block\0...`
+    for (std::string_view fields{buf, static_cast<std::size_t>(len)}; !fields.empty();) {
+      const std::size_t end = std::min(fields.find('\0'), fields.size());
+      if (fields.substr(0, end) == "SUBSYSTEM=block") {
+        block = true;
+      }
+      fields.remove_prefix(std::min(end + 1, fields.size()));
+    }
+  }
+  if (len == -1 && errno == ENOBUFS) {
+    // some were dropped, any of them may have been a disk
+    return true;
+  }
+  return block;
+}
+
+void Discovery::close_fds() {
+  if (uevent_fd != -1) {
+    close(uevent_fd);
+    uevent_fd = -1;
+  }
+  if (mountinfo_fd != -1) {
+    close(mountinfo_fd);
+    mountinfo_fd = -1;
+  }
+  if (mountinfo_changed_fd != -1) {
+    close(mountinfo_changed_fd);
+    mountinfo_changed_fd = -1;
+  }
+}
+
+[[nodiscard]] bool Discovery::matches(const dev_t& device) const {
+  std::error_code ec;
+  if (!std::filesystem::exists(
+        SYS_DEV_BLOCK_PATH / (std::to_string(major(device)) + ':' + std::to_string(minor(device))), ec)) {
+    // nfs, tmpfs, ...
+    return false;
+  }
+  const std::unordered_map<std::string, std::string> device_properties = properties(device);
+  return std::any_of(rules.begin(), rules.end(), [&device_properties](const Rule& rule) {
+    return (rule.serial.empty() || rule.serial == property(device_properties, "ID_SERIAL_SHORT")
+            || rule.serial == property(device_properties, "ID_SERIAL"))
+           && (rule.wwn.empty() || normalize_wwn(rule.wwn) == normalize_wwn(property(device_properties, "ID_WWN")))
+           && (rule.model.empty() || normalize_model(rule.model) == property(device_properties, "ID_MODEL"))
+           && (rule.label.empty() || rule.label == property(device_properties, "ID_FS_LABEL"));
+  });
+}
+
+std::unordered_map<std::string, std::string> Discovery::properties(const dev_t& device) {
+  std::unordered_map<std::string, std::string> result;
+  const std::string dev_name = std::to_string(major(device)) + ':' + std::to_string(minor(device));
+  // a partition inherits the properties of its disk
+  std::string udev_data;
+  File::read_file(UDEV_DATA_PATH / ('b' + dev_name), udev_data);
+  for (std::string_view rest{udev_data}; !rest.empty();) {
+    const std::size_t end = std::min(rest.find('\n'), rest.size());
+    const std::string_view line = rest.substr(0, end);
+    rest.remove_prefix(std::min(end + 1, rest.size()));
+    const std::size_t equal = line.find('=');
+    if (line.rfind("E:", 0) == 0 && equal != std::string_view::npos) {
+      result.emplace(line.substr(2, equal - 2), line.substr(equal + 1));
+    }
+  }
+  // what udev did not tell (not running, or it skipped the device), the label is only known to udev
+  std::error_code ec;
+  std::filesystem::path disk = std::filesystem::canonical(SYS_DEV_BLOCK_PATH / dev_name, ec);
+  if (ec) {
+    return result;
+  }
+  if (std::filesystem::exists(disk / "partition")) {
+    disk = disk.parent_path();
+  }
+  if (result.count("ID_MODEL") == 0) {
+    result.emplace("ID_MODEL", normalize_model(read_attribute(disk / "device" / "model")));
+  }
+  if (result.count("ID_SERIAL_SHORT") == 0) {
+    result.emplace("ID_SERIAL_SHORT", read_attribute(disk / "device" / "serial"));
+  }
+  if (result.count("ID_WWN") == 0) {
+    std::string wwid = read_attribute(disk / "wwid");
+    result.emplace("ID_WWN", wwid.empty() ? read_attribute(disk / "device" / "wwid") : wwid);
+  }
+  return result;
+}
+
+} // namespace ds
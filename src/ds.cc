@@ -1,42 +1,85 @@
 #include "do_not_sleep/ds.h"
 
 #include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
-#include <fstream>
 #include <functional>
 #include <initializer_list>
-#include <iostream>
 #include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
 #include <set>
+#include <system_error>
 #include <thread>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "fcntl.h"
+#include "poll.h"
+#include "sys/epoll.h"
+#include "sys/eventfd.h"
+#include "sys/types.h"
+#include "unistd.h"
+
+#include "do_not_sleep/access_watcher.h"
 #include "do_not_sleep/block_info.h"
+#include "do_not_sleep/cgroup_io.h"
 #include "do_not_sleep/config.h"
+#include "do_not_sleep/device_class.h"
+#include "do_not_sleep/device_worker.h"
+#include "do_not_sleep/discovery.h"
+#include "do_not_sleep/file.h"
 #include "do_not_sleep/hms.h"
+#include "do_not_sleep/io_estimator.h"
+#include "do_not_sleep/local_connections.h"
+#include "do_not_sleep/priority.h"
+#include "do_not_sleep/probe.h"
+#include "do_not_sleep/proc_watcher.h"
+#include "do_not_sleep/schedule.h"
+#include "do_not_sleep/service_probe.h"
+#include "do_not_sleep/state_file.h"
+#include "do_not_sleep/status_page.h"
+#include "do_not_sleep/status_writer.h"
+#include "do_not_sleep/timeline.h"
 #include "do_not_sleep/util.h"
 
 namespace ds {
 
-struct MonitorCtx {
-  BlockInfo block_info;
-  std::chrono::seconds awake_time_remaining;
-  std::chrono::seconds time_until_next_ticktock;
-};
+namespace {
+
+// I/O priority of the calling (worker) thread
+void use_io_priority(const IOPriority& priority) {
+  thread_local IOPriority current{IOPriority::UNSET};
+  if (priority != current && (priority == IOPriority::UNSET || set_io_priority(priority))) {
+    current = priority;
+  }
+}
+
+} // namespace
 
-DoNotSleep::DoNotSleep()
-  : config{Config::from_json()}
+DoNotSleep::DoNotSleep() : DoNotSleep(Config::from_json()) {
+}
+
+DoNotSleep::DoNotSleep(Config config)
+  : config{std::move(config)}
   , rand_engine(current_time_ms() & std::numeric_limits<std::uint8_t>::max()) {
 }
 
 DoNotSleep::DoNotSleep(std::initializer_list<std::filesystem::path> dirs,
                        std::chrono::seconds interval,
                        std::pair<HMS, HMS> time_range)
-  : config{.dirs = dirs, .interval = interval, .policy = Config::Policy::TIME_RANGE, .time_range = time_range}
+  : config{.dirs = dirs,
+           .interval = interval,
+           .policy = Config::Policy::TIME_RANGE,
+           .time_range = time_range,
+           .schedule = Schedule{{Schedule::Rule{
+                                  .days = Schedule::EVERYDAY, .start = time_range.first, .end = time_range.second}},
+                                {}}}
   , rand_engine(current_time_ms() & std::numeric_limits<std::uint8_t>::max()) {
 }
 
@@ -53,147 +96,1141 @@ DoNotSleep::DoNotSleep(std::initializer_list<std::filesystem::path> dirs,
 }
 
 void DoNotSleep::start() {
+  if (!open()) {
+    return;
+  }
+  while (process_events()) {
+    const Timeline::Span span{*timeline, "wait"};
+    const std::chrono::steady_clock::time_point until = next_deadline();
+    int timeout{-1};
+    if (until != std::chrono::steady_clock::time_point::max()) {
+      timeout = static_cast<int>(std::clamp<std::chrono::milliseconds::rep>(
+        std::chrono::ceil<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()).count(), 0, INT_MAX));
+    }
+    pollfd events_pollfd{.fd = fd(), .events = POLLIN, .revents = 0};
+    if (poll(&events_pollfd, 1, timeout) == -1 && errno != EINTR) {
+      DS_LOGERR << "failed to wait for events: " << strerror_safe(errno) << ", stopped.\n";
+      return;
+    }
+  }
+}
+
+bool DoNotSleep::open() {
+  // before the targets, their workers tell it
+  keepalives_done = std::make_shared<File>(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  if (!keepalives_done->good()) {
+    DS_LOGERR << "failed to create an eventfd: " << strerror_safe(keepalives_done->error()) << ", stopped.\n";
+    return false;
+  }
+  if (!prepare()) {
+    return false;
+  }
+  events = File{epoll_create1(EPOLL_CLOEXEC)};
+  if (!events.good()) {
+    DS_LOGERR << "failed to create an epoll instance: " << strerror_safe(events.error()) << ", stopped.\n";
+    return false;
+  }
+  if (!open_policy()) {
+    return false;
+  }
+  int policy_fd{-1};
+  if (access_watcher.has_value()) {
+    policy_fd = access_watcher->fd();
+  } else if (proc_watcher.has_value()) {
+    policy_fd = proc_watcher->fd();
+  } else if (service_probe.good()) {
+    policy_fd = service_probe.fd();
+  }
+  for (const auto& [source, ready] :
+       {std::make_pair(policy_fd, EPOLLIN),
+        std::make_pair(keepalives_done->fd(), EPOLLIN),
+        std::make_pair(discovery.good() ? discovery.mounts_fd() : -1, EPOLLPRI),
+        std::make_pair(discovery.good() ? discovery.uevents_fd() : -1, EPOLLIN)}) {
+    epoll_event event{.events = static_cast<std::uint32_t>(ready), .data{.fd = source}};
+    if (source != -1 && epoll_ctl(events.fd(), EPOLL_CTL_ADD, source, &event) == -1) {
+      DS_LOGERR << "failed to watch events: " << strerror_safe(errno) << ", stopped.\n";
+      return false;
+    }
+  }
+  // first look right away
+  deadline = std::chrono::steady_clock::time_point{};
+  opened = true;
+  return true;
+}
+
+[[nodiscard]] int DoNotSleep::fd() const {
+  return events.fd();
+}
+
+[[nodiscard]] std::chrono::steady_clock::time_point DoNotSleep::next_deadline() const {
+  std::chrono::steady_clock::time_point next = next_look();
+  for (const Target& target : targets) {
+    if (target.keepalive_deadline != std::chrono::steady_clock::time_point{}) {
+      next = std::min(next, target.keepalive_deadline);
+    }
+  }
+  return next;
+}
+
+[[nodiscard]] std::chrono::steady_clock::time_point DoNotSleep::next_look() const {
+  std::chrono::steady_clock::time_point next = deadline;
+  if (access_watcher.has_value()) {
+    next = std::min(next, access_watcher->next_deadline());
+  }
+  if (discovery.good()) {
+    next = std::min(next, discovery.next_deadline());
+  }
+  return next;
+}
+
+bool DoNotSleep::process_events() {
+  if (!opened) {
+    return false;
+  }
+  // only tells whether a source is ready, each is read without blocking
+  epoll_event ready[4];
+  const int ready_count = epoll_wait(events.fd(), ready, 4, 0);
+  bool due = steady_now() >= next_look();
+  bool uevents{false};
+  for (int i = 0; i < ready_count; i++) {
+    if (keepalives_done != nullptr && ready[i].data.fd == keepalives_done->fd()) {
+      // what returned is found by `finish_keepalives`
+      std::uint64_t count{0};
+      if (read(keepalives_done->fd(), &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        DS_LOGERR << "failed to read returned keepalives: " << strerror_safe(errno) << '\n';
+      }
+    } else if (discovery.good() && ready[i].data.fd == discovery.uevents_fd()) {
+      uevents = true;
+    } else if (!discovery.good() || ready[i].data.fd != discovery.mounts_fd()) {
+      due = true;
+    }
+  }
+  // the mount table is only read again when it changed; its wake up may have been consumed by the poll of our caller
+  if (discovery.good() && discovery.changed(uevents)) {
+    refresh_targets();
+    // new targets get their first look right away
+    due = true;
+  }
+  finish_keepalives();
+  if (!due) {
+    return true;
+  }
+  bool running{false};
+  switch (config.policy) {
+    case Config::Policy::TIME_RANGE:
+    case Config::Policy::SCHEDULE: running = step_schedule(); break;
+    case Config::Policy::MONITOR_IO:
+      running = config.trigger == Config::Trigger::FANOTIFY ? step_monitor_access() : step_monitor_io();
+      break;
+    case Config::Policy::SERVICE_AVAILABLE: running = step_service_available(); break;
+    case Config::Policy::CGROUP_IO: running = step_cgroup_io(); break;
+    case Config::Policy::PROCESS_PRESENT: running = step_process_present(); break;
+    case Config::Policy::LOCAL_CONNECTION: running = step_local_connection(); break;
+    default: break;
+  }
+  // those that returned right away, e.g. from the page cache
+  finish_keepalives();
+  opened = running;
+  return running;
+}
+
+bool DoNotSleep::prepare() {
   if (config == Config::UNSET) {
     DS_LOGERR << "something wrong with the config, stopped.\n";
-    return;
+    return false;
+  }
+  apply_priority();
+  if (!one_shot && config.timeline_spans > 0 && !config.timeline_file.empty()) {
+    // before the workers start, so they inherit the blocked SIGUSR1
+    timeline = std::make_shared<Timeline>(config.timeline_spans);
+    timeline_dumper = std::make_unique<TimelineDumper>(timeline, config.timeline_file);
+  }
+  if (!config.state_file.empty()) {
+    state_file = StateFile{config.state_file};
+    if (state_file.in_use()) {
+      DS_LOGERR << "state file " << config.state_file << " is used by another instance, stopped.\n";
+      return false;
+    }
+  }
+  if (!config.history_dir.empty()) {
+    history = History{config.history_dir, config.history_retention};
+    if (history.in_use()) {
+      DS_LOGERR << "history " << config.history_dir << " is used by another instance, stopped.\n";
+      return false;
+    }
+  }
+  if (!one_shot && !config.status_page.empty()) {
+    // a one-shot run would take the page over from the daemon
+    status_writer = StatusWriter{config.status_page};
+    if (status_writer.in_use()) {
+      DS_LOGERR << "status page " << config.status_page << " is used by another instance, stopped.\n";
+      return false;
+    }
+  }
+  if (!config.discover.empty()) {
+    discovery = Discovery{config.discover};
   }
   sanitize_config();
-  if (config.dirs.empty()) {
+  if (targets.empty() && !discovery.good()) {
     DS_LOGERR << "no dirs to proceed, stopped.\n";
-    return;
+    return false;
   }
-  switch (config.policy) {
-    case Config::Policy::TIME_RANGE: start_time_range(); break;
-    case Config::Policy::MONITOR_IO: start_monitor_io(); break;
-    case Config::Policy::SERVICE_AVAILABLE: start_service_available(); break;
-    default: DS_LOGERR << "invalid policy, stopped.\n"; return;
+  status_writer.set_device_count(targets.size());
+  for (const Target& target : targets) {
+    save(target);
   }
+  return true;
 }
 
-void DoNotSleep::start_time_range() {
-  while (true) {
-    if (!HMS::now().between(config.time_range)) {
-      DS_LOG << "zzz\n" << std::flush;
-      std::this_thread::sleep_for(config.interval);
-      continue;
+/* NOLINTNEXTLINE(readability-function-cognitive-complexity) */
+bool DoNotSleep::once() {
+  one_shot = true;
+  if (!prepare()) {
+    return false;
+  }
+  const std::int64_t now_ms = current_time_ms();
+  // targets the daemon would be keeping awake right now
+  std::vector<std::size_t> due;
+  const auto all_due = [this, &now_ms, &due]() {
+    for (std::size_t i = 0; i < targets.size(); i++) {
+      targets[i].state.awake_until_ms
+        = now_ms + std::chrono::duration_cast<std::chrono::milliseconds>(targets[i].interval).count();
+      due.emplace_back(i);
+    }
+  };
+  // monitor IO and cgroup IO compare counters with the ones saved by the previous run
+  std::vector<BlockInfo> blocks;
+  std::vector<IOEstimator> estimators;
+  std::vector<std::size_t> counters;
+  switch (config.policy) {
+    case Config::Policy::TIME_RANGE:
+    case Config::Policy::SCHEDULE:
+      if (const std::uint32_t now = Schedule::now(); config.schedule.contains(now)) {
+        DS_PROBE2(schedule_check, now, true);
+        all_due();
+      } else {
+        DS_PROBE2(schedule_check, now, false);
+      }
+      break;
+    case Config::Policy::SERVICE_AVAILABLE:
+      if (service_available(config.service)) {
+        all_due();
+      }
+      break;
+    case Config::Policy::LOCAL_CONNECTION: {
+      connections.emplace(config.ports);
+      std::size_t count{0};
+      if (!connections->good() || !connections->count(count)) {
+        DS_LOGERR << "failed to list local connections, stopped.\n";
+        return false;
+      }
+      if (count > 0) {
+        all_due();
+      }
+      break;
     }
-    for (const std::filesystem::path& dir : config.dirs) {
-      tick_tock(dir);
+    case Config::Policy::PROCESS_PRESENT:
+      // a scan of /proc, no need for the proc connector
+      if (ProcWatcher::count_running(config.processes) > 0) {
+        all_due();
+      }
+      break;
+    case Config::Policy::MONITOR_IO:
+    case Config::Policy::CGROUP_IO: {
+      if (config.policy == Config::Policy::CGROUP_IO) {
+        cgroup_io.emplace(config.cgroups);
+        for (const Target& target : targets) {
+          counters.emplace_back(cgroup_io->track(BlockInfo::disk_device(target.dir)));
+        }
+        cgroup_io->scan();
+      }
+      const BlockInfo::MountList mounts = cgroup_io.has_value() ? BlockInfo::MountList{} : BlockInfo::mount_list();
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      for (std::size_t i = 0; i < targets.size(); i++) {
+        Target& target = targets[i];
+        bool io_detected{false};
+        if (cgroup_io.has_value()) {
+          const std::pair<std::uint64_t, std::uint64_t> io{cgroup_io->counters(counters[i]).rios,
+                                                           cgroup_io->counters(counters[i]).wios};
+          // a rise is I/O, a drop (a unit stopped) is not, like the daemon
+          io_detected = (io.first > target.state.last_reads || io.second > target.state.last_writes)
+                        && (target.state.last_reads != 0 || target.state.last_writes != 0);
+          target.state.last_reads = io.first;
+          target.state.last_writes = io.second;
+        } else {
+          // fanotify needs a resident process, accesses are told by I/O counters too; the estimator the previous run
+          // saved takes the I/O since then over the time in between, journal commits and such alone do not count
+          BlockInfo& block = blocks.emplace_back(BlockInfo::from_mount_path(target.dir, mounts));
+          IOEstimator& estimator = estimators.emplace_back(config.activity);
+          estimator.restore(target.state.estimator, now, now_ms);
+          BlockInfo::Counters sample{};
+          if (block.sample(sample)) {
+            io_detected = estimator.update(sample, now);
+            target.state.last_reads = sample.read_ios;
+            target.state.last_writes = sample.write_ios;
+          }
+          target.state.estimator = estimator.save(now, now_ms);
+        }
+        if (io_detected) {
+          DS_LOG_UNLESS(quiet) << target.dir << ": I/O detected.\n";
+          DS_PROBE3(io_detected, target.dir.c_str(), target.state.last_reads, target.state.last_writes);
+          target.state.awake_until_ms
+            = now_ms + std::chrono::duration_cast<std::chrono::milliseconds>(config.keep_awake).count();
+          target.state.last_activity_ms = now_ms;
+        }
+        // keeps ticking until one interval after the last activity expired, like the daemon
+        if (target.state.awake_until_ms
+            > now_ms - std::chrono::duration_cast<std::chrono::milliseconds>(target.interval).count()) {
+          due.emplace_back(i);
+        }
+        save(target);
+      }
+      break;
     }
-    std::this_thread::sleep_for(config.interval);
+    default: DS_LOGERR << "invalid policy, stopped.\n"; return false;
+  }
+  if (due.empty()) {
+    DS_LOG_UNLESS(quiet) << "zzz\n";
+    return true;
   }
+  keep_awake_all(due, false);
+  const std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+  const std::int64_t done_ms = current_time_ms();
+  for (std::size_t i = 0; i < blocks.size(); i++) {
+    // ignore I/O from our keepalive
+    BlockInfo::Counters sample{};
+    if (blocks[i].sample(sample)) {
+      estimators[i].rebase(sample, done);
+      targets[i].state.last_reads = sample.read_ios;
+      targets[i].state.last_writes = sample.write_ios;
+      targets[i].state.estimator = estimators[i].save(done, done_ms);
+    }
+    save(targets[i]);
+  }
+  return std::all_of(due.begin(), due.end(), [this](const std::size_t& i) {
+    return targets[i].worker.stats().done > 0;
+  });
 }
 
 /* NOLINTNEXTLINE(readability-function-cognitive-complexity) */
-void DoNotSleep::start_monitor_io() {
-  // TODO(rayalto): try to make these shit work
-  std::unordered_map<std::filesystem::path, MonitorCtx> blocks;
-  for (const std::filesystem::path& block : config.dirs) {
-    blocks.emplace(block,
-                   MonitorCtx{.block_info{BlockInfo::from_mount_path(block)},
-                              .awake_time_remaining{std::chrono::seconds::zero()},
-                              .time_until_next_ticktock{std::chrono::seconds::zero()}});
-  }
-  while (true) {
-    for (std::pair<const std::filesystem::path, ds::MonitorCtx>& block : blocks) {
-      bool io_detected = (block.second.block_info.io_taken() != BlockInfo::NO_IO);
-
-      if (block.second.awake_time_remaining > std::chrono::seconds::zero()) {
-        // decrease the remaining time to keep awake by scan frequency
-        block.second.awake_time_remaining -= config.scan_frequency;
-        if (block.second.awake_time_remaining < std::chrono::seconds::zero()) {
-          // make sure it is not negative
-          block.second.awake_time_remaining = std::chrono::seconds::zero();
+bool DoNotSleep::open_policy() {
+  const std::int64_t start_ms = wall_ms();
+  switch (config.policy) {
+    case Config::Policy::TIME_RANGE:
+    case Config::Policy::SCHEDULE: return true;
+    case Config::Policy::MONITOR_IO:
+      if (config.trigger == Config::Trigger::FANOTIFY) {
+        access_watcher.emplace(config.scan_frequency);
+        for (std::size_t i = 0; i < targets.size(); i++) {
+          if (!access_watcher->watch(targets[i].dir)) {
+            DS_LOGERR << "could not watch " << targets[i].dir << ", ignored.\n";
+            continue;
+          }
+          // resume keeping awake if it was before a restart
+          access_blocks.emplace_back(AccessCtx{.target = i, .ticking = targets[i].state.awake_until_ms > start_ms});
         }
+        if (access_blocks.empty()) {
+          DS_LOGERR << "nothing to watch, stopped.\n";
+          return false;
+        }
+        return true;
       }
-
-      if (block.second.time_until_next_ticktock > std::chrono::seconds::zero()) {
-        // decrease the time untile next ticktock by scan frequency
-        block.second.time_until_next_ticktock -= config.scan_frequency;
-        if (block.second.time_until_next_ticktock <= std::chrono::seconds::zero()) {
-          // time to ticktock, flush I/O statistics at first
-          io_detected = (io_detected || (block.second.block_info.io_taken() != BlockInfo::NO_IO));
-          tick_tock(block.first);
-          // ignore I/O from our tichtock
-          block.second.block_info.io_taken();
-          if (block.second.awake_time_remaining > std::chrono::seconds::zero()) {
-            // still need to keep awake, prepare for the next ticktock
-            block.second.time_until_next_ticktock = config.interval;
-          } else {
-            // no need to keep awake anymore
-            block.second.time_until_next_ticktock = std::chrono::seconds::zero();
+      {
+        const BlockInfo::MountList mounts = BlockInfo::mount_list();
+        for (std::size_t i = 0; i < targets.size(); i++) {
+          const StateFile::DeviceState& state = targets[i].state;
+          MonitorCtx& block
+            = monitor_blocks.emplace_back(MonitorCtx{.target = i,
+                                                     .block_info{BlockInfo::from_mount_path(targets[i].dir, mounts)},
+                                                     .io{state.last_reads, state.last_writes},
+                                                     .estimator = IOEstimator{config.activity},
+                                                     .rebase = false,
+                                                     .awake_time_remaining{std::chrono::seconds::zero()},
+                                                     .time_until_next_ticktock{std::chrono::seconds::zero()}});
+          if (state.last_reads != 0 || state.last_writes != 0) {
+            // I/O while we were not running counts
+            block.block_info->set_last_io_statistics({state.last_reads, state.last_writes});
           }
+          // the noise it learned too
+          block.estimator.restore(state.estimator, steady_now(), start_ms);
+          if (state.awake_until_ms > start_ms) {
+            block.awake_time_remaining
+              = std::chrono::ceil<std::chrono::seconds>(std::chrono::milliseconds{state.awake_until_ms - start_ms});
+            block.time_until_next_ticktock = std::max(
+              std::chrono::ceil<std::chrono::seconds>(
+                std::chrono::milliseconds{next_keepalive_ms(targets[i], start_ms) - start_ms}),
+              config.scan_frequency);
+          }
+        }
+      }
+      return true;
+    case Config::Policy::SERVICE_AVAILABLE:
+      service_probe = ServiceProbe{config.service};
+      if (!service_probe.good()) {
+        DS_LOGERR << "cannot probe " << config.service << ", stopped.\n";
+        return false;
+      }
+      return true;
+    case Config::Policy::CGROUP_IO:
+      cgroup_io.emplace(config.cgroups);
+      for (Target& target : targets) {
+        const dev_t disk = BlockInfo::disk_device(target.dir);
+        if (disk == 0) {
+          DS_LOGERR << "could not find the disk of " << target.dir << ", its I/O will not be tracked.\n";
         }
+        cgroup_blocks.emplace_back(cgroup_io->track(disk), next_keepalive_ms(target, start_ms));
+      }
+      return true;
+    case Config::Policy::PROCESS_PRESENT:
+      proc_watcher.emplace(config.processes);
+      if (!proc_watcher->good()) {
+        DS_LOGERR << "process events are unavailable, stopped.\n";
+        return false;
       }
+      return true;
+    case Config::Policy::LOCAL_CONNECTION:
+      connections.emplace(config.ports);
+      if (!connections->good()) {
+        DS_LOGERR << "socket diagnostics are unavailable, stopped.\n";
+        return false;
+      }
+      return true;
+    default: DS_LOGERR << "invalid policy, stopped.\n"; return false;
+  }
+}
 
-      if (!io_detected) {
-        continue;
+bool DoNotSleep::step_schedule() {
+  const std::uint32_t now = Schedule::at(wall_ms());
+  DS_PROBE2(schedule_check, now, config.schedule.contains(now));
+  if (!config.schedule.contains(now)) {
+    const std::uint32_t until_open = config.schedule.next_transition(now);
+    if (until_open == Schedule::NEVER) {
+      DS_LOGERR << "the schedule never opens, stopped.\n";
+      return false;
+    }
+    DS_LOG_UNLESS(quiet) << "zzz for " << until_open << "s\n";
+    // look again at least hourly in case the local time jumps (DST, clock adjustments)
+    wait(std::min(std::chrono::seconds{until_open}, MAX_SCHEDULE_SLEEP));
+    return true;
+  }
+  const std::int64_t now_ms = wall_ms();
+  const std::int64_t next_ms = keep_awake_due(now_ms);
+  wait(std::chrono::milliseconds{next_ms - now_ms});
+  return true;
+}
+
+/* NOLINTNEXTLINE(readability-function-cognitive-complexity) */
+bool DoNotSleep::step_monitor_io() {
+  for (MonitorCtx& block : monitor_blocks) {
+    Target& target = targets[block.target];
+    bool io_detected{false};
+    BlockInfo::Counters counters{};
+    // a keepalive of ours still under way would be taken for activity
+    if (!block.rebase) {
+      const Timeline::Span span{*timeline, "sample_diskstats", target.dir.native()};
+      if (sample_disk(block, counters)) {
+        block.io = {counters.read_ios, counters.write_ios};
+        // journal commits, SMART polls and such alone do not count
+        io_detected = block.estimator.update(counters, steady_now());
       }
+    }
+
+    if (block.awake_time_remaining > std::chrono::seconds::zero()) {
+      // decrease the remaining time to keep awake by scan frequency
+      block.awake_time_remaining -= config.scan_frequency;
+      if (block.awake_time_remaining < std::chrono::seconds::zero()) {
+        // make sure it is not negative
+        block.awake_time_remaining = std::chrono::seconds::zero();
+      }
+    }
 
+    if (block.time_until_next_ticktock > std::chrono::seconds::zero()) {
+      // decrease the time untile next ticktock by scan frequency
+      block.time_until_next_ticktock -= config.scan_frequency;
+      if (block.time_until_next_ticktock <= std::chrono::seconds::zero()) {
+        keep_awake(target);
+        // ignore I/O from our tichtock, once it returned
+        block.rebase = true;
+        if (block.awake_time_remaining > std::chrono::seconds::zero()) {
+          // still need to keep awake, prepare for the next ticktock
+          block.time_until_next_ticktock = target.interval;
+        } else {
+          // no need to keep awake anymore
+          block.time_until_next_ticktock = std::chrono::seconds::zero();
+        }
+      }
+    }
+
+    if (io_detected) {
       // I/O operation detected
-      DS_LOG << block.first << ": I/O detected.\n";
-      block.second.awake_time_remaining = config.keep_awake;
-      if (block.second.time_until_next_ticktock == std::chrono::seconds::zero()) {
-        block.second.time_until_next_ticktock = config.interval;
+      DS_LOG_UNLESS(quiet) << target.dir << ": I/O detected.\n";
+      history.trigger(target.history_id, History::Trigger::DISK_IO);
+      DS_PROBE3(io_detected, target.dir.c_str(), block.io.first, block.io.second);
+      target.state.last_activity_ms = wall_ms();
+      block.awake_time_remaining = config.keep_awake;
+      if (block.time_until_next_ticktock == std::chrono::seconds::zero()) {
+        block.time_until_next_ticktock = target.interval;
       }
     }
-    std::this_thread::sleep_for(config.scan_frequency);
+
+    const std::int64_t now_ms = wall_ms();
+    target.state.last_reads = block.io.first;
+    target.state.last_writes = block.io.second;
+    target.state.awake_until_ms
+      = now_ms + std::chrono::duration_cast<std::chrono::milliseconds>(block.awake_time_remaining).count();
+    target.state.estimator = block.estimator.save(steady_now(), now_ms);
+    save(target);
   }
+  wait(config.scan_frequency);
+  return true;
 }
 
-void DoNotSleep::start_service_available() {
-  while (true) {
-    if (service_available(config.service)) {
-      for (const std::filesystem::path& dir : config.dirs) {
-        tick_tock(dir);
+bool DoNotSleep::step_monitor_access() {
+  if (!wait_accesses()) {
+    DS_LOGERR << "failed to wait for accesses, stopped.\n";
+    return false;
+  }
+  std::int64_t now_ms = wall_ms();
+  for (const std::size_t& i : triggered) {
+    AccessCtx& block = access_blocks[i];
+    Target& target = targets[block.target];
+    DS_LOG_UNLESS(quiet) << target.dir << ": access detected.\n";
+    history.trigger(target.history_id, History::Trigger::ACCESS);
+    target.state.last_activity_ms = now_ms;
+    target.state.awake_until_ms
+      = now_ms + std::chrono::duration_cast<std::chrono::milliseconds>(config.keep_awake).count();
+    save(target);
+    if (!block.ticking) {
+      // the disk may still be asleep, a page cache hit usually means real reads are coming, wake it up now
+      block.ticking = true;
+      keep_awake(target, true);
+    }
+  }
+
+  // nothing to do until the next ticktock, or forever if all disks are allowed to sleep
+  now_ms = wall_ms();
+  std::chrono::milliseconds timeout{-1};
+  for (AccessCtx& block : access_blocks) {
+    if (!block.ticking) {
+      continue;
+    }
+    Target& target = targets[block.target];
+    if (keepalive_due(target, now_ms)) {
+      keep_awake(target);
+      if (target.state.awake_until_ms <= now_ms) {
+        // no need to keep awake anymore
+        block.ticking = false;
+        continue;
       }
-    } else {
-      DS_LOG << "zzz\n" << std::flush;
     }
-    std::this_thread::sleep_for(config.interval);
+    // still need to keep awake, prepare for the next ticktock
+    const std::int64_t next_ms = std::min(next_keepalive_ms(target, now_ms), next_sample_ms(target));
+    std::chrono::milliseconds until_ticktock{next_ms - now_ms};
+    if (timeout < std::chrono::milliseconds::zero() || until_ticktock < timeout) {
+      timeout = until_ticktock;
+    }
   }
+  wait(timeout);
+  return true;
+}
+
+bool DoNotSleep::step_service_available() {
+  const std::int64_t now_ms = wall_ms();
+  ServiceProbe::Result result{ServiceProbe::Result::PENDING};
+  {
+    const Timeline::Span span{*timeline, "probe_service", config.service};
+    result = service_probe.advance(steady_now());
+  }
+  if (result == ServiceProbe::Result::PENDING) {
+    // looked at again once `fd` tells it can go on
+    deadline = service_probe.next_deadline();
+    return true;
+  }
+  if (result == ServiceProbe::Result::UNAVAILABLE) {
+    DS_LOG_UNLESS(quiet) << "zzz\n";
+    service_up = false;
+    wait(config.interval);
+    return true;
+  }
+  if (!service_up) {
+    for (const Target& target : targets) {
+      history.trigger(target.history_id, History::Trigger::SERVICE);
+    }
+    service_up = true;
+  }
+  const std::int64_t next_ms = keep_awake_due(now_ms);
+  wait(std::chrono::milliseconds{next_ms - now_ms});
+  return true;
+}
+
+bool DoNotSleep::step_cgroup_io() {
+  bool scanned{false};
+  {
+    const Timeline::Span span{*timeline, "scan_cgroups"};
+    scanned = scan_cgroups();
+  }
+  if (!scanned) {
+    DS_LOG_UNLESS(quiet) << "none of the cgroups is running.\n";
+  }
+  const std::int64_t keep_awake_ms = std::chrono::duration_cast<std::chrono::milliseconds>(config.keep_awake).count();
+  const std::int64_t now_ms = wall_ms();
+  for (std::size_t i = 0; i < targets.size(); i++) {
+    Target& target = targets[i];
+    const std::int64_t interval_ms = std::chrono::duration_cast<std::chrono::milliseconds>(target.interval).count();
+    const CgroupIO::Counters& counters = cgroup_counters(cgroup_blocks[i].first);
+    std::int64_t& next_ms = cgroup_blocks[i].second;
+    // the sum over cgroups also drops when a unit stops or cannot be read, only a rise is I/O; a drop is taken in
+    if (counters.rios != target.state.last_reads || counters.wios != target.state.last_writes) {
+      if ((target.state.last_reads != 0 || target.state.last_writes != 0)
+          && (counters.rios > target.state.last_reads || counters.wios > target.state.last_writes)) {
+        DS_LOG_UNLESS(quiet) << target.dir << ": I/O by tracked cgroups detected.\n";
+        history.trigger(target.history_id, History::Trigger::CGROUP_IO);
+        DS_PROBE3(io_detected, target.dir.c_str(), counters.rios, counters.wios);
+        if (target.state.awake_until_ms <= now_ms) {
+          // the disk is awake right now, keep it so from one interval on
+          next_ms = now_ms + interval_ms;
+        }
+        target.state.awake_until_ms = now_ms + keep_awake_ms;
+        target.state.last_activity_ms = now_ms;
+      }
+      target.state.last_reads = counters.rios;
+      target.state.last_writes = counters.wios;
+      save(target);
+    }
+    if (next_ms <= now_ms && target.state.awake_until_ms > now_ms - interval_ms && keepalive_due(target, now_ms)) {
+      // keeps ticking until one interval after the last activity expired, like monitor_io
+      keep_awake(target);
+      next_ms = now_ms + interval_ms;
+    }
+  }
+  wait(config.scan_frequency);
+  return true;
+}
+
+bool DoNotSleep::step_process_present() {
+  if (!proc_watcher->wait(std::chrono::milliseconds::zero())) {
+    DS_LOGERR << "failed to wait for process events, stopped.\n";
+    return false;
+  }
+  const std::int64_t now_ms = wall_ms();
+  // nothing to do while nothing is running
+  std::chrono::milliseconds timeout{-1};
+  if (proc_watcher->running() > 0) {
+    if (!processes_running) {
+      DS_LOG_UNLESS(quiet) << proc_watcher->running() << " watched process(es) running.\n";
+      // a job just started and is about to use the disks, spin them all up at once
+      due_targets.clear();
+      for (std::size_t i = 0; i < targets.size(); i++) {
+        Target& target = targets[i];
+        target.state.awake_until_ms
+          = now_ms + std::chrono::duration_cast<std::chrono::milliseconds>(target.interval).count();
+        target.state.last_activity_ms = now_ms;
+        history.trigger(target.history_id, History::Trigger::PROCESS);
+        due_targets.emplace_back(i);
+      }
+      keep_awake_all(due_targets, true);
+    }
+    timeout = std::chrono::milliseconds{keep_awake_due(now_ms) - now_ms};
+    processes_running = true;
+  } else if (processes_running) {
+    DS_LOG_UNLESS(quiet) << "zzz\n";
+    processes_running = false;
+  }
+  wait(timeout);
+  return true;
+}
+
+bool DoNotSleep::step_local_connection() {
+  const std::int64_t now_ms = wall_ms();
+  std::size_t count{0};
+  bool listed{false};
+  {
+    const Timeline::Span span{*timeline, "list_connections"};
+    listed = connections->count(count);
+  }
+  if (!listed) {
+    DS_LOGERR << "failed to list local connections.\n";
+  }
+  if (count != connection_count) {
+    DS_LOG_UNLESS(quiet) << count << " local connection(s).\n";
+    if (connection_count == 0) {
+      for (const Target& target : targets) {
+        history.trigger(target.history_id, History::Trigger::CONNECTION);
+      }
+    }
+    connection_count = count;
+  }
+  if (count == 0) {
+    DS_LOG_UNLESS(quiet) << "zzz\n";
+    wait(config.interval);
+    return true;
+  }
+  const std::int64_t next_ms = keep_awake_due(now_ms);
+  wait(std::chrono::milliseconds{next_ms - now_ms});
+  return true;
 }
 
 bool DoNotSleep::sanitize_config() {
   // dirs
+  targets.clear();
   for (std::set<std::filesystem::path>::const_iterator i_dir = config.dirs.cbegin(); i_dir != config.dirs.end();) {
-    if (!std::filesystem::is_directory(*i_dir)) {
-      DS_LOGERR << *i_dir << " is not a directory, ignored.\n";
-      i_dir = config.dirs.erase(i_dir);
-      continue;
-    }
-    std::ofstream test_file{*i_dir / DS_FILENAME, std::ios::trunc};
-    if (test_file.bad()) {
-      DS_LOGERR << "could not create " << DS_FILENAME << " in " << *i_dir << ", ignored.\n";
+    if (add_target(*i_dir, false)) {
+      i_dir++;
+    } else {
       i_dir = config.dirs.erase(i_dir);
-      continue;
     }
-    test_file.close();
-    i_dir++;
+  }
+  if (discovery.good()) {
+    refresh_targets();
   }
 
   return true;
 }
 
-void DoNotSleep::tick_tock(const std::filesystem::path& dir) {
-  const std::filesystem::path ds_filedir = dir / DS_FILENAME;
-  bool tick{false};
-  if (std::filesystem::is_empty(ds_filedir)) {
-    tick = true;
+bool DoNotSleep::add_target(const std::filesystem::path& dir, const bool& discovered) {
+  if (!std::filesystem::is_directory(dir)) {
+    DS_LOGERR << dir << " is not a directory, ignored.\n";
+    return false;
+  }
+  const DeviceClass device_class = DeviceClass::of(dir);
+  const Config::ClassPolicy& class_policy = config.device_classes[static_cast<std::size_t>(device_class.kind)];
+  if (class_policy.keepalive == Config::Keepalive::NONE) {
+    DS_LOG_UNLESS(quiet) << dir << ": " << device_class << " device, not kept awake.\n";
+    return false;
+  }
+  Target target{.dir = dir,
+                .slot = StateFile::NO_SLOT,
+                .history_id = 0,
+                .state{},
+                .last_latency{},
+                .device_class = device_class,
+                .keepalive = class_policy.keepalive,
+                .interval = class_policy.interval == std::chrono::seconds::zero() ? config.interval
+                                                                                 : class_policy.interval,
+                .worker{dir.string(), config.breaker},
+                .job = std::make_shared<KeepaliveJob>(),
+                .job_submitted = false,
+                .activity{},
+                .discovered = discovered,
+                .keepalive_deadline{},
+                .keepalive_wake = false};
+  KeepaliveJob& job = *target.job;
+  job.dir = dir;
+  job.ds_file = dir / DS_FILENAME;
+  job.keepalive = target.keepalive;
+  job.keepalive_priority = config.keepalive_priority;
+  job.wake_priority = config.wake_priority;
+  job.timeline = timeline;
+  if (config.skip_active && !one_shot && device_class.kind != DeviceClass::Kind::OTHER) {
+    target.activity.stat_file = BlockInfo::disk_stat_file(dir);
+    if (!target.activity.stat_file.empty()) {
+      target.activity.stat = File{target.activity.stat_file, O_RDONLY};
+    }
   }
-  std::ofstream ds_file{ds_filedir, std::ios::trunc | std::ios::binary};
+  DS_LOG_UNLESS(quiet) << dir << ": " << device_class << " device, "
+                       << (target.keepalive == Config::Keepalive::READ ? "read" : "written") << " every "
+                       << target.interval.count() << "s.\n";
+  if (target.keepalive == Config::Keepalive::READ) {
+    job.device_node = BlockInfo::device_node(dir);
+    if (job.device_node.empty()) {
+      DS_LOGERR << "could not find the device of " << dir << ", ignored.\n";
+      return false;
+    }
+  }
+  if (keepalives_done != nullptr) {
+    target.worker.notify(keepalives_done);
+  }
+  target.slot = state_file.slot(dir);
+  target.history_id = history.device(dir);
+  if (state_file.load(target.slot, target.state) || one_shot) {
+    // checked before a restart, do not wake up the disk just for that; a one-shot run finds out with its keepalive
+    targets.emplace_back(std::move(target));
+    return true;
+  }
+  // a hung disk must not keep the others from starting
+  std::shared_ptr<bool> created = std::make_shared<bool>(false);
+  if (target.worker.run([created, test_filedir = job.ds_file]() {
+        *created = File{test_filedir, O_WRONLY | O_CREAT | O_TRUNC}.good();
+      })
+        != DeviceWorker::Result::DONE
+      || !*created) {
+    DS_LOGERR << "could not create " << DS_FILENAME << " in " << dir << ", ignored.\n";
+    return false;
+  }
+  targets.emplace_back(std::move(target));
+  return true;
+}
+
+void DoNotSleep::refresh_targets() {
+  const Timeline::Span span{*timeline, "discover"};
+  const std::vector<std::filesystem::path> found = discovery.scan();
+  bool changed{false};
+  for (std::vector<Target>::iterator i_target = targets.begin(); i_target != targets.end();) {
+    if (i_target->discovered && std::find(found.begin(), found.end(), i_target->dir) == found.end()) {
+      DS_LOG_UNLESS(quiet) << i_target->dir << " is gone.\n";
+      i_target = targets.erase(i_target);
+      changed = true;
+    } else {
+      i_target++;
+    }
+  }
+  for (const std::filesystem::path& dir : found) {
+    if (std::any_of(targets.begin(), targets.end(), [&dir](const Target& target) { return target.dir == dir; })) {
+      continue;
+    }
+    DS_LOG_UNLESS(quiet) << dir << " discovered.\n";
+    changed = add_target(dir, true) || changed;
+  }
+  if (changed) {
+    // indices in the status page shifted
+    status_writer.set_device_count(targets.size());
+    for (const Target& target : targets) {
+      save(target);
+    }
+  }
+}
+
+void DoNotSleep::wait(const std::chrono::milliseconds& duration) {
+  deadline = duration < std::chrono::milliseconds::zero() ? std::chrono::steady_clock::time_point::max()
+                                                          : steady_now() + duration;
+}
+
+[[nodiscard]] std::int64_t DoNotSleep::wall_ms() const {
+  return current_time_ms();
+}
+
+[[nodiscard]] std::chrono::steady_clock::time_point DoNotSleep::steady_now() const {
+  return std::chrono::steady_clock::now();
+}
+
+bool DoNotSleep::sample_disk(MonitorCtx& block, BlockInfo::Counters& out) {
+  return block.block_info->sample(out);
+}
+
+bool DoNotSleep::wait_accesses() {
+  return access_watcher->wait(std::chrono::milliseconds::zero(), triggered);
+}
+
+bool DoNotSleep::scan_cgroups() {
+  return cgroup_io->scan();
+}
+
+[[nodiscard]] const CgroupIO::Counters& DoNotSleep::cgroup_counters(const std::size_t& index) const {
+  return cgroup_io->counters(index);
+}
+
+void DoNotSleep::tick_tock(const KeepaliveJob& job, const std::uint64_t& random) {
+  DS_PROBE1(tick_tock_begin, job.dir.c_str());
+  // created by the first tick if missing (a one-shot run creates no test file beforehand)
+  File ds_file{job.ds_file, O_RDWR | O_CREAT};
+  char first_byte{0};
+  const bool tick = ds_file.good() && ds_file.pread(&first_byte, 1, 0) == 0;
+  bool written{ds_file.good()};
   if (tick) {
     std::uint8_t rand_byte_buf[DS_RAND_BYTE_COUNT + 1];
-    std::generate_n(rand_byte_buf, DS_RAND_BYTE_COUNT, std::ref(rand_engine));
-    DS_LOG << dir << " tick.\n" << std::flush;
-    ds_file.write(reinterpret_cast<const char*>(rand_byte_buf), DS_RAND_BYTE_COUNT);
+    for (std::size_t i = 0; i < DS_RAND_BYTE_COUNT; i++) {
+      rand_byte_buf[i] = static_cast<std::uint8_t>(random >> (8U * (i % sizeof(random))));
+    }
+    DS_LOG << job.dir << " tick.\n";
+    written = ds_file.pwrite(rand_byte_buf, DS_RAND_BYTE_COUNT, 0);
+  } else if (written) {
+    DS_LOG << job.dir << " tock.\n";
+    written = ds_file.truncate(0);
+  }
+  // to the disk now rather than whenever the page cache is written back
+  if (!written || !ds_file.fdatasync()) {
+    DS_LOGERR << "failed to write " << job.ds_file << ": " << strerror_safe(ds_file.error()) << '\n';
+  }
+  DS_PROBE2(tick_tock_end, job.dir.c_str(), tick);
+}
+
+void DoNotSleep::read_block(const KeepaliveJob& job, const std::uint64_t& random) {
+  const std::filesystem::path& device_node = job.device_node;
+  File device{device_node, O_RDONLY | O_DIRECT};
+  if (!device.good()) {
+    DS_LOGERR << "failed to open " << device_node << ": " << strerror_safe(device.error()) << '\n';
+    return;
+  }
+  const off_t size = lseek(device.fd(), 0, SEEK_END);
+  // a random block so the drive's own cache rarely has it either
+  const off_t block_count = size / static_cast<off_t>(DS_READ_BLOCK_SIZE);
+  const off_t offset
+    = block_count > 0 ? static_cast<off_t>(random % block_count) * static_cast<off_t>(DS_READ_BLOCK_SIZE) : 0;
+  alignas(DS_READ_BLOCK_SIZE) char buf[DS_READ_BLOCK_SIZE];
+  DS_PROBE2(read_block_begin, device_node.c_str(), offset);
+  const ssize_t ret = device.pread(buf, DS_READ_BLOCK_SIZE, offset);
+  DS_PROBE3(read_block_end, device_node.c_str(), offset, ret);
+  if (ret == -1) {
+    DS_LOGERR << "failed to read " << device_node << ": " << strerror_safe(device.error()) << '\n';
   } else {
-    DS_LOG << dir << " tock.\n" << std::flush;
+    DS_LOG << job.dir << " read.\n";
+  }
+}
+
+void DoNotSleep::run_keepalive(const KeepaliveJob& job) {
+  use_io_priority(job.wake.load(std::memory_order_relaxed) ? job.wake_priority : job.keepalive_priority);
+  const std::uint64_t random = job.random.load(std::memory_order_relaxed);
+  if (job.keepalive == Config::Keepalive::READ) {
+    const Timeline::Span span{*job.timeline, "read_block", job.dir.native()};
+    read_block(job, random);
+  } else {
+    const Timeline::Span span{*job.timeline, "tick_tock", job.dir.native()};
+    tick_tock(job, random);
+  }
+}
+
+void DoNotSleep::keep_awake(Target& target, const bool& wake) {
+  if (!start_keep_awake(target, wake)) {
+    save(target);
+    return;
+  }
+  target.keepalive_deadline = steady_now() + config.breaker.timeout;
+  target.keepalive_wake = wake;
+}
+
+bool DoNotSleep::start_keep_awake(Target& target, const bool& wake, const bool& in_place) {
+  std::uint64_t random{0};
+  for (std::size_t i = 0; i < sizeof(random); i++) {
+    random = (random << 8U) | rand_engine();
+  }
+  // relaxed, submitting orders them before the run
+  target.job->random.store(random, std::memory_order_relaxed);
+  target.job->wake.store(wake, std::memory_order_relaxed);
+  // an attempt counts, a stuck disk is not retried right away
+  target.state.last_keepalive_ms = wall_ms();
+  DeviceWorker::Result result{DeviceWorker::Result::DONE};
+  if (in_place) {
+    const KeepaliveJob& job = *target.job;
+    result = target.worker.run_here([&job]() { run_keepalive(job); });
+  } else if (target.job_submitted) {
+    result = target.worker.submit();
+  } else {
+    // runs on the worker of the target, owns everything it uses
+    result = target.worker.submit([job = target.job]() { run_keepalive(*job); });
+    target.job_submitted = result != DeviceWorker::Result::STUCK;
+  }
+  DS_PROBE3(keepalive_start, target.dir.c_str(), wake, static_cast<int>(result));
+  if (result == DeviceWorker::Result::STUCK) {
+    DS_LOGERR << target.dir << ": previous I/O is still stuck, keepalive skipped.\n";
+  } else if (result == DeviceWorker::Result::QUARANTINED) {
+    DS_LOGERR << target.dir << ": quarantined, keepalive skipped.\n";
+  }
+  if (result != DeviceWorker::Result::DONE) {
+    history.keepalive(target.history_id, wake, result, std::chrono::nanoseconds::zero());
+  }
+  return result == DeviceWorker::Result::DONE;
+}
+
+void DoNotSleep::keep_awake_all(const std::vector<std::size_t>& indices, const bool& wake) {
+  const Timeline::Span span{*timeline, wake ? "wake_round" : "keepalive_round"};
+  // all at once, disks spin up in parallel
+  started_targets.clear();
+  for (const std::size_t& i : indices) {
+    // a one-shot run has nothing else to do meanwhile: the last one runs on this thread once the others started, a
+    // single dir starts no thread
+    if (start_keep_awake(targets[i], wake, one_shot && &i == &indices.back())) {
+      started_targets.emplace_back(i);
+    } else {
+      save(targets[i]);
+    }
+  }
+  const std::chrono::steady_clock::time_point deadline = steady_now() + config.breaker.timeout;
+  for (const std::size_t& i : started_targets) {
+    if (one_shot) {
+      finish_keep_awake(targets[i], wake, deadline);
+    } else {
+      targets[i].keepalive_deadline = deadline;
+      targets[i].keepalive_wake = wake;
+    }
+  }
+}
+
+void DoNotSleep::finish_keepalives() {
+  const std::chrono::steady_clock::time_point now = steady_now();
+  for (Target& target : targets) {
+    if (target.keepalive_deadline == std::chrono::steady_clock::time_point{}
+        || (now < target.keepalive_deadline && target.worker.running())) {
+      continue;
+    }
+    const std::chrono::steady_clock::time_point until = std::exchange(target.keepalive_deadline, {});
+    finish_keep_awake(target, target.keepalive_wake, until);
+  }
+  for (MonitorCtx& block : monitor_blocks) {
+    if (!block.rebase || targets[block.target].keepalive_deadline != std::chrono::steady_clock::time_point{}) {
+      continue;
+    }
+    block.rebase = false;
+    BlockInfo::Counters counters{};
+    if (sample_disk(block, counters)) {
+      block.io = {counters.read_ios, counters.write_ios};
+      block.estimator.rebase(counters, now);
+    }
+  }
+}
+
+void DoNotSleep::finish_keep_awake(Target& target,
+                                   const bool& wake,
+                                   const std::chrono::steady_clock::time_point& deadline) {
+  const DeviceWorker::Result result = target.worker.wait(deadline);
+  if (result == DeviceWorker::Result::DONE) {
+    target.last_latency = target.worker.stats().last_duration;
+    (wake ? wake_latency : keepalive_latency).add(target.last_latency);
+  }
+  DS_PROBE4(keepalive_done,
+            target.dir.c_str(),
+            wake,
+            static_cast<int>(result),
+            result == DeviceWorker::Result::DONE ? target.last_latency.count() : -1);
+  history.keepalive(target.history_id,
+                    wake,
+                    result,
+                    result == DeviceWorker::Result::DONE ? target.last_latency : std::chrono::nanoseconds::zero());
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (now - last_latency_log >= LATENCY_LOG_PERIOD) {
+    log_latency();
+    last_latency_log = now;
+  }
+  save(target);
+}
+
+void DoNotSleep::apply_priority() {
+  if (!config.cgroup.empty()) {
+    join_cgroup(config.cgroup);
+  }
+  if (config.cpu_idle) {
+    set_cpu_idle();
+  } else if (config.nice.has_value()) {
+    set_nice(config.nice.value());
+  }
+  last_latency_log = std::chrono::steady_clock::now();
+}
+
+void DoNotSleep::log_latency() {
+  const auto ms = [](const std::chrono::nanoseconds& ns) {
+    return std::chrono::duration<double, std::milli>(ns).count();
+  };
+  const std::uint64_t skipped
+    = std::accumulate(targets.begin(), targets.end(), std::uint64_t{0}, [](const std::uint64_t& sum, const Target& t) {
+        return sum + t.activity.skipped;
+      });
+  DS_LOG_UNLESS(quiet) << "keepalive latency (" << config.keepalive_priority << "): " << keepalive_latency.count
+                       << " done, mean " << ms(keepalive_latency.mean()) << "ms, max " << ms(keepalive_latency.max)
+                       << "ms; wake latency (" << config.wake_priority << "): " << wake_latency.count
+                       << " done, mean " << ms(wake_latency.mean()) << "ms, max " << ms(wake_latency.max)
+                       << "ms; schedule jitter: mean " << ms(schedule_jitter.mean()) << "ms, max "
+                       << ms(schedule_jitter.max) << "ms; " << skipped << " keepalive(s) skipped on busy disks.\n";
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  for (const Target& target : targets) {
+    const DeviceWorker::Stats stats = target.worker.stats();
+    const std::chrono::steady_clock::time_point stuck_since = target.worker.stuck_since();
+    if (stats.timeouts == 0 && stats.rejected == 0) {
+      continue;
+    }
+    LogLine log = DS_LOG;
+    log << target.dir << ": " << stats.timeouts << " timeout(s), " << stats.rejected << " keepalive(s) skipped, "
+        << stats.quarantines << " quarantine(s), longest stuck " << ms(stats.longest_stuck) << "ms";
+    if (stuck_since != std::chrono::steady_clock::time_point{}) {
+      log << ", stuck for " << ms(now - stuck_since) << "ms right now";
+    }
+    log << ".\n";
+  }
+}
+
+std::int64_t DoNotSleep::keep_awake_due(const std::int64_t& now_ms) {
+  std::int64_t next_ms = now_ms + std::chrono::duration_cast<std::chrono::milliseconds>(config.interval).count();
+  due_targets.clear();
+  for (std::size_t i = 0; i < targets.size(); i++) {
+    Target& target = targets[i];
+    if (keepalive_due(target, now_ms)) {
+      const std::int64_t due_ms = next_keepalive_ms(target, now_ms);
+      if (target.state.last_keepalive_ms != 0
+          && now_ms - due_ms < std::chrono::duration_cast<std::chrono::milliseconds>(target.interval).count()) {
+        // how late a keepalive that kept to the schedule ran, timer slack or a loaded machine
+        schedule_jitter.add(std::chrono::milliseconds{now_ms - due_ms});
+      }
+      // kept awake at least until the next one
+      target.state.awake_until_ms
+        = now_ms + std::chrono::duration_cast<std::chrono::milliseconds>(target.interval).count();
+      due_targets.emplace_back(i);
+    }
+  }
+  keep_awake_all(due_targets, false);
+  // the keepalives just started are a little later than `now_ms`, not a clock set back
+  const std::int64_t started_ms = std::max(now_ms, wall_ms());
+  for (const Target& target : targets) {
+    next_ms = std::min({next_ms, next_keepalive_ms(target, started_ms), next_sample_ms(target)});
+  }
+  return next_ms;
+}
+
+bool DoNotSleep::keepalive_due(Target& target, const std::int64_t& now_ms) {
+  DiskActivity& activity = target.activity;
+  if (activity.stat.good()) {
+    const std::pair<std::uint64_t, std::uint64_t> io = BlockInfo::get_io_statistics(activity.stat, activity.stat_file);
+    if (io != activity.io && activity.sampled_ms != 0) {
+      // some time after the previous sample, assume right after it
+      activity.active_ms = activity.sampled_ms;
+      // counters start over if the disk is replaced
+      history.io(target.history_id,
+                 io.first >= activity.io.first ? io.first - activity.io.first : io.first,
+                 io.second >= activity.io.second ? io.second - activity.io.second : io.second);
+    }
+    activity.io = io;
+    activity.sampled_ms = now_ms;
+  }
+  if (next_keepalive_ms(target, now_ms) <= now_ms) {
+    return true;
+  }
+  const std::int64_t interval_ms = std::chrono::duration_cast<std::chrono::milliseconds>(target.interval).count();
+  if (target.state.last_keepalive_ms + interval_ms <= now_ms && now_ms >= activity.skipped_until_ms) {
+    // due by the interval alone, the disk is busy anyway
+    activity.skipped++;
+    activity.skipped_until_ms = now_ms + interval_ms;
+    history.skip(target.history_id);
+    DS_PROBE2(keepalive_skip, target.dir.c_str(), now_ms - activity.active_ms);
+  }
+  return false;
+}
+
+[[nodiscard]] std::int64_t DoNotSleep::next_keepalive_ms(const Target& target, const std::int64_t& now_ms) const {
+  if (target.state.last_keepalive_ms > now_ms) {
+    // the clock went backwards
+    return now_ms;
+  }
+  // I/O of any origin resets the spin down timer of the disk, the last one seen is at least that recent
+  const std::int64_t last_ms
+    = target.activity.active_ms <= now_ms ? std::max(target.state.last_keepalive_ms, target.activity.active_ms)
+                                          : target.state.last_keepalive_ms;
+  return last_ms + std::chrono::duration_cast<std::chrono::milliseconds>(target.interval).count();
+}
+
+[[nodiscard]] std::int64_t DoNotSleep::next_sample_ms(const Target& target) const {
+  if (!target.activity.stat.good()) {
+    return std::numeric_limits<std::int64_t>::max();
+  }
+  // I/O is only known to have happened since the previous sample, twice per interval keeps the disk from being
+  // left idle for more than one interval
+  return target.activity.sampled_ms
+         + std::chrono::duration_cast<std::chrono::milliseconds>(target.interval).count() / 2;
+}
+
+void DoNotSleep::save(const Target& target) {
+  state_file.store(target.slot, target.state);
+  if (!status_writer.good()) {
+    return;
   }
-  ds_file.close();
+  status::DeviceSnapshot snapshot{.dir{},
+                                  .last_keepalive_ms = target.state.last_keepalive_ms,
+                                  .awake_until_ms = target.state.awake_until_ms,
+                                  .last_activity_ms = target.state.last_activity_ms,
+                                  .last_keepalive_latency_ns = static_cast<std::uint64_t>(target.last_latency.count())};
+  target.dir.native().copy(snapshot.dir, status::DIR_LENGTH - 1);
+  status_writer.publish(&target - targets.data(), snapshot);
 }
 
 const std::filesystem::path DoNotSleep::DS_FILENAME{".do_not_sleep"};
 const std::size_t DoNotSleep::DS_RAND_BYTE_COUNT{4};
+const std::chrono::seconds DoNotSleep::MAX_SCHEDULE_SLEEP{3600};
+const std::chrono::seconds DoNotSleep::LATENCY_LOG_PERIOD{3600};
 
 } // namespace ds
@@ -0,0 +1,145 @@
+#include "do_not_sleep/file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <utility>
+
+#include "fcntl.h"
+#include "sys/types.h"
+#include "unistd.h"
+
+namespace ds {
+
+File::File() : file_fd(-1), last_error(0) {
+}
+
+File::File(const std::filesystem::path& path, const int& flags, const mode_t& mode)
+  : file_fd(open(path.c_str(), flags | O_CLOEXEC, mode))
+  , last_error(file_fd == -1 ? errno : 0) {
+}
+
+File::File(const int& fd) : file_fd(fd), last_error(fd == -1 ? errno : 0) {
+}
+
+File::File(File&& other) noexcept
+  : file_fd(std::exchange(other.file_fd, -1))
+  , last_error(other.last_error) {
+}
+
+File& File::operator=(File&& other) noexcept {
+  if (this != &other) {
+    close_fd();
+    file_fd = std::exchange(other.file_fd, -1);
+    last_error = other.last_error;
+  }
+  return *this;
+}
+
+File::~File() {
+  close_fd();
+}
+
+[[nodiscard]] bool File::good() const {
+  return file_fd != -1;
+}
+
+[[nodiscard]] int File::fd() const {
+  return file_fd;
+}
+
+[[nodiscard]] int File::error() const {
+  return last_error;
+}
+
+ssize_t File::pread(void* buf, const std::size_t& size, const off_t& offset) {
+  while (true) {
+    const ssize_t ret = ::pread(file_fd, buf, size, offset);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret == -1) {
+      last_error = errno;
+    }
+    return ret;
+  }
+}
+
+bool File::pwrite(const void* buf, const std::size_t& size, const off_t& offset) {
+  std::size_t done{0};
+  while (done < size) {
+    const ssize_t ret
+      = ::pwrite(file_fd, static_cast<const char*>(buf) + done, size - done, offset + static_cast<off_t>(done));
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      last_error = errno;
+      return false;
+    }
+    done += static_cast<std::size_t>(ret);
+  }
+  return true;
+}
+
+bool File::truncate(const off_t& size) {
+  while (ftruncate(file_fd, size) == -1) {
+    if (errno != EINTR) {
+      last_error = errno;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool File::fdatasync() {
+  while (::fdatasync(file_fd) == -1) {
+    if (errno != EINTR) {
+      last_error = errno;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool File::read_all(std::string& out) {
+  out.resize(std::max<std::size_t>(out.capacity(), 4096));
+  std::size_t done{0};
+  while (true) {
+    if (done == out.size()) {
+      out.resize(out.size() * 2);
+    }
+    const ssize_t ret = pread(out.data() + done, out.size() - done, static_cast<off_t>(done));
+    if (ret == -1) {
+      out.clear();
+      return false;
+    }
+    if (ret == 0) {
+      // procfs may return less than asked before the end, only 0 tells it
+      break;
+    }
+    done += static_cast<std::size_t>(ret);
+  }
+  out.resize(done);
+  return true;
+}
+
+bool File::read_file(const std::filesystem::path& path, std::string& out) {
+  File file{path, O_RDONLY};
+  if (!file.good()) {
+    out.clear();
+    return false;
+  }
+  return file.read_all(out);
+}
+
+void File::close_fd() {
+  if (file_fd != -1) {
+    close(file_fd);
+    file_fd = -1;
+  }
+}
+
+} // namespace ds
@@ -0,0 +1,664 @@
+#include "do_not_sleep/history.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fcntl.h"
+#include "sys/file.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "unistd.h"
+
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+void put_varint(std::uint8_t*& out, std::uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<std::uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<std::uint8_t>(value);
+}
+
+bool get_varint(const std::uint8_t*& in, const std::uint8_t* end, std::uint64_t& value) {
+  value = 0;
+  for (unsigned int shift = 0; shift < 64 && in != end; shift += 7) {
+    const std::uint8_t byte = *in++;
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// small negative deltas (the clock was set back) stay small
+std::uint64_t zigzag(const std::int64_t& value) {
+  return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+std::int64_t unzigzag(const std::uint64_t& value) {
+  return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+std::string_view to_string(const DeviceWorker::Result& result) {
+  switch (result) {
+    case DeviceWorker::Result::DONE:
+      return "done";
+    case DeviceWorker::Result::TIMED_OUT:
+      return "timed_out";
+    case DeviceWorker::Result::STUCK:
+      return "stuck";
+    case DeviceWorker::Result::QUARANTINED:
+      return "quarantined";
+  }
+  return "";
+}
+
+// as a CSV field
+void write_csv_string(std::ostream& out, const std::string_view& str) {
+  out << '"';
+  for (const char& c : str) {
+    out << (c == '"' ? "\"\"" : std::string_view{&c, 1});
+  }
+  out << '"';
+}
+
+} // namespace
+
+const char History::MAGIC[8]{'D', 'S', 'H', 'I', 'S', 'T', '\0', '\0'};
+const std::filesystem::path History::SEGMENT_EXTENSION{".dsh"};
+
+History::History() : retention(0), lock_fd(-1), contended(false), fd(-1), header(nullptr), last_ms(0) {
+}
+
+History::History(std::filesystem::path dir, const std::chrono::hours& retention)
+  : dir(std::move(dir))
+  , retention(retention)
+  , lock_fd(-1)
+  , contended(false)
+  , fd(-1)
+  , header(nullptr)
+  , last_ms(0) {
+  static_assert(std::is_standard_layout_v<Header> && std::is_trivially_copyable_v<Header>);
+  std::error_code ec;
+  std::filesystem::create_directories(this->dir, ec);
+  lock_fd = open(this->dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  // released when the dir is closed, by a crash too
+  if (lock_fd == -1 || flock(lock_fd, LOCK_EX | LOCK_NB) == -1) {
+    contended = lock_fd != -1 && errno == EWOULDBLOCK;
+    if (!contended) {
+      DS_LOGERR << "failed to lock history " << this->dir << ": " << strerror_safe(errno) << '\n';
+    }
+    if (lock_fd != -1) {
+      close(lock_fd);
+      lock_fd = -1;
+    }
+    return;
+  }
+  if (!resume()) {
+    rotate(current_time_ms());
+  }
+}
+
+History::History(History&& other) noexcept
+  : dir(std::move(other.dir))
+  , retention(other.retention)
+  , lock_fd(std::exchange(other.lock_fd, -1))
+  , contended(other.contended)
+  , fd(std::exchange(other.fd, -1))
+  , header(std::exchange(other.header, nullptr))
+  , last_ms(other.last_ms)
+  , devices(std::move(other.devices)) {
+}
+
+History& History::operator=(History&& other) noexcept {
+  if (this != &other) {
+    unmap();
+    if (lock_fd != -1) {
+      close(lock_fd);
+    }
+    dir = std::move(other.dir);
+    retention = other.retention;
+    lock_fd = std::exchange(other.lock_fd, -1);
+    contended = other.contended;
+    fd = std::exchange(other.fd, -1);
+    header = std::exchange(other.header, nullptr);
+    last_ms = other.last_ms;
+    devices = std::move(other.devices);
+  }
+  return *this;
+}
+
+History::~History() {
+  unmap();
+  if (lock_fd != -1) {
+    close(lock_fd);
+  }
+}
+
+[[nodiscard]] bool History::good() const {
+  return header != nullptr;
+}
+
+[[nodiscard]] bool History::in_use() const {
+  return contended;
+}
+
+std::uint32_t History::device(const std::filesystem::path& dir) {
+  const std::string_view dir_str = std::string_view{dir.native()}.substr(0, DIR_LENGTH);
+  const auto found = std::find(devices.begin(), devices.end(), dir_str);
+  if (found != devices.end()) {
+    return static_cast<std::uint32_t>(found - devices.begin());
+  }
+  const auto id = static_cast<std::uint32_t>(devices.size());
+  devices.emplace_back(dir_str);
+  Event event{};
+  event.time_ms = current_time_ms();
+  event.kind = Kind::DEVICE;
+  event.device = id;
+  event.dir = devices.back();
+  append(event);
+  return id;
+}
+
+void History::io(const std::uint32_t& device, const std::uint64_t& reads, const std::uint64_t& writes) {
+  Event event{};
+  event.time_ms = current_time_ms();
+  event.kind = Kind::IO;
+  event.device = device;
+  event.reads = reads;
+  event.writes = writes;
+  append(event);
+}
+
+void History::keepalive(const std::uint32_t& device,
+                        const bool& wake,
+                        const DeviceWorker::Result& result,
+                        const std::chrono::nanoseconds& latency) {
+  Event event{};
+  event.time_ms = current_time_ms();
+  event.kind = Kind::KEEPALIVE;
+  event.device = device;
+  event.wake = wake;
+  event.result = result;
+  event.latency = std::chrono::duration_cast<std::chrono::microseconds>(latency);
+  append(event);
+}
+
+void History::skip(const std::uint32_t& device) {
+  Event event{};
+  event.time_ms = current_time_ms();
+  event.kind = Kind::SKIP;
+  event.device = device;
+  append(event);
+}
+
+void History::trigger(const std::uint32_t& device, const Trigger& trigger) {
+  Event event{};
+  event.time_ms = current_time_ms();
+  event.kind = Kind::TRIGGER;
+  event.device = device;
+  event.trigger = trigger;
+  append(event);
+}
+
+bool History::read(const std::filesystem::path& dir,
+                   const std::int64_t& since_ms,
+                   const std::function<void(const Event&)>& visit) {
+  const std::vector<std::pair<std::int64_t, std::filesystem::path>> found = segments(dir);
+  bool any{false};
+  for (std::size_t i = 0; i < found.size(); i++) {
+    if (i + 1 < found.size() && found[i + 1].first <= since_ms) {
+      // all of it is older
+      continue;
+    }
+    const int segment_fd = open(found[i].second.c_str(), O_RDONLY | O_CLOEXEC);
+    if (segment_fd == -1) {
+      DS_LOGERR << "failed to open history segment " << found[i].second << ": " << strerror_safe(errno) << '\n';
+      continue;
+    }
+    struct stat file_stat {};
+    void* mapped = MAP_FAILED;
+    if (fstat(segment_fd, &file_stat) == 0 && file_stat.st_size >= static_cast<off_t>(sizeof(Header))) {
+      mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, segment_fd, 0);
+    }
+    close(segment_fd);
+    if (mapped == MAP_FAILED) {
+      DS_LOGERR << "failed to map history segment " << found[i].second << ".\n";
+      continue;
+    }
+    const Header& segment = *static_cast<const Header*>(mapped);
+    if (std::memcmp(segment.magic, MAGIC, sizeof(MAGIC)) != 0 || segment.version != VERSION
+        || segment.size != static_cast<std::uint64_t>(file_stat.st_size)) {
+      DS_LOGERR << "history segment " << found[i].second << " is from another version, skipped.\n";
+    } else {
+      any = true;
+      scan(segment, [&visit, &since_ms](const Event& event) {
+        if (event.kind != Kind::DEVICE && event.time_ms >= since_ms) {
+          visit(event);
+        }
+      });
+    }
+    munmap(mapped, file_stat.st_size);
+  }
+  return any;
+}
+
+void History::write_time(std::ostream& out, const std::int64_t& time_ms) {
+  const std::time_t t = static_cast<std::time_t>(time_ms / 1000);
+  out << std::put_time(&localtime_safe(t), "%Y-%m-%d %H:%M:%S");
+}
+
+bool History::summarize(const std::filesystem::path& dir, const std::int64_t& since_ms, std::ostream& out) {
+  struct Summary {
+    std::uint64_t keepalives{0};
+    std::uint64_t wakes{0};
+    std::uint64_t failed{0};
+    std::uint64_t skipped{0};
+    std::uint64_t reads{0};
+    std::uint64_t writes{0};
+    std::chrono::microseconds longest{0};
+    // by what asked for the disk since the keepalive before, "schedule" if nothing did
+    std::map<std::string_view, std::uint64_t> spin_ups;
+    std::optional<Trigger> pending;
+  };
+  std::map<std::string, Summary> summaries;
+  std::int64_t first_ms{0};
+  const bool any = read(dir, since_ms, [&summaries, &first_ms](const Event& event) {
+    if (first_ms == 0) {
+      first_ms = event.time_ms;
+    }
+    Summary& summary = summaries[std::string{event.dir}];
+    switch (event.kind) {
+      case Kind::IO:
+        summary.reads += event.reads;
+        summary.writes += event.writes;
+        break;
+      case Kind::KEEPALIVE:
+        summary.keepalives++;
+        summary.wakes += event.wake ? 1 : 0;
+        if (event.result != DeviceWorker::Result::DONE) {
+          summary.failed++;
+        } else if (event.latency >= SPIN_UP) {
+          summary.spin_ups[summary.pending ? to_string(*summary.pending) : "schedule"]++;
+        }
+        summary.longest = std::max(summary.longest, event.latency);
+        summary.pending.reset();
+        break;
+      case Kind::SKIP:
+        summary.skipped++;
+        break;
+      case Kind::TRIGGER:
+        summary.pending = event.trigger;
+        break;
+      case Kind::DEVICE:
+        break;
+    }
+  });
+  if (!any) {
+    out << "no history in " << dir << ".\n";
+    return false;
+  }
+  out << "since ";
+  write_time(out, std::max(first_ms, since_ms));
+  out << ":\n";
+  for (const auto& [device_dir, summary] : summaries) {
+    std::uint64_t spin_ups{0};
+    for (const auto& [cause, count] : summary.spin_ups) {
+      spin_ups += count;
+    }
+    out << device_dir << ": " << summary.keepalives << " keepalive(s) (" << summary.wakes << " wake(s), "
+        << summary.failed << " failed, longest " << summary.longest.count() / 1000 << "ms), " << spin_ups
+        << " spin-up(s)";
+    const char* separator = " (";
+    for (const auto& [cause, count] : summary.spin_ups) {
+      out << separator << count << ' ' << cause;
+      separator = ", ";
+    }
+    out << (summary.spin_ups.empty() ? "" : ")") << ", " << summary.skipped << " skipped on a busy disk, "
+        << summary.reads << " read(s), " << summary.writes << " write(s).\n";
+  }
+  return true;
+}
+
+bool History::export_csv(const std::filesystem::path& dir, const std::int64_t& since_ms, std::ostream& out) {
+  out << "time_ms,device,event,reads,writes,wake,result,latency_ms,trigger\n";
+  return read(dir, since_ms, [&out](const Event& event) {
+    out << event.time_ms << ',';
+    write_csv_string(out, event.dir);
+    out << ',' << to_string(event.kind) << ',';
+    if (event.kind == Kind::IO) {
+      out << event.reads << ',' << event.writes;
+    } else {
+      out << ',';
+    }
+    out << ',';
+    if (event.kind == Kind::KEEPALIVE) {
+      out << (event.wake ? 1 : 0) << ',' << ds::to_string(event.result) << ',' << event.latency.count() / 1000 << '.'
+          << std::setw(3) << std::setfill('0') << event.latency.count() % 1000 << std::setfill(' ');
+    } else {
+      out << ",,";
+    }
+    out << ',' << (event.kind == Kind::TRIGGER ? to_string(event.trigger) : "") << '\n';
+  });
+}
+
+std::string_view History::to_string(const Kind& kind) {
+  switch (kind) {
+    case Kind::DEVICE:
+      return "device";
+    case Kind::IO:
+      return "io";
+    case Kind::KEEPALIVE:
+      return "keepalive";
+    case Kind::SKIP:
+      return "skip";
+    case Kind::TRIGGER:
+      return "trigger";
+  }
+  return "";
+}
+
+std::string_view History::to_string(const Trigger& trigger) {
+  switch (trigger) {
+    case Trigger::ACCESS:
+      return "access";
+    case Trigger::DISK_IO:
+      return "disk_io";
+    case Trigger::PROCESS:
+      return "process";
+    case Trigger::CGROUP_IO:
+      return "cgroup_io";
+    case Trigger::SERVICE:
+      return "service";
+    case Trigger::CONNECTION:
+      return "connection";
+  }
+  return "";
+}
+
+void History::append(const Event& event) {
+  if (!good()) {
+    return;
+  }
+  std::uint32_t used = __atomic_load_n(&header->used, __ATOMIC_RELAXED);
+  if (used + MAX_RECORD > SEGMENT_SIZE - sizeof(Header)) {
+    if (!rotate(event.time_ms)) {
+      return;
+    }
+    used = __atomic_load_n(&header->used, __ATOMIC_RELAXED);
+  }
+  std::uint8_t record[MAX_RECORD];
+  const std::size_t size = encode(event, last_ms, record);
+  std::memcpy(records() + used, record, size);
+  // readers see the record only once it is complete
+  __atomic_store_n(&header->used, used + static_cast<std::uint32_t>(size), __ATOMIC_RELEASE);
+  last_ms = event.time_ms;
+}
+
+bool History::rotate(const std::int64_t& now_ms) {
+  unmap();
+  char name[32];
+  std::snprintf(name, sizeof(name), "%013lld", static_cast<long long>(now_ms));
+  std::filesystem::path path = dir / name;
+  path += SEGMENT_EXTENSION;
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    DS_LOGERR << "failed to open history segment " << path << ": " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  if (ftruncate(fd, SEGMENT_SIZE) == -1) {
+    DS_LOGERR << "failed to resize history segment " << path << ": " << strerror_safe(errno) << '\n';
+    unmap();
+    return false;
+  }
+  void* mapped = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    DS_LOGERR << "failed to map history segment " << path << ": " << strerror_safe(errno) << '\n';
+    unmap();
+    return false;
+  }
+  header = static_cast<Header*>(mapped);
+  header->version = VERSION;
+  header->size = SEGMENT_SIZE;
+  header->start_ms = now_ms;
+  header->used = 0;
+  // magic last, a torn header is skipped by readers
+  std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+  last_ms = now_ms;
+  // each segment can be read on its own
+  Event event{};
+  event.time_ms = now_ms;
+  event.kind = Kind::DEVICE;
+  for (std::size_t id = 0; id < devices.size(); id++) {
+    event.device = static_cast<std::uint32_t>(id);
+    event.dir = devices[id];
+    append(event);
+  }
+  // a segment expires once the one after it starts before the retention
+  const std::int64_t expired_ms = now_ms - std::chrono::duration_cast<std::chrono::milliseconds>(retention).count();
+  const std::vector<std::pair<std::int64_t, std::filesystem::path>> found = segments(dir);
+  for (std::size_t i = 0; i + 1 < found.size() && found[i + 1].first < expired_ms; i++) {
+    std::error_code ec;
+    std::filesystem::remove(found[i].second, ec);
+    if (ec) {
+      DS_LOGERR << "failed to remove history segment " << found[i].second << ": " << ec.message() << '\n';
+    }
+  }
+  return true;
+}
+
+bool History::resume() {
+  const std::vector<std::pair<std::int64_t, std::filesystem::path>> found = segments(dir);
+  if (found.empty()) {
+    return false;
+  }
+  const std::filesystem::path& path = found.back().second;
+  fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  struct stat file_stat {};
+  if (fd == -1 || fstat(fd, &file_stat) == -1 || file_stat.st_size != static_cast<off_t>(SEGMENT_SIZE)) {
+    unmap();
+    return false;
+  }
+  void* mapped = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    unmap();
+    return false;
+  }
+  header = static_cast<Header*>(mapped);
+  if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION
+      || header->size != SEGMENT_SIZE || header->used + MAX_RECORD > SEGMENT_SIZE - sizeof(Header)) {
+    unmap();
+    return false;
+  }
+  // devices are recovered in order, a record torn by a crash is dropped and overwritten
+  last_ms = header->start_ms;
+  std::uint32_t valid{0};
+  Event event{};
+  while (valid < header->used) {
+    const std::size_t size = decode(records() + valid, header->used - valid, last_ms, event);
+    if (size == 0) {
+      break;
+    }
+    if (event.kind == Kind::DEVICE && event.device == devices.size()) {
+      devices.emplace_back(event.dir);
+    }
+    valid += static_cast<std::uint32_t>(size);
+  }
+  header->used = valid;
+  return true;
+}
+
+void History::unmap() {
+  if (header != nullptr) {
+    munmap(header, SEGMENT_SIZE);
+    header = nullptr;
+  }
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+[[nodiscard]] std::uint8_t* History::records() const {
+  return reinterpret_cast<std::uint8_t*>(header) + sizeof(Header);
+}
+
+std::vector<std::pair<std::int64_t, std::filesystem::path>> History::segments(const std::filesystem::path& dir) {
+  std::vector<std::pair<std::int64_t, std::filesystem::path>> found;
+  std::error_code ec;
+  for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator{dir, ec}) {
+    const std::filesystem::path& path = entry.path();
+    if (path.extension() != SEGMENT_EXTENSION) {
+      continue;
+    }
+    const std::string stem = path.stem().native();
+    std::int64_t start_ms{0};
+    const auto [end, err] = std::from_chars(stem.data(), stem.data() + stem.size(), start_ms);
+    if (err == std::errc{} && end == stem.data() + stem.size()) {
+      found.emplace_back(start_ms, path);
+    }
+  }
+  std::sort(found.begin(), found.end());
+  return found;
+}
+
+std::size_t History::encode(const Event& event, const std::int64_t& last_ms, std::uint8_t* out) {
+  std::uint8_t* const begin = out;
+  put_varint(out, zigzag(event.time_ms - last_ms));
+  *out++ = static_cast<std::uint8_t>(event.kind);
+  put_varint(out, event.device);
+  switch (event.kind) {
+    case Kind::DEVICE: {
+      const std::size_t length = std::min(event.dir.size(), DIR_LENGTH);
+      put_varint(out, length);
+      std::memcpy(out, event.dir.data(), length);
+      out += length;
+      break;
+    }
+    case Kind::IO:
+      put_varint(out, event.reads);
+      put_varint(out, event.writes);
+      break;
+    case Kind::KEEPALIVE:
+      *out++ = static_cast<std::uint8_t>((event.wake ? 1U : 0U) | (static_cast<unsigned int>(event.result) << 1U));
+      put_varint(out, static_cast<std::uint64_t>(std::max<std::int64_t>(event.latency.count(), 0)));
+      break;
+    case Kind::SKIP:
+      break;
+    case Kind::TRIGGER:
+      *out++ = static_cast<std::uint8_t>(event.trigger);
+      break;
+  }
+  return out - begin;
+}
+
+std::size_t History::decode(const std::uint8_t* in, const std::size_t& size, std::int64_t& last_ms, Event& out) {
+  const std::uint8_t* const begin = in;
+  const std::uint8_t* const end = in + size;
+  std::uint64_t value{0};
+  if (!get_varint(in, end, value) || in == end) {
+    return 0;
+  }
+  const std::int64_t time_ms = last_ms + unzigzag(value);
+  const std::uint8_t kind = *in++;
+  if (kind > static_cast<std::uint8_t>(Kind::TRIGGER) || !get_varint(in, end, value)) {
+    return 0;
+  }
+  out = Event{};
+  out.time_ms = time_ms;
+  out.kind = static_cast<Kind>(kind);
+  out.device = static_cast<std::uint32_t>(value);
+  switch (out.kind) {
+    case Kind::DEVICE:
+      if (!get_varint(in, end, value) || value > DIR_LENGTH || value > static_cast<std::uint64_t>(end - in)) {
+        return 0;
+      }
+      out.dir = std::string_view{reinterpret_cast<const char*>(in), value};
+      in += value;
+      break;
+    case Kind::IO:
+      if (!get_varint(in, end, out.reads) || !get_varint(in, end, out.writes)) {
+        return 0;
+      }
+      break;
+    case Kind::KEEPALIVE: {
+      if (in == end) {
+        return 0;
+      }
+      const std::uint8_t flags = *in++;
+      if ((flags >> 1U) > static_cast<std::uint8_t>(DeviceWorker::Result::QUARANTINED)
+          || !get_varint(in, end, value)) {
+        return 0;
+      }
+      out.wake = (flags & 1U) != 0;
+      out.result = static_cast<DeviceWorker::Result>(flags >> 1U);
+      out.latency = std::chrono::microseconds{value};
+      break;
+    }
+    case Kind::SKIP:
+      break;
+    case Kind::TRIGGER:
+      if (in == end || *in > static_cast<std::uint8_t>(Trigger::CONNECTION)) {
+        return 0;
+      }
+      out.trigger = static_cast<Trigger>(*in++);
+      break;
+  }
+  last_ms = time_ms;
+  return in - begin;
+}
+
+void History::scan(const Header& header, const std::function<void(const Event&)>& visit) {
+  const std::uint8_t* records = reinterpret_cast<const std::uint8_t*>(&header) + sizeof(Header);
+  const std::size_t used
+    = std::min<std::size_t>(__atomic_load_n(&header.used, __ATOMIC_ACQUIRE), header.size - sizeof(Header));
+  // the dirs of this segment, ids are only meaningful within it
+  std::vector<std::string_view> dirs;
+  std::int64_t time_ms = header.start_ms;
+  Event event{};
+  std::size_t offset{0};
+  while (offset < used) {
+    const std::size_t size = decode(records + offset, used - offset, time_ms, event);
+    if (size == 0) {
+      break;
+    }
+    offset += size;
+    if (event.kind == Kind::DEVICE) {
+      if (event.device >= dirs.size()) {
+        dirs.resize(event.device + 1);
+      }
+      dirs[event.device] = event.dir;
+    } else if (event.device < dirs.size()) {
+      event.dir = dirs[event.device];
+    } else {
+      event.dir = {};
+    }
+    visit(event);
+  }
+}
+
+} // namespace ds
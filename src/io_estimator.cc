@@ -0,0 +1,159 @@
+#include "do_not_sleep/io_estimator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#include "do_not_sleep/block_info.h"
+
+namespace ds {
+
+namespace {
+
+// weight of a sample `dt` seconds after the previous one in a rate decaying with `half_life`
+double weight(const double& dt, const std::chrono::seconds& half_life) {
+  if (half_life <= std::chrono::seconds::zero()) {
+    return 1;
+  }
+  return 1 - std::exp2(-dt / static_cast<double>(half_life.count()));
+}
+
+// seconds, a rate decaying with `half_life` times it is the count of what it measured in the past
+double lifetime(const std::chrono::seconds& half_life) {
+  return static_cast<double>(half_life.count()) / std::log(2.0);
+}
+
+// the floor follows `rate` down right away and up with `weight`, `spread` is how far `rate` strays above it
+void follow(const double& rate, const double& weight, double& floor, double& spread) {
+  if (rate < floor) {
+    floor = rate;
+  } else {
+    floor += weight * (rate - floor);
+  }
+  spread += weight * (rate - floor - spread);
+}
+
+} // namespace
+
+IOEstimator::IOEstimator(const Thresholds& thresholds)
+  : thresholds{thresholds}
+  , last{}
+  , last_time{}
+  , sampled{false}
+  , measured{false}
+  , updates{0}
+  , read_sectors{0}
+  , write_sectors{0}
+  , ios{0}
+  , sector_floor{0}
+  , sector_spread{0}
+  , io_floor{0}
+  , io_spread{0}
+  , is_active{false} {
+}
+
+bool IOEstimator::update(const BlockInfo::Counters& counters, const std::chrono::steady_clock::time_point& now) {
+  if (!sampled || counters.read_ios < last.read_ios || counters.read_sectors < last.read_sectors
+      || counters.write_ios < last.write_ios || counters.write_sectors < last.write_sectors) {
+    // counters start over if the disk is replaced
+    rebase(counters, now);
+    return is_active;
+  }
+  const double dt = std::chrono::duration<double>(now - last_time).count();
+  if (dt <= 0) {
+    // taken together with the next one
+    return is_active;
+  }
+  const double read_rate = static_cast<double>(counters.read_sectors - last.read_sectors) / dt;
+  const double write_rate = static_cast<double>(counters.write_sectors - last.write_sectors) / dt;
+  const double io_rate
+    = static_cast<double>((counters.read_ios - last.read_ios) + (counters.write_ios - last.write_ios)) / dt;
+  last = counters;
+  last_time = now;
+  if (!measured) {
+    measured = true;
+    read_sectors = read_rate;
+    write_sectors = write_rate;
+    ios = io_rate;
+    sector_floor = read_rate + write_rate;
+    io_floor = io_rate;
+    return is_active;
+  }
+  const double fast = weight(dt, thresholds.half_life);
+  read_sectors += fast * (read_rate - read_sectors);
+  write_sectors += fast * (write_rate - write_sectors);
+  ios += fast * (io_rate - ios);
+  // against the noise learned before this sample, a burst is not part of it yet
+  const double sectors = read_sectors + write_sectors;
+  is_active = sectors - sector_floor - sector_spread >= thresholds.sectors_per_second
+              || (ios - io_floor - io_spread) * lifetime(thresholds.half_life) >= thresholds.ios;
+  // quiet samples weigh as in their mean until the half-life weighs more, so a floor started low settles within
+  // minutes; activity only ever creeps into it
+  updates += is_active ? 0 : 1;
+  const double slow = is_active ? weight(dt, thresholds.noise_half_life)
+                                : std::max(weight(dt, thresholds.noise_half_life), 1 / static_cast<double>(updates));
+  follow(sectors, slow, sector_floor, sector_spread);
+  follow(ios, slow, io_floor, io_spread);
+  return is_active;
+}
+
+void IOEstimator::rebase(const BlockInfo::Counters& counters, const std::chrono::steady_clock::time_point& now) {
+  last = counters;
+  last_time = now;
+  sampled = true;
+}
+
+[[nodiscard]] IOEstimator::State IOEstimator::save(const std::chrono::steady_clock::time_point& now,
+                                                   const std::int64_t& now_ms) const {
+  return State{
+    .last = last,
+    .last_ms = sampled ? now_ms - std::chrono::duration_cast<std::chrono::milliseconds>(now - last_time).count() : 0,
+    .updates = updates,
+    .read_sectors = read_sectors,
+    .write_sectors = write_sectors,
+    .ios = ios,
+    .sector_floor = sector_floor,
+    .sector_spread = sector_spread,
+    .io_floor = io_floor,
+    .io_spread = io_spread,
+    .measured = measured,
+    .active = is_active};
+}
+
+void IOEstimator::restore(const State& state,
+                          const std::chrono::steady_clock::time_point& now,
+                          const std::int64_t& now_ms) {
+  last = state.last;
+  // a sample from the future (the clock was set back) is not one
+  sampled = state.last_ms != 0 && state.last_ms <= now_ms;
+  last_time = now - std::chrono::milliseconds{sampled ? now_ms - state.last_ms : 0};
+  measured = state.measured;
+  updates = state.updates;
+  read_sectors = state.read_sectors;
+  write_sectors = state.write_sectors;
+  ios = state.ios;
+  sector_floor = state.sector_floor;
+  sector_spread = state.sector_spread;
+  io_floor = state.io_floor;
+  io_spread = state.io_spread;
+  is_active = state.active;
+}
+
+[[nodiscard]] bool IOEstimator::active() const {
+  return is_active;
+}
+
+[[nodiscard]] double IOEstimator::read_rate() const {
+  return read_sectors;
+}
+
+[[nodiscard]] double IOEstimator::write_rate() const {
+  return write_sectors;
+}
+
+[[nodiscard]] double IOEstimator::noise_rate() const {
+  return sector_floor;
+}
+
+} // namespace ds
@@ -0,0 +1,168 @@
+#include "do_not_sleep/local_connections.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "linux/inet_diag.h"
+#include "linux/netlink.h"
+#include "linux/rtnetlink.h"
+#include "linux/sock_diag.h"
+#include "netinet/in.h"
+#include "netinet/tcp.h"
+#include "sys/socket.h"
+#include "unistd.h"
+
+#include "do_not_sleep/probe.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+LocalConnections::LocalConnections(const std::vector<std::uint16_t>& ports)
+  : netlink_fd(socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG))
+  , seq(0)
+  , buf() {
+  if (netlink_fd == -1) {
+    DS_LOGERR << "failed to open sock_diag: " << strerror_safe(errno) << '\n';
+    return;
+  }
+  const std::vector<char> filter = bytecode(ports);
+  const std::size_t attr_len = RTA_LENGTH(filter.size());
+  request.resize(NLMSG_SPACE(sizeof(inet_diag_req_v2)) + RTA_SPACE(filter.size()));
+  nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request.data());
+  header->nlmsg_len = static_cast<std::uint32_t>(NLMSG_SPACE(sizeof(inet_diag_req_v2)) + attr_len);
+  header->nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  header->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  inet_diag_req_v2* diag_request = static_cast<inet_diag_req_v2*>(NLMSG_DATA(header));
+  diag_request->sdiag_protocol = IPPROTO_TCP;
+  diag_request->idiag_states = 1U << TCP_ESTABLISHED;
+  rtattr* attr = reinterpret_cast<rtattr*>(request.data() + NLMSG_SPACE(sizeof(inet_diag_req_v2)));
+  attr->rta_type = INET_DIAG_REQ_BYTECODE;
+  attr->rta_len = static_cast<unsigned short>(attr_len);
+  std::memcpy(RTA_DATA(attr), filter.data(), filter.size());
+}
+
+LocalConnections::LocalConnections(LocalConnections&& other) noexcept
+  : netlink_fd(std::exchange(other.netlink_fd, -1))
+  , request(std::move(other.request))
+  , seq(other.seq)
+  , buf() {
+}
+
+LocalConnections& LocalConnections::operator=(LocalConnections&& other) noexcept {
+  if (this != &other) {
+    if (netlink_fd != -1) {
+      close(netlink_fd);
+    }
+    netlink_fd = std::exchange(other.netlink_fd, -1);
+    request = std::move(other.request);
+    seq = other.seq;
+  }
+  return *this;
+}
+
+LocalConnections::~LocalConnections() {
+  if (netlink_fd != -1) {
+    close(netlink_fd);
+  }
+}
+
+[[nodiscard]] bool LocalConnections::good() const {
+  return netlink_fd != -1;
+}
+
+bool LocalConnections::count(std::size_t& out_count) {
+  out_count = 0;
+  if (netlink_fd == -1) {
+    return false;
+  }
+  const bool ok = dump(AF_INET6, out_count) && dump(AF_INET, out_count);
+  DS_PROBE2(connections_check, out_count, ok);
+  return ok;
+}
+
+/* NOLINTNEXTLINE(readability-function-cognitive-complexity) */
+bool LocalConnections::dump(const std::uint8_t& family, std::size_t& out_count) {
+  nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request.data());
+  header->nlmsg_seq = ++seq;
+  static_cast<inet_diag_req_v2*>(NLMSG_DATA(header))->sdiag_family = family;
+  sockaddr_nl kernel{};
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(netlink_fd, request.data(), header->nlmsg_len, 0, reinterpret_cast<const sockaddr*>(&kernel),
+             sizeof(kernel))
+      == -1) {
+    DS_LOGERR << "failed to request socket dump: " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  while (true) {
+    ssize_t len = recv(netlink_fd, buf.data(), buf.size(), 0);
+    if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      DS_LOGERR << "failed to read socket dump: " << strerror_safe(errno) << '\n';
+      return false;
+    }
+    for (const nlmsghdr* reply = reinterpret_cast<const nlmsghdr*>(buf.data()); NLMSG_OK(reply, len);
+         reply = NLMSG_NEXT(reply, len)) {
+      if (reply->nlmsg_seq != seq) {
+        // left over from an interrupted dump
+        continue;
+      }
+      if (reply->nlmsg_type == NLMSG_DONE) {
+        return true;
+      }
+      if (reply->nlmsg_type == NLMSG_ERROR) {
+        const nlmsgerr* error = static_cast<const nlmsgerr*>(NLMSG_DATA(reply));
+        if (family == AF_INET6 && error->error == -ENOENT) {
+          // no IPv6 support
+          return true;
+        }
+        DS_LOGERR << "socket dump failed: " << strerror_safe(-error->error) << '\n';
+        return false;
+      }
+      if (reply->nlmsg_type == SOCK_DIAG_BY_FAMILY) {
+        out_count++;
+      }
+    }
+  }
+}
+
+std::vector<char> LocalConnections::bytecode(const std::vector<std::uint16_t>& ports) {
+  // per port `sport >= port && sport <= port`, joined by jumps to the end:
+  //   [GE port][LE port][JMP] ... [GE port][LE port]
+  // every op is reachable through `yes`, which the kernel's bytecode audit requires. A failed comparison skips to
+  // the next port, past the end (+4) for the last one, which rejects, a match runs into its JMP or, for the last
+  // port, lands exactly on the end, which accepts.
+  constexpr std::size_t OP_SIZE{sizeof(inet_diag_bc_op)};
+  constexpr std::size_t PORT_SIZE{2 * 2 * OP_SIZE};
+  constexpr std::size_t BLOCK_SIZE{PORT_SIZE + OP_SIZE};
+  const std::size_t length = ports.empty() ? 0 : ports.size() * BLOCK_SIZE - OP_SIZE;
+  std::vector<inet_diag_bc_op> ops;
+  ops.reserve(length / OP_SIZE);
+  for (std::size_t i = 0; i < ports.size(); i++) {
+    const std::size_t offset = i * BLOCK_SIZE;
+    ops.emplace_back(inet_diag_bc_op{.code = INET_DIAG_BC_S_GE,
+                                     .yes = static_cast<std::uint8_t>(2 * OP_SIZE),
+                                     .no = static_cast<std::uint16_t>(BLOCK_SIZE)});
+    ops.emplace_back(inet_diag_bc_op{.code = 0, .yes = 0, .no = ports[i]});
+    ops.emplace_back(inet_diag_bc_op{.code = INET_DIAG_BC_S_LE,
+                                     .yes = static_cast<std::uint8_t>(2 * OP_SIZE),
+                                     .no = static_cast<std::uint16_t>(BLOCK_SIZE - 2 * OP_SIZE)});
+    ops.emplace_back(inet_diag_bc_op{.code = 0, .yes = 0, .no = ports[i]});
+    if (i + 1 < ports.size()) {
+      const std::size_t jmp_offset = offset + PORT_SIZE;
+      ops.emplace_back(inet_diag_bc_op{.code = INET_DIAG_BC_JMP,
+                                       .yes = static_cast<std::uint8_t>(OP_SIZE),
+                                       .no = static_cast<std::uint16_t>(length - jmp_offset)});
+    }
+  }
+  std::vector<char> filter(length);
+  std::memcpy(filter.data(), ops.data(), length);
+  return filter;
+}
+
+} // namespace ds
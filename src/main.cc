@@ -1,8 +1,99 @@
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <system_error>
+
+#include "do_not_sleep/config.h"
 #include "do_not_sleep/ds.h"
+#include "do_not_sleep/history.h"
+#include "do_not_sleep/replay.h"
+#include "do_not_sleep/util.h"
+
+namespace {
+
+int usage(const char* argv0, const bool& asked) {
+  (asked ? std::cout : std::cerr)
+    << "usage: " << argv0 << " [--once] [--config PATH]\n"
+    << "       " << argv0 << " history [--days N] [--csv] [--config PATH]\n"
+    << "       " << argv0 << " replay [--days N] [--config PATH]\n"
+    << "  --once     keep awake once if the policy asks for it and exit, e.g. from a systemd timer\n"
+    << "  --config   the config file instead of ~/.config/do_not_sleep/conf\n"
+    << "  history    summarize the recorded keepalives, spin-ups and what asked for them, per dir\n"
+    << "  --days N   only the last N days\n"
+    << "  --csv      every recorded event as CSV instead\n"
+    << "  replay     run the policy of the config over the recorded I/O and triggers, its keepalives against the\n"
+    << "             recorded ones per dir\n";
+  return asked ? 0 : 2;
+}
+
+// `history` and `replay`
+int history(const char* argv0, const int& argc, const char* argv[]) {
+  const bool replay = std::string_view{argv[1]} == "replay";
+  std::int64_t since_ms{0};
+  bool csv{false};
+  std::filesystem::path config_file{ds::Config::default_config_dir()};
+  for (int i = 2; i < argc; i++) {
+    const std::string_view arg{argv[i]};
+    std::uint32_t days{0};
+    if (arg == "--csv" && !replay) {
+      csv = true;
+    } else if (arg == "--config" && i + 1 < argc) {
+      config_file = argv[++i];
+    } else if (arg == "--days" && i + 1 < argc) {
+      const std::string_view value{argv[++i]};
+      const auto [end, err] = std::from_chars(value.data(), value.data() + value.size(), days);
+      if (err != std::errc{} || end != value.data() + value.size()) {
+        return usage(argv0, false);
+      }
+      since_ms = ds::current_time_ms() - static_cast<std::int64_t>(days) * 24 * 3600 * 1000;
+    } else {
+      return usage(argv0, arg == "--help" || arg == "-h");
+    }
+  }
+  const ds::Config config = ds::Config::from_json(config_file);
+  if (config == ds::Config::UNSET) {
+    DS_LOGERR << "something wrong with the config, stopped.\n";
+    return 1;
+  }
+  if (config.history_dir.empty()) {
+    DS_LOGERR << "history is not recorded, see `history.dir`.\n";
+    return 1;
+  }
+  bool read{false};
+  if (replay) {
+    read = ds::Replay{config}.run(config.history_dir, since_ms, std::cout);
+  } else {
+    read = csv ? ds::History::export_csv(config.history_dir, since_ms, std::cout)
+               : ds::History::summarize(config.history_dir, since_ms, std::cout);
+  }
+  std::cout << std::flush;
+  return read ? 0 : 1;
+}
+
+} // namespace
 
-// NOLINTNEXTLINE(misc-unused-parameters)
 int main(int argc, const char* argv[]) {
-  ds::DoNotSleep ds{};
+  if (argc > 1 && (std::string_view{argv[1]} == "history" || std::string_view{argv[1]} == "replay")) {
+    return history(argv[0], argc, argv);
+  }
+  bool once{false};
+  std::filesystem::path config_file{};
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg{argv[i]};
+    if (arg == "--once") {
+      once = true;
+    } else if (arg == "--config" && i + 1 < argc) {
+      config_file = argv[++i];
+    } else {
+      return usage(argv[0], arg == "--help" || arg == "-h");
+    }
+  }
+  ds::DoNotSleep ds{config_file.empty() ? ds::Config::from_json() : ds::Config::from_json(config_file)};
+  if (once) {
+    return ds.once() ? 0 : 1;
+  }
   ds.start();
   return 0;
 }
@@ -0,0 +1,104 @@
+#include "do_not_sleep/priority.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+#include <tuple>
+
+#include "fcntl.h"
+#include "linux/ioprio.h"
+#include "sched.h"
+#include "sys/resource.h"
+#include "sys/syscall.h"
+#include "unistd.h"
+
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+const IOPriority IOPriority::UNSET{.io_class = IOPriority::Class::NONE, .level = 0};
+
+bool operator==(const IOPriority& l, const IOPriority& r) {
+  return std::tie(l.io_class, l.level) == std::tie(r.io_class, r.level);
+}
+
+bool operator!=(const IOPriority& l, const IOPriority& r) {
+  return !(l == r);
+}
+
+LogLine& operator<<(LogLine& out, const IOPriority& priority) {
+  switch (priority.io_class) {
+    case IOPriority::Class::NONE: return out << "none";
+    case IOPriority::Class::REALTIME: return out << "realtime/" << static_cast<int>(priority.level);
+    case IOPriority::Class::BEST_EFFORT: return out << "best_effort/" << static_cast<int>(priority.level);
+    case IOPriority::Class::IDLE: return out << "idle";
+    default: return out << "unknown";
+  }
+}
+
+bool set_io_priority(const IOPriority& priority) {
+  int io_class{IOPRIO_CLASS_NONE};
+  switch (priority.io_class) {
+    case IOPriority::Class::NONE: io_class = IOPRIO_CLASS_NONE; break;
+    case IOPriority::Class::REALTIME: io_class = IOPRIO_CLASS_RT; break;
+    case IOPriority::Class::BEST_EFFORT: io_class = IOPRIO_CLASS_BE; break;
+    case IOPriority::Class::IDLE: io_class = IOPRIO_CLASS_IDLE; break;
+    default: return false;
+  }
+  const int level = (priority.io_class == IOPriority::Class::IDLE || priority.io_class == IOPriority::Class::NONE)
+                      ? 0
+                      : std::min<int>(priority.level, 7);
+  // who = 0 is the calling thread
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(io_class, level)) == -1) {
+    DS_LOGERR << "failed to set I/O priority " << priority << ": " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool set_cpu_idle() {
+  sched_param param{};
+  param.sched_priority = 0;
+  if (sched_setscheduler(0, SCHED_IDLE, &param) == -1) {
+    DS_LOGERR << "failed to set SCHED_IDLE: " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool set_nice(const int& nice) {
+  // on linux nice values are per thread, 0 is the calling one
+  if (setpriority(PRIO_PROCESS, 0, nice) == -1) {
+    DS_LOGERR << "failed to set nice " << nice << ": " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool join_cgroup(const std::filesystem::path& cgroup) {
+  std::error_code ec;
+  std::filesystem::create_directories(cgroup, ec);
+  File procs{cgroup / "cgroup.procs", O_WRONLY};
+  // writing 0 moves the writing process
+  if (!procs.good() || !procs.pwrite("0", 1, 0)) {
+    DS_LOGERR << "failed to join cgroup " << cgroup << ": " << strerror_safe(procs.error()) << '\n';
+    return false;
+  }
+  return true;
+}
+
+void LatencyStats::add(const std::chrono::nanoseconds& latency) {
+  count++;
+  total += latency;
+  max = std::max(max, latency);
+}
+
+[[nodiscard]] std::chrono::nanoseconds LatencyStats::mean() const {
+  return count == 0 ? std::chrono::nanoseconds::zero() : total / static_cast<std::int64_t>(count);
+}
+
+} // namespace ds
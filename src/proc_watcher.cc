@@ -0,0 +1,272 @@
+#include "do_not_sleep/proc_watcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "fcntl.h"
+#include "linux/cn_proc.h"
+#include "linux/connector.h"
+#include "linux/netlink.h"
+#include "poll.h"
+#include "sys/socket.h"
+#include "unistd.h"
+
+#include "do_not_sleep/probe.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+// `/proc/<pid>/comm` is truncated to 15 chars
+constexpr std::size_t COMM_LENGTH{15};
+
+// ask the proc connector behind `netlink_fd` to start or stop sending process events, false on error
+bool send_mcast_op(const int& netlink_fd, const proc_cn_mcast_op& op) {
+  alignas(nlmsghdr) char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))]{};
+  nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request);
+  header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+  header->nlmsg_type = NLMSG_DONE;
+  header->nlmsg_pid = getpid();
+  cn_msg* message = static_cast<cn_msg*>(NLMSG_DATA(header));
+  message->id.idx = CN_IDX_PROC;
+  message->id.val = CN_VAL_PROC;
+  message->len = sizeof(proc_cn_mcast_op);
+  std::memcpy(message->data, &op, sizeof(op));
+  return send(netlink_fd, request, header->nlmsg_len, 0) != -1;
+}
+
+std::vector<std::string> truncated(const std::vector<std::string>& names) {
+  std::vector<std::string> result;
+  for (const std::string& name : names) {
+    result.emplace_back(name.substr(0, COMM_LENGTH));
+  }
+  return result;
+}
+
+} // namespace
+
+ProcWatcher::ProcWatcher(const std::vector<std::string>& names)
+  : netlink_fd(socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_CONNECTOR))
+  , names(truncated(names)) {
+  if (netlink_fd == -1) {
+    DS_LOGERR << "failed to open proc connector: " << strerror_safe(errno) << '\n';
+  } else if (!subscribe()) {
+    close(netlink_fd);
+    netlink_fd = -1;
+  }
+  // after subscribing, so nothing started in between is missed, `running` is right even without events
+  scan_proc();
+}
+
+ProcWatcher::ProcWatcher(ProcWatcher&& other) noexcept
+  : netlink_fd(std::exchange(other.netlink_fd, -1))
+  , names(std::move(other.names))
+  , pids(std::move(other.pids)) {
+}
+
+ProcWatcher& ProcWatcher::operator=(ProcWatcher&& other) noexcept {
+  if (this != &other) {
+    release();
+    netlink_fd = std::exchange(other.netlink_fd, -1);
+    names = std::move(other.names);
+    pids = std::move(other.pids);
+  }
+  return *this;
+}
+
+ProcWatcher::~ProcWatcher() {
+  release();
+}
+
+[[nodiscard]] bool ProcWatcher::good() const {
+  return netlink_fd != -1;
+}
+
+[[nodiscard]] std::size_t ProcWatcher::running() const {
+  return pids.size();
+}
+
+[[nodiscard]] int ProcWatcher::fd() const {
+  return netlink_fd;
+}
+
+bool ProcWatcher::wait(std::chrono::milliseconds timeout) {
+  pollfd netlink_pollfd{.fd = netlink_fd, .events = POLLIN, .revents = 0};
+  int ret = poll(&netlink_pollfd, 1, timeout < std::chrono::milliseconds::zero() ? -1 : timeout.count());
+  if (ret == -1) {
+    if (errno == EINTR) {
+      return true;
+    }
+    DS_LOGERR << "failed to poll proc connector: " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  if (ret == 0) {
+    return true;
+  }
+  return read_events();
+}
+
+bool ProcWatcher::subscribe() {
+  sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_pid = 0;
+  addr.nl_groups = CN_IDX_PROC;
+  if (bind(netlink_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == -1) {
+    DS_LOGERR << "failed to bind proc connector: " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  if (!send_mcast_op(netlink_fd, PROC_CN_MCAST_LISTEN)) {
+    DS_LOGERR << "failed to subscribe to process events: " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  return true;
+}
+
+void ProcWatcher::release() {
+  if (netlink_fd == -1) {
+    return;
+  }
+  // the kernel counts listeners and keeps building events while it has any, closing the socket does not count down
+  if (!send_mcast_op(netlink_fd, PROC_CN_MCAST_IGNORE)) {
+    DS_LOGERR << "failed to unsubscribe from process events: " << strerror_safe(errno) << '\n';
+  }
+  close(netlink_fd);
+  netlink_fd = -1;
+}
+
+std::size_t ProcWatcher::count_running(const std::vector<std::string>& names) {
+  std::vector<pid_t> found;
+  scan_proc(truncated(names), found);
+  DS_PROBE1(processes_check, found.size());
+  return found.size();
+}
+
+void ProcWatcher::scan_proc() {
+  scan_proc(names, pids);
+  DS_PROBE1(processes_check, pids.size());
+}
+
+void ProcWatcher::scan_proc(const std::vector<std::string>& names, std::vector<pid_t>& out) {
+  out.clear();
+  std::error_code ec;
+  for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator{"/proc", ec}) {
+    const std::string& name = entry.path().filename().native();
+    if (name.empty() || !std::all_of(name.begin(), name.end(), [](const char& c) { return c >= '0' && c <= '9'; })) {
+      continue;
+    }
+    const pid_t pid = static_cast<pid_t>(std::strtol(name.c_str(), nullptr, 10));
+    if (matches(pid, names)) {
+      out.emplace_back(pid);
+    }
+  }
+  std::sort(out.begin(), out.end());
+}
+
+bool ProcWatcher::read_events() {
+  alignas(nlmsghdr) char buf[8192];
+  ssize_t len{0};
+  while ((len = recv(netlink_fd, buf, sizeof(buf), 0)) > 0) {
+    for (const nlmsghdr* header = reinterpret_cast<const nlmsghdr*>(buf); NLMSG_OK(header, len);
+         header = NLMSG_NEXT(header, len)) {
+      if (header->nlmsg_type == NLMSG_NOOP || header->nlmsg_type == NLMSG_ERROR) {
+        continue;
+      }
+      const cn_msg* message = static_cast<const cn_msg*>(NLMSG_DATA(header));
+      if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC) {
+        continue;
+      }
+      const proc_event* event = reinterpret_cast<const proc_event*>(message->data);
+      switch (event->what) {
+        case proc_event::PROC_EVENT_FORK:
+          // e.g. rsync forks itself without exec
+          if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid
+              && tracked(event->event_data.fork.parent_tgid)) {
+            track(event->event_data.fork.child_tgid);
+          }
+          break;
+        case proc_event::PROC_EVENT_EXEC:
+        case proc_event::PROC_EVENT_COMM: {
+          // both carry process_pid/process_tgid at the same place
+          const pid_t tgid = event->event_data.exec.process_tgid;
+          if (matches(tgid, names)) {
+            track(tgid);
+          } else {
+            untrack(tgid);
+          }
+          break;
+        }
+        case proc_event::PROC_EVENT_EXIT:
+          if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+            untrack(event->event_data.exit.process_tgid);
+          }
+          break;
+        default: break;
+      }
+    }
+  }
+  if (len == -1 && errno == ENOBUFS) {
+    // events were dropped, start over
+    DS_LOGERR << "lost process events, rescanning /proc.\n";
+    scan_proc();
+    return true;
+  }
+  if (len == -1 && errno != EAGAIN) {
+    DS_LOGERR << "failed to read process events: " << strerror_safe(errno) << '\n';
+    return false;
+  }
+  DS_PROBE1(processes_check, pids.size());
+  return true;
+}
+
+[[nodiscard]] bool ProcWatcher::matches(const pid_t& pid, const std::vector<std::string>& names) {
+  char path[32];
+  std::snprintf(path, sizeof(path), "/proc/%d/comm", static_cast<int>(pid));
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  char comm[COMM_LENGTH + 2];
+  const ssize_t len = read(fd, comm, sizeof(comm));
+  close(fd);
+  if (len <= 0) {
+    return false;
+  }
+  std::string_view comm_view{comm, static_cast<std::size_t>(len)};
+  if (comm_view.back() == '\n') {
+    comm_view.remove_suffix(1);
+  }
+  return std::find(names.begin(), names.end(), comm_view) != names.end();
+}
+
+[[nodiscard]] bool ProcWatcher::tracked(const pid_t& pid) const {
+  return std::binary_search(pids.begin(), pids.end(), pid);
+}
+
+void ProcWatcher::track(const pid_t& pid) {
+  std::vector<pid_t>::iterator found = std::lower_bound(pids.begin(), pids.end(), pid);
+  if (found == pids.end() || *found != pid) {
+    pids.insert(found, pid);
+  }
+}
+
+void ProcWatcher::untrack(const pid_t& pid) {
+  std::vector<pid_t>::iterator found = std::lower_bound(pids.begin(), pids.end(), pid);
+  if (found != pids.end() && *found == pid) {
+    pids.erase(found);
+  }
+}
+
+} // namespace ds
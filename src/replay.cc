@@ -0,0 +1,272 @@
+#include "do_not_sleep/replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "sys/epoll.h"
+
+#include "do_not_sleep/block_info.h"
+#include "do_not_sleep/cgroup_io.h"
+#include "do_not_sleep/config.h"
+#include "do_not_sleep/device_class.h"
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/history.h"
+#include "do_not_sleep/io_estimator.h"
+#include "do_not_sleep/state_file.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+Replay::Replay(Config config) : DoNotSleep(std::move(config)) {
+  // the report is the output, the log lines of the policy on the replayed clock would bury it
+  quiet = true;
+}
+
+bool Replay::run(const std::filesystem::path& history_dir, const std::int64_t& since_ms, std::ostream& out) {
+  if (config == Config::UNSET) {
+    DS_LOGERR << "something wrong with the config, stopped.\n";
+    return false;
+  }
+  // of the events of the dirs kept awake
+  std::int64_t first_ms{0};
+  std::int64_t last_ms{0};
+  const bool any = History::read(history_dir, since_ms, [this, &first_ms, &last_ms](const History::Event& event) {
+    const std::size_t target = target_of(event.dir);
+    if (target == NO_TARGET) {
+      return;
+    }
+    first_ms = first_ms == 0 ? event.time_ms : std::min(first_ms, event.time_ms);
+    last_ms = std::max(last_ms, event.time_ms);
+    Tally& tally = tallies[target];
+    switch (event.kind) {
+      case History::Kind::KEEPALIVE:
+        tally.recorded_keepalives++;
+        tally.recorded_wakes += event.wake ? 1 : 0;
+        tally.recorded_spin_ups
+          += event.result == DeviceWorker::Result::DONE && event.latency >= History::SPIN_UP ? 1 : 0;
+        break;
+      case History::Kind::SKIP: tally.recorded_skips++; break;
+      case History::Kind::IO:
+      case History::Kind::TRIGGER:
+        inputs.emplace_back(Input{.time_ms = event.time_ms,
+                                  .target = target,
+                                  .kind = event.kind,
+                                  .trigger = event.trigger,
+                                  .reads = event.reads,
+                                  .writes = event.writes});
+        break;
+      default: break;
+    }
+  });
+  if (!any) {
+    out << "no history in " << history_dir << ".\n";
+    return false;
+  }
+  if (targets.empty()) {
+    out << "none of the recorded dirs is kept awake by the config.\n";
+    return false;
+  }
+  // segments are read oldest first, a clock set back may still have reordered them
+  std::stable_sort(
+    inputs.begin(), inputs.end(), [](const Input& a, const Input& b) { return a.time_ms < b.time_ms; });
+  clock_ms = first_ms;
+
+  events = File{epoll_create1(EPOLL_CLOEXEC)};
+  if (!events.good() || !open_policy()) {
+    return false;
+  }
+  deadline = std::chrono::steady_clock::time_point{};
+  opened = true;
+  bool running{true};
+  for (std::size_t next = 0; running;) {
+    for (; next < inputs.size() && inputs[next].time_ms <= clock_ms; next++) {
+      feed(inputs[next]);
+    }
+    running = process_events();
+    if (next == inputs.size() && clock_ms >= last_ms) {
+      break;
+    }
+    // on to the next look or the next event, whichever comes first
+    std::int64_t until_ms = next < inputs.size() ? inputs[next].time_ms : last_ms;
+    const std::chrono::steady_clock::time_point look = next_deadline();
+    if (look != std::chrono::steady_clock::time_point::max()) {
+      until_ms = std::min(
+        until_ms, std::chrono::duration_cast<std::chrono::milliseconds>(look.time_since_epoch()).count());
+    }
+    clock_ms = std::max(clock_ms + 1, until_ms);
+  }
+
+  out << "replayed " << inputs.size() << " recorded event(s) from ";
+  History::write_time(out, first_ms);
+  out << " to ";
+  History::write_time(out, last_ms);
+  out << ":\n";
+  for (const Target& target : targets) {
+    const Tally& tally = tallies[&target - targets.data()];
+    out << target.dir.native() << ": recorded " << tally.recorded_keepalives << " keepalive(s) ("
+        << tally.recorded_wakes << " wake(s), " << tally.recorded_spin_ups << " spin-up(s), "
+        << tally.recorded_skips << " skipped); replayed " << tally.keepalives << " keepalive(s) (" << tally.wakes
+        << " wake(s), " << target.activity.skipped << " skipped) from " << tally.io_records << " I/O record(s) and "
+        << tally.triggers << " trigger(s).\n";
+  }
+  return running;
+}
+
+std::size_t Replay::target_of(const std::string_view& dir) {
+  const auto found = by_dir.find(dir);
+  if (found != by_dir.end()) {
+    return found->second;
+  }
+  const std::filesystem::path path{dir};
+  std::size_t& index = by_dir[std::string{dir}];
+  index = NO_TARGET;
+  // discovered dirs come and go, any of them counts
+  if (config.discover.empty() && config.dirs.count(path) == 0) {
+    return index;
+  }
+  // as it is now, e.g. `other` if the dir is gone
+  const DeviceClass device_class = DeviceClass::of(path);
+  const Config::ClassPolicy& class_policy = config.device_classes[static_cast<std::size_t>(device_class.kind)];
+  if (class_policy.keepalive == Config::Keepalive::NONE) {
+    return index;
+  }
+  index = targets.size();
+  targets.emplace_back(Target{.dir = path,
+                              .slot = StateFile::NO_SLOT,
+                              .history_id = 0,
+                              .state{},
+                              .last_latency{},
+                              .device_class = device_class,
+                              .keepalive = class_policy.keepalive,
+                              .interval = class_policy.interval == std::chrono::seconds::zero() ? config.interval
+                                                                                               : class_policy.interval,
+                              .worker{path.string(), config.breaker},
+                              .job{},
+                              .job_submitted = false,
+                              .activity{},
+                              .discovered = !config.discover.empty(),
+                              .keepalive_deadline{},
+                              .keepalive_wake = false});
+  tallies.emplace_back();
+  disks.emplace_back();
+  // the first look only takes them in, as a daemon starting up would
+  cgroups.emplace_back(CgroupIO::Counters{.rbytes = 0, .wbytes = 0, .rios = 1, .wios = 1});
+  return index;
+}
+
+void Replay::feed(const Input& input) {
+  Tally& tally = tallies[input.target];
+  BlockInfo::Counters& disk = disks[input.target];
+  if (input.kind == History::Kind::IO) {
+    tally.io_records++;
+    disk.read_ios += input.reads;
+    disk.write_ios += input.writes;
+    Target& target = targets[input.target];
+    if (config.skip_active && target.device_class.kind != DeviceClass::Kind::OTHER) {
+      // recorded when a sample saw it, which the daemon takes for the time of the sample before: up to half an
+      // interval earlier, so a few more keepalives are skipped here than there
+      target.activity.active_ms = input.time_ms;
+    }
+    return;
+  }
+  tally.triggers++;
+  switch (input.trigger) {
+    case History::Trigger::ACCESS:
+      if (std::find(accessed.begin(), accessed.end(), input.target) == accessed.end()) {
+        accessed.emplace_back(input.target);
+      }
+      // the watcher would wake the loop up right away
+      deadline = std::chrono::steady_clock::time_point{};
+      break;
+    case History::Trigger::DISK_IO:
+      // the counters behind it are not recorded: a burst the estimator takes for activity whatever it learned
+      if (std::isfinite(config.activity.ios)) {
+        disk.write_ios += static_cast<std::uint64_t>(std::ceil(2 * config.activity.ios));
+      }
+      break;
+    case History::Trigger::CGROUP_IO: cgroups[input.target].wios++; break;
+    default: break;
+  }
+}
+
+bool Replay::open_policy() {
+  switch (config.policy) {
+    case Config::Policy::TIME_RANGE:
+    case Config::Policy::SCHEDULE: return true;
+    case Config::Policy::MONITOR_IO:
+      for (std::size_t i = 0; i < targets.size(); i++) {
+        if (config.trigger == Config::Trigger::FANOTIFY) {
+          access_blocks.emplace_back(AccessCtx{.target = i, .ticking = false});
+          continue;
+        }
+        monitor_blocks.emplace_back(MonitorCtx{.target = i,
+                                               .block_info{},
+                                               .io{0, 0},
+                                               .estimator = IOEstimator{config.activity},
+                                               .rebase = false,
+                                               .awake_time_remaining{std::chrono::seconds::zero()},
+                                               .time_until_next_ticktock{std::chrono::seconds::zero()}});
+      }
+      return true;
+    case Config::Policy::CGROUP_IO:
+      for (std::size_t i = 0; i < targets.size(); i++) {
+        cgroup_blocks.emplace_back(i, next_keepalive_ms(targets[i], clock_ms));
+      }
+      return true;
+    default:
+      DS_LOGERR << "only the start of what the policy waits for is recorded, it cannot be replayed, stopped.\n";
+      return false;
+  }
+}
+
+[[nodiscard]] std::int64_t Replay::wall_ms() const {
+  return clock_ms;
+}
+
+[[nodiscard]] std::chrono::steady_clock::time_point Replay::steady_now() const {
+  return std::chrono::steady_clock::time_point{std::chrono::milliseconds{clock_ms}};
+}
+
+bool Replay::sample_disk(MonitorCtx& block, BlockInfo::Counters& out) {
+  out = disks[block.target];
+  return true;
+}
+
+bool Replay::wait_accesses() {
+  triggered.clear();
+  // one access block per target
+  triggered.swap(accessed);
+  return true;
+}
+
+bool Replay::scan_cgroups() {
+  return true;
+}
+
+[[nodiscard]] const CgroupIO::Counters& Replay::cgroup_counters(const std::size_t& index) const {
+  return cgroups[index];
+}
+
+bool Replay::start_keep_awake(Target& target, const bool& wake, const bool& /*in_place*/) {
+  target.state.last_keepalive_ms = clock_ms;
+  Tally& tally = tallies[&target - targets.data()];
+  tally.keepalives++;
+  tally.wakes += wake ? 1 : 0;
+  return true;
+}
+
+void Replay::finish_keep_awake(Target& /*target*/,
+                               const bool& /*wake*/,
+                               const std::chrono::steady_clock::time_point& /*deadline*/) {
+}
+
+} // namespace ds
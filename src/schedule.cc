@@ -0,0 +1,193 @@
+#include "do_not_sleep/schedule.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "do_not_sleep/hms.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+constexpr std::uint32_t SECONDS_PER_DAY{24 * 60 * 60};
+constexpr std::uint64_t ALL_SECONDS_OF_MINUTE{(std::uint64_t{1} << 60) - 1};
+
+std::uint32_t second_of_day(const HMS& hms) {
+  return (hms.hours * 60 + hms.minutes) * 60 + hms.seconds;
+}
+
+using Range = std::pair<std::uint32_t, std::uint32_t>;
+
+// [start, end) in seconds of the week on each day of `rule`, `end` may pass the end of the week
+void add_ranges(std::vector<Range>& ranges, const Schedule::Rule& rule) {
+  const std::uint32_t start = std::min(second_of_day(rule.start), SECONDS_PER_DAY);
+  std::uint32_t end = std::min(second_of_day(rule.end), SECONDS_PER_DAY);
+  if (end <= start) {
+    // across midnight
+    end += SECONDS_PER_DAY;
+  }
+  for (std::uint32_t day = 0; day < 7; day++) {
+    if ((rule.days & (1U << day)) != 0) {
+      ranges.emplace_back(day * SECONDS_PER_DAY + start, day * SECONDS_PER_DAY + end);
+    }
+  }
+}
+
+bool covered(const std::vector<Range>& ranges, const std::uint32_t& second_of_week) {
+  return std::any_of(ranges.begin(), ranges.end(), [&second_of_week](const Range& range) {
+    return (second_of_week + Schedule::SECONDS_PER_WEEK - range.first) % Schedule::SECONDS_PER_WEEK
+           < range.second - range.first;
+  });
+}
+
+} // namespace
+
+Schedule::Schedule() : active{}, edges{} {
+}
+
+Schedule::Schedule(const std::vector<Rule>& windows, const std::vector<Rule>& exceptions) : active{}, edges{} {
+  std::vector<Range> window_ranges;
+  std::vector<Range> exception_ranges;
+  for (const Rule& window : windows) {
+    add_ranges(window_ranges, window);
+  }
+  for (const Rule& exception : exceptions) {
+    add_ranges(exception_ranges, exception);
+  }
+  // the state only changes at these, compiled range by range instead of second by second
+  std::vector<std::uint32_t> bounds{0, SECONDS_PER_WEEK};
+  for (const std::vector<Range>* ranges : {&window_ranges, &exception_ranges}) {
+    for (const Range& range : *ranges) {
+      bounds.emplace_back(range.first % SECONDS_PER_WEEK);
+      bounds.emplace_back(range.second % SECONDS_PER_WEEK);
+    }
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  // per-second state of each minute, bit 0 is the first second
+  std::vector<std::uint64_t> minute_masks(MINUTES_PER_WEEK, 0);
+  for (std::size_t i = 0; i + 1 < bounds.size(); i++) {
+    if (!covered(window_ranges, bounds[i]) || covered(exception_ranges, bounds[i])) {
+      continue;
+    }
+    for (std::uint32_t s = bounds[i]; s < bounds[i + 1];) {
+      const std::uint32_t minute = s / 60;
+      const std::uint32_t until = std::min(bounds[i + 1], (minute + 1) * 60);
+      minute_masks[minute] |= ((std::uint64_t{1} << (until - s)) - 1) << (s % 60);
+      s = until;
+    }
+  }
+  for (std::uint32_t minute = 0; minute < MINUTES_PER_WEEK; minute++) {
+    const std::uint64_t minute_mask = minute_masks[minute];
+    const std::uint64_t bit = std::uint64_t{1} << (minute % WORD_BITS);
+    if ((minute_mask & 1U) != 0) {
+      active[minute / WORD_BITS] |= bit;
+    }
+    if (minute_mask != 0 && minute_mask != ALL_SECONDS_OF_MINUTE) {
+      edges[minute / WORD_BITS] |= bit;
+      edge_seconds.emplace_back(minute, minute_mask);
+    }
+  }
+}
+
+[[nodiscard]] bool Schedule::contains(const std::uint32_t& second_of_week) const {
+  const std::uint32_t minute = (second_of_week / 60) % MINUTES_PER_WEEK;
+  if (!minute_edge(minute)) {
+    return minute_active(minute);
+  }
+  return ((minute_seconds(minute) >> (second_of_week % 60)) & 1U) != 0;
+}
+
+[[nodiscard]] std::uint32_t Schedule::next_transition(const std::uint32_t& second_of_week) const {
+  const bool state = contains(second_of_week);
+  const std::uint32_t minute = (second_of_week / 60) % MINUTES_PER_WEEK;
+  const std::uint32_t second = second_of_week % 60;
+
+  // rest of the current minute
+  if (minute_edge(minute)) {
+    const std::uint64_t seconds = minute_seconds(minute);
+    for (std::uint32_t s = second + 1; s < 60; s++) {
+      if ((((seconds >> s) & 1U) != 0) != state) {
+        return s - second;
+      }
+    }
+  }
+
+  // first following minute that either starts in the other state or changes within itself
+  const std::uint64_t flip = state ? ~std::uint64_t{0} : 0;
+  const std::uint32_t first = minute + 1;
+  for (std::uint32_t scanned = 0; scanned <= MINUTES_PER_WEEK;) {
+    const std::uint32_t m = (first + scanned) % MINUTES_PER_WEEK;
+    const std::uint32_t word = m / WORD_BITS;
+    const std::uint32_t offset = m % WORD_BITS;
+    std::uint64_t candidates = ((active[word] ^ flip) | edges[word]) >> offset;
+    if (word == WORDS - 1) {
+      // bits past the end of the week are not minutes
+      const std::uint32_t valid = MINUTES_PER_WEEK - word * WORD_BITS - offset;
+      candidates &= (valid < WORD_BITS) ? ((std::uint64_t{1} << valid) - 1) : ~std::uint64_t{0};
+    }
+    if (candidates == 0) {
+      scanned += (word == WORDS - 1) ? (MINUTES_PER_WEEK - m) : (WORD_BITS - offset);
+      continue;
+    }
+    const std::uint32_t found = m + static_cast<std::uint32_t>(__builtin_ctzll(candidates));
+    std::uint32_t found_second{0};
+    if (minute_edge(found) && minute_active(found) == state) {
+      // same state at its first second, changes later within this minute
+      const std::uint64_t seconds = minute_seconds(found) ^ flip;
+      found_second = static_cast<std::uint32_t>(__builtin_ctzll(seconds & ALL_SECONDS_OF_MINUTE));
+    }
+    return ((found * 60 + found_second) + SECONDS_PER_WEEK - second_of_week) % SECONDS_PER_WEEK;
+  }
+  return NEVER;
+}
+
+std::uint32_t Schedule::now() {
+  return at(current_time_ms());
+}
+
+std::uint32_t Schedule::at(const std::int64_t& time_ms) {
+  const std::time_t time = static_cast<std::time_t>(time_ms / 1000);
+  const std::tm& time_tm = localtime_safe(time);
+  return static_cast<std::uint32_t>(((time_tm.tm_wday * 24 + time_tm.tm_hour) * 60 + time_tm.tm_min) * 60
+                                    + std::min(time_tm.tm_sec, 59));
+}
+
+bool operator==(const Schedule& l, const Schedule& r) {
+  if (&l == &r) {
+    return true;
+  }
+  return std::tie(l.active, l.edges, l.edge_seconds) == std::tie(r.active, r.edges, r.edge_seconds);
+}
+
+bool operator!=(const Schedule& l, const Schedule& r) {
+  return !(l == r);
+}
+
+[[nodiscard]] bool Schedule::minute_active(const std::uint32_t& minute) const {
+  return ((active[minute / WORD_BITS] >> (minute % WORD_BITS)) & 1U) != 0;
+}
+
+[[nodiscard]] bool Schedule::minute_edge(const std::uint32_t& minute) const {
+  return ((edges[minute / WORD_BITS] >> (minute % WORD_BITS)) & 1U) != 0;
+}
+
+[[nodiscard]] std::uint64_t Schedule::minute_seconds(const std::uint32_t& minute) const {
+  std::vector<std::pair<std::uint32_t, std::uint64_t>>::const_iterator found
+    = std::lower_bound(edge_seconds.begin(),
+                       edge_seconds.end(),
+                       minute,
+                       [](const std::pair<std::uint32_t, std::uint64_t>& edge, const std::uint32_t& m) {
+                         return edge.first < m;
+                       });
+  return found->second;
+}
+
+} // namespace ds
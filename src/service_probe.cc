@@ -0,0 +1,157 @@
+#include "do_not_sleep/service_probe.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "netinet/in.h"
+#include "poll.h"
+#include "sys/epoll.h"
+#include "sys/eventfd.h"
+#include "sys/socket.h"
+#include "unistd.h"
+
+#include "do_not_sleep/device_worker.h"
+#include "do_not_sleep/file.h"
+#include "do_not_sleep/probe.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+// a name server that does not answer within it is not taken for an answer yet, the resolution goes on meanwhile
+constexpr std::chrono::seconds RESOLVE_TIMEOUT{10};
+
+} // namespace
+
+ServiceProbe::ServiceProbe()
+  : timeout{0}
+  , resolver{"", DeviceWorker::Breaker{}}
+  , resolution_pending{false}
+  , next_address{0}
+  , stage{Stage::IDLE}
+  , deadline{std::chrono::steady_clock::time_point::max()} {
+}
+
+ServiceProbe::ServiceProbe(std::string service, const std::chrono::milliseconds& timeout)
+  : service{std::move(service)}
+  , timeout{timeout}
+  , events{epoll_create1(EPOLL_CLOEXEC)}
+  , resolved{std::make_shared<File>(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))}
+  , resolver{"resolve " + this->service,
+             DeviceWorker::Breaker{.timeout = RESOLVE_TIMEOUT,
+                                   .failures = 1,
+                                   .backoff = std::chrono::seconds::zero(),
+                                   .max_backoff = std::chrono::seconds::zero()}}
+  , resolving{std::make_shared<ResolvedService>()}
+  , resolution_pending{false}
+  // a numeric address needs no name server
+  , addresses{resolve_service(this->service, true)}
+  , next_address{0}
+  , stage{Stage::IDLE}
+  , deadline{std::chrono::steady_clock::time_point::max()} {
+  epoll_event event{.events = EPOLLIN, .data{.fd = resolved->fd()}};
+  if (!events.good() || !resolved->good() || epoll_ctl(events.fd(), EPOLL_CTL_ADD, resolved->fd(), &event) == -1) {
+    DS_LOGERR << "failed to set up probing " << this->service << ": " << strerror_safe(errno) << '\n';
+    events = File{};
+    return;
+  }
+  resolver.notify(resolved);
+}
+
+[[nodiscard]] bool ServiceProbe::good() const {
+  return events.good();
+}
+
+[[nodiscard]] int ServiceProbe::fd() const {
+  return events.fd();
+}
+
+[[nodiscard]] std::chrono::steady_clock::time_point ServiceProbe::next_deadline() const {
+  return deadline;
+}
+
+ServiceProbe::Result ServiceProbe::advance(const std::chrono::steady_clock::time_point& now) {
+  if (!good()) {
+    return Result::UNAVAILABLE;
+  }
+  if (resolution_pending && !resolver.running()) {
+    // `resolved` stays readable until it is read
+    std::uint64_t count{0};
+    if (read(resolved->fd(), &count, sizeof(count)) == -1 && errno != EAGAIN) {
+      DS_LOGERR << "failed to read the resolution of " << service << ": " << strerror_safe(errno) << '\n';
+    }
+    resolver.wait(now);
+    addresses = std::move(*resolving);
+    resolution_pending = false;
+  }
+  if (stage == Stage::IDLE) {
+    next_address = 0;
+    if (!addresses.addresses.empty()) {
+      return connect_next(now);
+    }
+    // e.g. no name server yet at boot, asked again each probe until it answers
+    if (!resolution_pending) {
+      if (resolver.submit([resolving = resolving, service = service]() { *resolving = resolve_service(service); })
+          != DeviceWorker::Result::DONE) {
+        return finish(false);
+      }
+      resolution_pending = true;
+    }
+    stage = Stage::RESOLVING;
+    deadline = now + RESOLVE_TIMEOUT;
+    return Result::PENDING;
+  }
+  if (stage == Stage::RESOLVING) {
+    if (resolution_pending) {
+      return now < deadline ? Result::PENDING : finish(false);
+    }
+    return connect_next(now);
+  }
+  pollfd connecting{.fd = connection.fd(), .events = POLLOUT, .revents = 0};
+  if (poll(&connecting, 1, 0) == 0) {
+    // still under way
+    return now < deadline ? Result::PENDING : connect_next(now);
+  }
+  int error{0};
+  socklen_t length = sizeof(error);
+  if (getsockopt(connection.fd(), SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+    return finish(true);
+  }
+  return connect_next(now);
+}
+
+ServiceProbe::Result ServiceProbe::connect_next(const std::chrono::steady_clock::time_point& now) {
+  while (next_address < addresses.addresses.size()) {
+    const auto& [address, length] = addresses.addresses[next_address++];
+    connection = File{socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)};
+    if (!connection.good()) {
+      continue;
+    }
+    if (connect(connection.fd(), reinterpret_cast<const sockaddr*>(&address), length) == 0) {
+      return finish(true);
+    }
+    epoll_event event{.events = EPOLLOUT, .data{.fd = connection.fd()}};
+    if (errno == EINPROGRESS && epoll_ctl(events.fd(), EPOLL_CTL_ADD, connection.fd(), &event) == 0) {
+      stage = Stage::CONNECTING;
+      deadline = now + timeout;
+      return Result::PENDING;
+    }
+  }
+  return finish(false);
+}
+
+ServiceProbe::Result ServiceProbe::finish(const bool& available) {
+  // also leaves `events`
+  connection = File{};
+  stage = Stage::IDLE;
+  deadline = std::chrono::steady_clock::time_point::max();
+  DS_PROBE3(service_probe, addresses.host.c_str(), addresses.port.c_str(), available);
+  return available ? Result::AVAILABLE : Result::UNAVAILABLE;
+}
+
+} // namespace ds
@@ -0,0 +1,224 @@
+#include "do_not_sleep/state_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "fcntl.h"
+#include "sys/file.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "unistd.h"
+
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+const char StateFile::MAGIC[8]{'D', 'S', 'S', 'T', 'A', 'T', 'E', '\0'};
+
+StateFile::StateFile() : fd(-1), layout(nullptr), contended(false) {
+}
+
+StateFile::StateFile(const std::filesystem::path& path) : fd(-1), layout(nullptr), contended(false) {
+  static_assert(std::is_standard_layout_v<Layout> && std::is_trivially_copyable_v<Layout>);
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    DS_LOGERR << "failed to open state file " << path << ": " << strerror_safe(errno) << '\n';
+    return;
+  }
+  // released when the file is closed, by a crash too
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+    contended = errno == EWOULDBLOCK;
+    if (!contended) {
+      DS_LOGERR << "failed to lock state file " << path << ": " << strerror_safe(errno) << '\n';
+    }
+    close(fd);
+    fd = -1;
+    return;
+  }
+  struct stat file_stat {};
+  if (fstat(fd, &file_stat) == -1) {
+    DS_LOGERR << "failed to stat state file " << path << ": " << strerror_safe(errno) << '\n';
+    close(fd);
+    fd = -1;
+    return;
+  }
+  bool fresh = (file_stat.st_size != sizeof(Layout));
+  if (fresh && (ftruncate(fd, 0) == -1 || ftruncate(fd, sizeof(Layout)) == -1)) {
+    DS_LOGERR << "failed to resize state file " << path << ": " << strerror_safe(errno) << '\n';
+    close(fd);
+    fd = -1;
+    return;
+  }
+  void* mapped = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    DS_LOGERR << "failed to map state file " << path << ": " << strerror_safe(errno) << '\n';
+    close(fd);
+    fd = -1;
+    return;
+  }
+  layout = static_cast<Layout*>(mapped);
+  if (!fresh
+      && (std::memcmp(layout->magic, MAGIC, sizeof(MAGIC)) != 0 || layout->version != VERSION
+          || layout->slot_count != SLOT_COUNT)) {
+    DS_LOGERR << "state file " << path << " is from another version, discarded.\n";
+    fresh = true;
+  }
+  if (fresh) {
+    std::memset(static_cast<void*>(layout), 0, sizeof(Layout));
+    layout->version = VERSION;
+    layout->slot_count = SLOT_COUNT;
+    // magic last, a torn header is discarded on the next start
+    std::memcpy(layout->magic, MAGIC, sizeof(MAGIC));
+  }
+}
+
+StateFile::StateFile(StateFile&& other) noexcept
+  : fd(std::exchange(other.fd, -1))
+  , layout(std::exchange(other.layout, nullptr))
+  , contended(other.contended) {
+}
+
+StateFile& StateFile::operator=(StateFile&& other) noexcept {
+  if (this != &other) {
+    if (layout != nullptr) {
+      munmap(layout, sizeof(Layout));
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+    fd = std::exchange(other.fd, -1);
+    layout = std::exchange(other.layout, nullptr);
+    contended = other.contended;
+  }
+  return *this;
+}
+
+StateFile::~StateFile() {
+  if (layout != nullptr) {
+    munmap(layout, sizeof(Layout));
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+[[nodiscard]] bool StateFile::good() const {
+  return layout != nullptr;
+}
+
+[[nodiscard]] bool StateFile::in_use() const {
+  return contended;
+}
+
+std::size_t StateFile::slot(const std::filesystem::path& dir) {
+  const std::string& dir_str = dir.native();
+  if (!good() || dir_str.empty() || dir_str.size() >= DIR_LENGTH) {
+    return NO_SLOT;
+  }
+  std::size_t free_slot = NO_SLOT;
+  for (std::size_t i = 0; i < SLOT_COUNT; i++) {
+    const char* slot_dir = layout->slots[i].dir;
+    if (slot_dir[0] == '\0') {
+      if (free_slot == NO_SLOT) {
+        free_slot = i;
+      }
+      continue;
+    }
+    if (std::strncmp(slot_dir, dir_str.c_str(), DIR_LENGTH) == 0) {
+      return i;
+    }
+  }
+  if (free_slot == NO_SLOT) {
+    DS_LOGERR << "state file is full, state of " << dir << " will not be kept.\n";
+    return NO_SLOT;
+  }
+  Slot& claimed = layout->slots[free_slot];
+  std::memset(static_cast<void*>(claimed.records), 0, sizeof(claimed.records));
+  std::memcpy(claimed.dir, dir_str.c_str(), dir_str.size() + 1);
+  return free_slot;
+}
+
+bool StateFile::load(const std::size_t& slot, DeviceState& out_state) const {
+  if (!good() || slot >= SLOT_COUNT) {
+    return false;
+  }
+  const Record* newest = nullptr;
+  for (const Record& record : layout->slots[slot].records) {
+    if (valid(record) && (newest == nullptr || record.seq > newest->seq)) {
+      newest = &record;
+    }
+  }
+  if (newest == nullptr) {
+    return false;
+  }
+  out_state = newest->state;
+  return true;
+}
+
+void StateFile::store(const std::size_t& slot, const DeviceState& state) {
+  if (!good() || slot >= SLOT_COUNT) {
+    return;
+  }
+  Record* records = layout->slots[slot].records;
+  const std::uint64_t seq0 = valid(records[0]) ? records[0].seq : 0;
+  const std::uint64_t seq1 = valid(records[1]) ? records[1].seq : 0;
+  // overwrite the older copy, the newer one stays intact until this store is complete
+  Record& record = (seq0 <= seq1) ? records[0] : records[1];
+  const std::uint64_t seq = std::max(seq0, seq1) + 1;
+  __atomic_store_n(&record.seq, 0, __ATOMIC_RELEASE);
+  record.state = state;
+  record.checksum = checksum(seq, record.state);
+  __atomic_store_n(&record.seq, seq, __ATOMIC_RELEASE);
+}
+
+std::uint64_t StateFile::checksum(const std::uint64_t& seq, const DeviceState& state) {
+  // FNV-1a
+  std::uint64_t hash{0xcbf29ce484222325};
+  const auto feed = [&hash](const void* data, const std::size_t& size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+  };
+  const auto feed_value = [&feed](const auto& value) { feed(&value, sizeof(value)); };
+  // field by field, the padding bytes of the struct are indeterminate
+  feed_value(seq);
+  feed_value(state.last_keepalive_ms);
+  feed_value(state.awake_until_ms);
+  feed_value(state.last_activity_ms);
+  feed_value(state.last_reads);
+  feed_value(state.last_writes);
+  const IOEstimator::State& estimator = state.estimator;
+  feed_value(estimator.last.read_ios);
+  feed_value(estimator.last.read_sectors);
+  feed_value(estimator.last.write_ios);
+  feed_value(estimator.last.write_sectors);
+  feed_value(estimator.last_ms);
+  feed_value(estimator.updates);
+  feed_value(estimator.read_sectors);
+  feed_value(estimator.write_sectors);
+  feed_value(estimator.ios);
+  feed_value(estimator.sector_floor);
+  feed_value(estimator.sector_spread);
+  feed_value(estimator.io_floor);
+  feed_value(estimator.io_spread);
+  feed_value(estimator.measured);
+  feed_value(estimator.active);
+  return hash;
+}
+
+bool StateFile::valid(const Record& record) {
+  return record.seq != 0 && record.checksum == checksum(record.seq, record.state);
+}
+
+} // namespace ds
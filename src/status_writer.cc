@@ -0,0 +1,163 @@
+#include "do_not_sleep/status_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "fcntl.h"
+#include "sys/file.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "sys/types.h"
+#include "unistd.h"
+
+#include "do_not_sleep/status_page.h"
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+void clear(status::Device& device) {
+  std::memset(device.dir, 0, status::DIR_LENGTH);
+  device.last_keepalive_ms.store(0, std::memory_order_relaxed);
+  device.awake_until_ms.store(0, std::memory_order_relaxed);
+  device.last_activity_ms.store(0, std::memory_order_relaxed);
+  device.last_keepalive_latency_ns.store(0, std::memory_order_relaxed);
+}
+
+} // namespace
+
+StatusWriter::StatusWriter() : fd(-1), page(nullptr), contended(false) {
+}
+
+StatusWriter::StatusWriter(const std::string& name) : fd(-1), page(nullptr), contended(false) {
+  fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    DS_LOGERR << "failed to open status page " << name << ": " << strerror_safe(errno) << '\n';
+    return;
+  }
+  // before the page is cleared, it may be another instance's; released when it is closed, by a crash too
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+    contended = errno == EWOULDBLOCK;
+    if (!contended) {
+      DS_LOGERR << "failed to lock status page " << name << ": " << strerror_safe(errno) << '\n';
+    }
+    close(fd);
+    fd = -1;
+    return;
+  }
+  // never shrunk, a reader with the page mapped would get SIGBUS
+  struct stat page_stat {};
+  void* mapped = MAP_FAILED;
+  if (fstat(fd, &page_stat) == 0
+      && (page_stat.st_size >= static_cast<off_t>(sizeof(status::Page)) || ftruncate(fd, sizeof(status::Page)) == 0)) {
+    mapped = mmap(nullptr, sizeof(status::Page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (mapped == MAP_FAILED) {
+    DS_LOGERR << "failed to map status page " << name << ": " << strerror_safe(errno) << '\n';
+    close(fd);
+    fd = -1;
+    return;
+  }
+  page = static_cast<status::Page*>(mapped);
+  const bool valid = std::memcmp(page->magic, status::MAGIC, sizeof(status::MAGIC)) == 0
+                     && page->version == status::VERSION;
+  if (valid) {
+    // left by a previous daemon and maybe read right now, devices are cleared under their seqlock
+    page->device_count.store(0, std::memory_order_release);
+    for (status::Device& device : page->devices) {
+      const std::uint32_t seq = device.seq.load(std::memory_order_relaxed);
+      device.seq.store(seq | 1U, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      clear(device);
+      device.seq.store((seq | 1U) + 1, std::memory_order_release);
+    }
+  } else {
+    // new or foreign, readers ignore it until the magic is in place
+    std::memset(page->magic, 0, sizeof(page->magic));
+    std::atomic_thread_fence(std::memory_order_release);
+    page->version = status::VERSION;
+    page->device_count.store(0, std::memory_order_relaxed);
+    for (status::Device& device : page->devices) {
+      device.seq.store(0, std::memory_order_relaxed);
+      clear(device);
+    }
+  }
+  page->writer_pid.store(getpid(), std::memory_order_release);
+  if (!valid) {
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(page->magic, status::MAGIC, sizeof(status::MAGIC));
+  }
+}
+
+StatusWriter::StatusWriter(StatusWriter&& other) noexcept
+  : fd(std::exchange(other.fd, -1))
+  , page(std::exchange(other.page, nullptr))
+  , contended(other.contended) {
+}
+
+StatusWriter& StatusWriter::operator=(StatusWriter&& other) noexcept {
+  if (this != &other) {
+    release();
+    fd = std::exchange(other.fd, -1);
+    page = std::exchange(other.page, nullptr);
+    contended = other.contended;
+  }
+  return *this;
+}
+
+StatusWriter::~StatusWriter() {
+  release();
+}
+
+[[nodiscard]] bool StatusWriter::good() const {
+  return page != nullptr;
+}
+
+[[nodiscard]] bool StatusWriter::in_use() const {
+  return contended;
+}
+
+void StatusWriter::set_device_count(const std::size_t& count) {
+  if (page != nullptr) {
+    page->device_count.store(std::min(count, status::MAX_DEVICES), std::memory_order_release);
+  }
+}
+
+void StatusWriter::publish(const std::size_t& index, const status::DeviceSnapshot& snapshot) {
+  if (page == nullptr || index >= status::MAX_DEVICES) {
+    return;
+  }
+  status::Device& device = page->devices[index];
+  const std::uint32_t seq = device.seq.load(std::memory_order_relaxed);
+  device.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(device.dir, snapshot.dir, status::DIR_LENGTH);
+  device.dir[status::DIR_LENGTH - 1] = '\0';
+  device.last_keepalive_ms.store(snapshot.last_keepalive_ms, std::memory_order_relaxed);
+  device.awake_until_ms.store(snapshot.awake_until_ms, std::memory_order_relaxed);
+  device.last_activity_ms.store(snapshot.last_activity_ms, std::memory_order_relaxed);
+  device.last_keepalive_latency_ns.store(snapshot.last_keepalive_latency_ns, std::memory_order_relaxed);
+  device.seq.store(seq + 2, std::memory_order_release);
+}
+
+void StatusWriter::release() {
+  if (page != nullptr) {
+    page->writer_pid.store(0, std::memory_order_release);
+    munmap(page, sizeof(status::Page));
+    page = nullptr;
+  }
+  if (fd != -1) {
+    // the lock goes with it, after the pid is cleared
+    close(fd);
+    fd = -1;
+  }
+}
+
+} // namespace ds
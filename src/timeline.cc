@@ -0,0 +1,234 @@
+#include "do_not_sleep/timeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "poll.h"
+#include "sys/eventfd.h"
+#include "sys/signalfd.h"
+#include "unistd.h"
+
+#include "do_not_sleep/util.h"
+
+namespace ds {
+
+namespace {
+
+std::uint32_t current_tid() {
+  thread_local const std::uint32_t tid = static_cast<std::uint32_t>(gettid());
+  return tid;
+}
+
+std::int64_t to_ns(const Timeline::TimePoint& t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+// as a JSON string literal
+void write_json_string(std::ostream& out, const std::string_view& str) {
+  out << '"';
+  for (const char& c : str) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+      out << escaped;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+// nanoseconds as microseconds with 3 decimals, trace events are in microseconds
+void write_us(std::ostream& out, const std::int64_t& ns) {
+  out << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000 << std::setfill(' ');
+}
+
+} // namespace
+
+Timeline::Span::Span(Timeline& timeline, const char* name, std::string_view detail)
+  : timeline(timeline)
+  , name(name)
+  , detail(detail)
+  , start(std::chrono::steady_clock::now()) {
+}
+
+Timeline::Span::~Span() {
+  timeline.record(name, detail, start, std::chrono::steady_clock::now());
+}
+
+Timeline::Timeline(const std::size_t& capacity) : slots(capacity), head(0) {
+  for (Slot& slot : slots) {
+    slot.seq.store(0, std::memory_order_relaxed);
+  }
+}
+
+void Timeline::record(const char* name,
+                      const std::string_view& detail,
+                      const TimePoint& start,
+                      const TimePoint& end) {
+  if (slots.empty()) {
+    return;
+  }
+  const std::uint64_t n = head.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = slots[n % slots.size()];
+  slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.name = name;
+  slot.start_ns = to_ns(start);
+  slot.end_ns = to_ns(end);
+  slot.tid = current_tid();
+  const std::size_t length = std::min(detail.size(), DETAIL_LENGTH);
+  std::memcpy(slot.detail, detail.data(), length);
+  slot.detail[length] = '\0';
+  slot.seq.store(2 * n + 2, std::memory_order_release);
+}
+
+bool Timeline::dump(const std::filesystem::path& path) const {
+  const std::uint64_t end = head.load(std::memory_order_acquire);
+  const std::uint64_t begin = end > slots.size() ? end - slots.size() : 0;
+  const std::filesystem::path tmp_path = path.string() + ".tmp";
+  std::ofstream out{tmp_path, std::ios::trunc};
+  if (!out) {
+    DS_LOGERR << "failed to open " << tmp_path << ".\n";
+    return false;
+  }
+  const pid_t pid = getpid();
+  out << R"({"displayTimeUnit":"ms","traceEvents":[)";
+  bool first{true};
+  for (std::uint64_t n = begin; n < end; n++) {
+    const Slot& slot = slots[n % slots.size()];
+    const std::uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != 2 * n + 2) {
+      // still being written, or already overwritten
+      continue;
+    }
+    const char* name = slot.name;
+    const std::int64_t start_ns = slot.start_ns;
+    const std::int64_t end_ns = slot.end_ns;
+    const std::uint32_t tid = slot.tid;
+    char detail[DETAIL_LENGTH + 1];
+    std::memcpy(detail, slot.detail, sizeof(detail));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) {
+      continue;
+    }
+    detail[DETAIL_LENGTH] = '\0';
+    out << (first ? "" : ",") << "\n{\"name\":";
+    write_json_string(out, name);
+    // complete events, microseconds
+    out << R"(,"cat":"ds","ph":"X","pid":)" << pid << ",\"tid\":" << tid << ",\"ts\":";
+    write_us(out, start_ns);
+    out << ",\"dur\":";
+    write_us(out, end_ns - start_ns);
+    if (detail[0] != '\0') {
+      out << ",\"args\":{\"detail\":";
+      write_json_string(out, detail);
+      out << '}';
+    }
+    out << '}';
+    first = false;
+  }
+  out << "\n]}\n";
+  out.close();
+  if (!out) {
+    DS_LOGERR << "failed to write " << tmp_path << ".\n";
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    DS_LOGERR << "failed to rename " << tmp_path << " to " << path << ": " << ec.message() << '\n';
+    return false;
+  }
+  return true;
+}
+
+TimelineDumper::TimelineDumper(std::shared_ptr<const Timeline> timeline, std::filesystem::path path)
+  : signal_fd(-1)
+  , stop_fd(eventfd(0, EFD_CLOEXEC)) {
+  sigset_t mask{};
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR1);
+  // delivered to the signalfd only, instead of killing the process
+  if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+    DS_LOGERR << "failed to block SIGUSR1.\n";
+    return;
+  }
+  signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+  if (signal_fd == -1 || stop_fd == -1) {
+    DS_LOGERR << "failed to listen to SIGUSR1: " << strerror_safe(errno) << '\n';
+    return;
+  }
+  thread = std::thread{loop, signal_fd, stop_fd, std::move(timeline), std::move(path)};
+}
+
+TimelineDumper::~TimelineDumper() {
+  if (thread.joinable()) {
+    const std::uint64_t one{1};
+    if (write(stop_fd, &one, sizeof(one)) == sizeof(one)) {
+      thread.join();
+    } else {
+      thread.detach();
+    }
+  }
+  if (signal_fd != -1) {
+    close(signal_fd);
+  }
+  if (stop_fd != -1) {
+    close(stop_fd);
+  }
+}
+
+[[nodiscard]] bool TimelineDumper::good() const {
+  return thread.joinable();
+}
+
+void TimelineDumper::loop(const int& signal_fd,
+                          const int& stop_fd,
+                          const std::shared_ptr<const Timeline>& timeline,
+                          const std::filesystem::path& path) {
+  while (true) {
+    pollfd fds[2]{
+      {.fd = signal_fd, .events = POLLIN, .revents = 0},
+      {.fd = stop_fd,   .events = POLLIN, .revents = 0}
+    };
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      DS_LOGERR << "failed to wait for SIGUSR1: " << strerror_safe(errno) << '\n';
+      return;
+    }
+    if ((fds[1].revents & POLLIN) != 0) {
+      return;
+    }
+    signalfd_siginfo info{};
+    if (read(signal_fd, &info, sizeof(info)) != sizeof(info)) {
+      continue;
+    }
+    if (timeline->dump(path)) {
+      DS_LOG << "timeline dumped to " << path << ".\n";
+    }
+  }
+}
+
+} // namespace ds
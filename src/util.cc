@@ -1,15 +1,20 @@
 #include "do_not_sleep/util.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <cstdint>
 #include <ctime>
-#include <iomanip>
-#include <iostream>
+#include <filesystem>
 #include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include "netdb.h"
 #include "netinet/in.h"
@@ -17,6 +22,8 @@
 #include "sys/time.h"
 #include "unistd.h"
 
+#include "do_not_sleep/probe.h"
+
 namespace ds {
 
 std::int64_t current_time_ms() {
@@ -28,10 +35,10 @@ std::int64_t current_time_ms(const std::chrono::system_clock::time_point& t) {
 }
 
 const std::tm& localtime_safe(const std::time_t& t) {
-  static std::mutex localtime_mutex;
-  std::unique_lock<std::mutex> localtime_lock(localtime_mutex);
-  /* NOLINTNEXTLINE(concurrency-mt-unsafe) */
-  return *std::localtime(&t);
+  // localtime(3) would also reload the time zone on every call, allocating each time
+  thread_local std::tm result{};
+  localtime_r(&t, &result);
+  return result;
 }
 
 std::optional<std::string> getenv_safe(std::string_view key) {
@@ -45,34 +52,50 @@ std::optional<std::string> getenv_safe(std::string_view key) {
   return value;
 }
 
-bool service_available(const std::string_view& service, const std::int64_t& time_out) {
+std::string strerror_safe(const int& errnum) {
+  char buf[256]{};
+  // GNU strerror_r, may return a static string instead of filling buf
+  return strerror_r(errnum, buf, sizeof(buf));
+}
+
+ResolvedService resolve_service(const std::string_view& service, const bool& numeric) {
+  ResolvedService result;
   std::size_t colon_pos = service.find(':');
   if (colon_pos == std::string::npos) {
     DS_LOGERR << "failed to parse service `" << service << "`, it should be `<IP>:<PORT>`\n";
-    return false;
+    return result;
   }
-  std::string ip{service.substr(0, colon_pos)};
-  std::string port{service.substr(colon_pos + 1)};
-  int ret{0};
+  result.host = service.substr(0, colon_pos);
+  result.port = service.substr(colon_pos + 1);
   addrinfo hints{};
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
-  hints.ai_flags = 0;
+  hints.ai_flags = numeric ? AI_NUMERICHOST | AI_NUMERICSERV : 0;
   hints.ai_protocol = IPPROTO_TCP;
-  addrinfo* result{nullptr};
-  ret = getaddrinfo(ip.c_str(), port.c_str(), &hints, &result);
+  addrinfo* addresses{nullptr};
+  const int ret = getaddrinfo(result.host.c_str(), result.port.c_str(), &hints, &addresses);
   if (ret != 0) {
-    DS_LOGERR << "failed to resolve service: " << gai_strerror(ret) << '\n';
-    return false;
+    if (!numeric || ret != EAI_NONAME) {
+      DS_LOGERR << "failed to resolve service: " << gai_strerror(ret) << '\n';
+    }
+    return result;
   }
+  for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+    std::pair<sockaddr_storage, socklen_t>& resolved = result.addresses.emplace_back(sockaddr_storage{}, 0);
+    std::memcpy(&resolved.first, address->ai_addr, address->ai_addrlen);
+    resolved.second = address->ai_addrlen;
+  }
+  freeaddrinfo(addresses);
+  return result;
+}
 
+bool service_available(const ResolvedService& service, const std::int64_t& time_out) {
   timeval timeout{};
   timeout.tv_sec = time_out / 1000;
-  timeout.tv_usec = time_out % 1000;
-  int socket_fd{0};
-  addrinfo* result_ptr{nullptr};
-  for (result_ptr = result; result_ptr != nullptr; result_ptr = result_ptr->ai_next) {
-    socket_fd = socket(result_ptr->ai_family, result_ptr->ai_socktype, result_ptr->ai_protocol);
+  timeout.tv_usec = (time_out % 1000) * 1000;
+  bool connected{false};
+  for (const std::pair<sockaddr_storage, socklen_t>& address : service.addresses) {
+    const int socket_fd = socket(address.first.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
     if (socket_fd == -1) {
       continue;
     }
@@ -84,29 +107,116 @@ bool service_available(const std::string_view& service, const std::int64_t& time
       DS_LOGERR << "failed to set timeout\n";
     }
 
-    if (connect(socket_fd, result_ptr->ai_addr, result_ptr->ai_addrlen) != -1) {
-      // connected
+    connected = connect(socket_fd, reinterpret_cast<const sockaddr*>(&address.first), address.second) != -1;
+    close(socket_fd);
+    if (connected) {
       break;
     }
-
-    // failed
-    close(socket_fd);
   }
 
-  freeaddrinfo(result);
-  return result_ptr != nullptr;
+  DS_PROBE3(service_probe, service.host.c_str(), service.port.c_str(), connected);
+  return connected;
 }
 
-std::ostream& log_error(const std::string_view& file, const std::uint_fast32_t& line, const bool& err) {
-  std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+bool service_available(const std::string_view& service, const std::int64_t& time_out) {
+  return service_available(resolve_service(service), time_out);
+}
+
+LogLine::LogLine(const std::string_view& file, const std::uint_fast32_t& line, const bool& err, const bool& muted)
+  : out_fd{muted ? -1 : (err ? STDERR_FILENO : STDOUT_FILENO)}
+  , size{0} {
+  const std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
   const std::tm& now_time_tm = localtime_safe(std::chrono::system_clock::to_time_t(now));
-  std::int_fast64_t now_ms
+  const std::int_fast64_t now_ms
     = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
-  std::ostream& out = (err ? std::cerr : std::cout);
-  const char fill_prev = out.fill();
   /* [YYYY-MM-DDThh:mm:ss.sss](__FILE__:__LINE__): MSG */
-  return out << '[' << std::put_time(&now_time_tm, "%FT%T") << '.' << std::setfill('0') << std::setw(3) << now_ms
-             << std::setfill(fill_prev) << "](" << file << ':' << line << "): ";
+  buf[size++] = '[';
+  size += std::strftime(buf + size, CAPACITY - size, "%FT%T", &now_time_tm);
+  const char ms[]{'.',
+                  static_cast<char>('0' + now_ms / 100),
+                  static_cast<char>('0' + now_ms / 10 % 10),
+                  static_cast<char>('0' + now_ms % 10)};
+  append(ms, sizeof(ms));
+  *this << "](" << file << ':' << line << "): ";
+}
+
+LogLine::~LogLine() {
+  flush();
+}
+
+LogLine& LogLine::operator<<(const std::string_view& str) {
+  append(str.data(), str.size());
+  return *this;
+}
+
+LogLine& LogLine::operator<<(const std::string& str) {
+  append(str.data(), str.size());
+  return *this;
+}
+
+LogLine& LogLine::operator<<(const char* str) {
+  append(str, std::strlen(str));
+  return *this;
+}
+
+LogLine& LogLine::operator<<(const char& c) {
+  append(&c, 1);
+  return *this;
+}
+
+LogLine& LogLine::operator<<(const bool& b) {
+  return *this << (b ? '1' : '0');
+}
+
+LogLine& LogLine::operator<<(const double& value) {
+  // `%g`, as iostreams print it by default
+  char digits[32];
+  const int length = std::snprintf(digits, sizeof(digits), "%g", value);
+  append(digits, static_cast<std::size_t>(std::clamp(length, 0, static_cast<int>(sizeof(digits)) - 1)));
+  return *this;
+}
+
+LogLine& LogLine::operator<<(const std::filesystem::path& path) {
+  // as `std::quoted`
+  *this << '"';
+  for (const char& c : path.native()) {
+    if (c == '"' || c == '\\') {
+      *this << '\\';
+    }
+    *this << c;
+  }
+  return *this << '"';
+}
+
+void LogLine::append(const char* data, std::size_t length) {
+  while (length > 0) {
+    if (size == CAPACITY) {
+      flush();
+    }
+    const std::size_t n = std::min(length, CAPACITY - size);
+    std::memcpy(buf + size, data, n);
+    size += n;
+    data += n;
+    length -= n;
+  }
+}
+
+void LogLine::flush() {
+  if (out_fd == -1) {
+    size = 0;
+    return;
+  }
+  for (std::size_t written = 0; written < size;) {
+    const ssize_t n = write(out_fd, buf + written, size - written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    written += static_cast<std::size_t>(n);
+  }
+  size = 0;
 }
 
 } // namespace ds
@@ -0,0 +1,130 @@
+// Counts heap allocations of all threads with a replaced `operator new` while a policy runs scans and keepalive
+// rounds, once it is set up none are expected:
+//
+//   allocations <policy>
+//
+// Exits 77 (skipped) if the policy cannot run here.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "driver.h"
+
+namespace {
+
+constexpr int SKIP{77};
+constexpr int ROUNDS{20};
+
+std::atomic<std::size_t> allocations{0};
+
+void* allocate(const std::size_t& size, const std::size_t& alignment = alignof(std::max_align_t)) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return alignment > alignof(std::max_align_t)
+           ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+           : std::malloc(size == 0 ? 1 : size);
+}
+
+} // namespace
+
+void* operator new(std::size_t size) {
+  if (void* pointer = allocate(size)) {
+    return pointer;
+  }
+  throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  if (void* pointer = allocate(size, static_cast<std::size_t>(alignment))) {
+    return pointer;
+  }
+  throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t& /*unused*/) noexcept {
+  return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& /*unused*/) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t /*unused*/) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t /*unused*/) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t /*unused*/) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t /*unused*/) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t /*unused*/, std::align_val_t /*unused*/) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t /*unused*/, std::align_val_t /*unused*/) noexcept {
+  std::free(pointer);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::fprintf(stderr, "usage: %s <policy>\n", argv[0]);
+    return 2;
+  }
+  ds::test::PolicySetup setup{argv[1]};
+  if (!setup.good()) {
+    std::fprintf(stderr, "skipped: %s\n", setup.skipped.c_str());
+    return SKIP;
+  }
+  ds::test::Driver driver{setup.config};
+  // what the host lacks is told by `setup`, past it the policy has to come up
+  if (!driver.open()) {
+    std::fprintf(stderr, "%s: failed to open\n", argv[1]);
+    return 1;
+  }
+  if (driver.target_count() != 2) {
+    std::fprintf(stderr, "%s: %zu target(s) instead of 2\n", argv[1], driver.target_count());
+    return 1;
+  }
+  // the first look, first keepalives (starting the workers) and first scans set things up
+  for (int i = 0; i < 2; i++) {
+    if (!driver.round() || !driver.scan()) {
+      return 1;
+    }
+  }
+  allocations.store(0);
+  for (int i = 0; i < ROUNDS; i++) {
+    if (!driver.round() || !driver.scan()) {
+      return 1;
+    }
+  }
+  const std::size_t count = allocations.load();
+  std::printf("%zu allocation(s) in %d rounds and scans\n", count, ROUNDS);
+  return count == 0 ? 0 : 1;
+}
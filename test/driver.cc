@@ -0,0 +1,253 @@
+#include "driver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "arpa/inet.h"
+#include "netinet/in.h"
+#include "poll.h"
+#include "sys/mman.h"
+#include "sys/mount.h"
+#include "sys/socket.h"
+#include "unistd.h"
+
+#include "do_not_sleep/cgroup_io.h"
+#include "do_not_sleep/hms.h"
+#include "do_not_sleep/schedule.h"
+#include "do_not_sleep/util.h"
+
+namespace ds::test {
+
+namespace {
+
+// a socket listening on 127.0.0.1, its port in `port`
+File listen_local(std::uint16_t& port) {
+  File listener{socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if (!listener.good() || bind(listener.fd(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1
+      || listen(listener.fd(), SOMAXCONN) == -1
+      || getsockname(listener.fd(), reinterpret_cast<sockaddr*>(&address), &length) == -1) {
+    return File{};
+  }
+  port = ntohs(address.sin_port);
+  return listener;
+}
+
+// a connection to 127.0.0.1:`port`
+File connect_local(const std::uint16_t& port) {
+  File client{socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if (!client.good() || connect(client.fd(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+    return File{};
+  }
+  return client;
+}
+
+// the cgroup v2 of this process, e.g. `/sys/fs/cgroup/user.slice/x`, empty if there is none
+std::filesystem::path own_cgroup() {
+  std::string cgroups;
+  if (!File::read_file("/proc/self/cgroup", cgroups)) {
+    return {};
+  }
+  // `0::/user.slice/x` is the unified hierarchy
+  const std::size_t begin = cgroups.find("0::/");
+  if (begin == std::string::npos || (begin != 0 && cgroups[begin - 1] != '\n')) {
+    return {};
+  }
+  const std::size_t end = cgroups.find('\n', begin);
+  return CgroupIO::CGROUP_ROOT / cgroups.substr(begin + 4, end == std::string::npos ? end : end - begin - 4);
+}
+
+} // namespace
+
+PolicySetup::PolicySetup(const std::string& policy) {
+  std::string work_template = (std::filesystem::temp_directory_path() / "do-not-sleep-test.XXXXXX").string();
+  if (mkdtemp(work_template.data()) == nullptr) {
+    skipped = "no scratch dir";
+    return;
+  }
+  work = work_template;
+  std::error_code error;
+  std::filesystem::create_directory(work / "a", error);
+  std::filesystem::create_directory(work / "b", error);
+
+  const Schedule always{{Schedule::Rule{.days = Schedule::EVERYDAY, .start = HMS::UNSET, .end = HMS::UNSET}}, {}};
+  config.dirs = {work / "a", work / "b"};
+  // long enough that nothing is due between rounds
+  config.interval = std::chrono::seconds{3600};
+  config.scan_frequency = std::chrono::seconds{1};
+  config.keep_awake = std::chrono::seconds{3600};
+  config.trigger = Config::Trigger::POLL;
+  // whatever the device of the scratch dir is, e.g. tmpfs or a solid state disk
+  for (Config::ClassPolicy& class_policy : config.device_classes) {
+    class_policy = {.keepalive = Config::Keepalive::WRITE, .interval = std::chrono::seconds::zero()};
+  }
+  // other I/O on the disk must not skip a round
+  config.skip_active = false;
+  config.state_file = work / "state";
+  config.history_dir = work / "history";
+  config.history_retention = std::chrono::hours{24};
+  config.status_page = "/do_not_sleep_test_" + std::to_string(getpid());
+
+  if (policy == "time_range") {
+    config.policy = Config::Policy::TIME_RANGE;
+    config.time_range = {HMS::UNSET, HMS::UNSET};
+    config.schedule = always;
+  } else if (policy == "schedule") {
+    config.policy = Config::Policy::SCHEDULE;
+    config.schedule = always;
+  } else if (policy == "monitor_io") {
+    // samples the disk of each mount point; I/O of others on it must not count
+    config.activity.sectors_per_second = std::numeric_limits<double>::infinity();
+    config.activity.ios = std::numeric_limits<double>::infinity();
+    for (const std::filesystem::path& dir : config.dirs) {
+      if (mount(dir.c_str(), dir.c_str(), nullptr, MS_BIND, nullptr) == -1) {
+        skipped = "cannot bind mount the dirs";
+        return;
+      }
+      mounted.emplace_back(dir);
+    }
+    config.policy = Config::Policy::MONITOR_IO;
+  } else if (policy == "monitor_io_fanotify") {
+    config.policy = Config::Policy::MONITOR_IO;
+    config.trigger = Config::Trigger::FANOTIFY;
+  } else if (policy == "service_available") {
+    std::uint16_t port{0};
+    if (!sockets.emplace_back(listen_local(port)).good()) {
+      skipped = "no loopback socket";
+      return;
+    }
+    config.policy = Config::Policy::SERVICE_AVAILABLE;
+    config.service = "127.0.0.1:" + std::to_string(port);
+  } else if (policy == "cgroup_io") {
+    // an empty one, the keepalives of this process would count as I/O of its own cgroup
+    const std::filesystem::path parent = own_cgroup();
+    if (!parent.empty() && std::filesystem::create_directory(parent / work.filename(), error)) {
+      cgroup = parent / work.filename();
+    }
+    if (cgroup.empty() || !std::filesystem::exists(cgroup / "io.stat", error)) {
+      skipped = "no cgroup v2 io.stat";
+      return;
+    }
+    config.policy = Config::Policy::CGROUP_IO;
+    config.cgroups = {cgroup};
+  } else if (policy == "process_present") {
+    std::string comm;
+    if (!File::read_file("/proc/self/comm", comm) || comm.empty()) {
+      skipped = "no /proc/self/comm";
+      return;
+    }
+    config.policy = Config::Policy::PROCESS_PRESENT;
+    config.processes = {comm.substr(0, comm.find('\n'))};
+  } else if (policy == "local_connection") {
+    std::uint16_t port{0};
+    if (!sockets.emplace_back(listen_local(port)).good() || !sockets.emplace_back(connect_local(port)).good()) {
+      skipped = "no loopback connection";
+      return;
+    }
+    config.policy = Config::Policy::LOCAL_CONNECTION;
+    config.ports = {port};
+  } else {
+    skipped = "unknown policy " + policy;
+  }
+}
+
+PolicySetup::~PolicySetup() {
+  for (const std::filesystem::path& dir : mounted) {
+    umount2(dir.c_str(), MNT_DETACH);
+  }
+  if (!cgroup.empty()) {
+    rmdir(cgroup.c_str());
+  }
+  if (!config.status_page.empty()) {
+    shm_unlink(config.status_page.c_str());
+  }
+  if (!work.empty()) {
+    std::error_code error;
+    std::filesystem::remove_all(work, error);
+  }
+}
+
+[[nodiscard]] bool PolicySetup::good() const {
+  return skipped.empty();
+}
+
+const std::vector<std::string> PolicySetup::POLICIES{"time_range",
+                                                     "schedule",
+                                                     "monitor_io",
+                                                     "monitor_io_fanotify",
+                                                     "service_available",
+                                                     "cgroup_io",
+                                                     "process_present",
+                                                     "local_connection"};
+
+Driver::Driver(Config config) : DoNotSleep(std::move(config)) {
+}
+
+bool Driver::scan() {
+  deadline = std::chrono::steady_clock::time_point{};
+  return process_events() && settle();
+}
+
+bool Driver::round() {
+  const std::int64_t now_ms = current_time_ms();
+  for (Target& target : targets) {
+    target.state.last_keepalive_ms = 0;
+    target.state.awake_until_ms
+      = now_ms + std::chrono::duration_cast<std::chrono::milliseconds>(config.keep_awake).count();
+    target.activity.active_ms = 0;
+  }
+  for (MonitorCtx& block : monitor_blocks) {
+    // ticks on this scan
+    block.time_until_next_ticktock = config.scan_frequency;
+    block.awake_time_remaining = config.keep_awake;
+  }
+  for (AccessCtx& block : access_blocks) {
+    block.ticking = true;
+  }
+  for (std::pair<std::size_t, std::int64_t>& block : cgroup_blocks) {
+    block.second = 0;
+  }
+  return scan();
+}
+
+[[nodiscard]] std::size_t Driver::target_count() const {
+  return targets.size();
+}
+
+bool Driver::settle() {
+  bool running{true};
+  while (running && service_probe.next_deadline() != std::chrono::steady_clock::time_point::max()) {
+    const std::chrono::milliseconds left
+      = std::chrono::ceil<std::chrono::milliseconds>(service_probe.next_deadline() - std::chrono::steady_clock::now());
+    pollfd events_pollfd{.fd = fd(), .events = POLLIN, .revents = 0};
+    poll(&events_pollfd, 1, static_cast<int>(std::clamp<std::chrono::milliseconds::rep>(left.count(), 0, INT_MAX)));
+    running = process_events();
+  }
+  bool pending{false};
+  for (Target& target : targets) {
+    if (target.keepalive_deadline != std::chrono::steady_clock::time_point{}) {
+      target.worker.wait(target.keepalive_deadline);
+      pending = true;
+    }
+  }
+  return running && (!pending || process_events());
+}
+
+} // namespace ds::test
@@ -0,0 +1,68 @@
+#ifndef DO_NOT_SLEEP_TEST_DRIVER_H_
+#define DO_NOT_SLEEP_TEST_DRIVER_H_
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "do_not_sleep/config.h"
+#include "do_not_sleep/ds.h"
+#include "do_not_sleep/file.h"
+
+namespace ds::test {
+
+// What a policy needs to keep its dirs awake right away: a scratch dir with two dirs, the state file and history in
+// it, and whatever the policy watches (mount points, a listening socket, a connection, this process).
+class PolicySetup {
+public:
+  PolicySetup() = delete;
+  // e.g. `monitor_io`, `monitor_io_fanotify`, `service_available`
+  explicit PolicySetup(const std::string& policy);
+  PolicySetup(const PolicySetup&) = delete;
+  PolicySetup(PolicySetup&&) noexcept = delete;
+  PolicySetup& operator=(const PolicySetup&) = delete;
+  PolicySetup& operator=(PolicySetup&&) noexcept = delete;
+
+  // removes the scratch dir
+  virtual ~PolicySetup();
+
+  // false if the policy cannot run here, `skipped` tells why
+  [[nodiscard]] bool good() const;
+
+  Config config;
+  std::string skipped;
+
+  // the policies, as accepted by the constructor
+  static const std::vector<std::string> POLICIES;
+
+protected:
+  std::filesystem::path work;
+  // listening and connected sockets
+  std::vector<File> sockets;
+  // dirs bind mounted onto themselves
+  std::vector<std::filesystem::path> mounted;
+  // created for cgroup_io, empty if none
+  std::filesystem::path cgroup;
+};
+
+// Steps the policy of a `DoNotSleep` by hand: a scan finds nothing due, a round keeps every target awake. Both return
+// once the service probe and the keepalives they started are done and recorded.
+class Driver : public DoNotSleep {
+public:
+  explicit Driver(Config config);
+
+  using DoNotSleep::open;
+  // look at the policy once with no keepalive due, false once it stopped
+  bool scan();
+  // look at the policy once with a keepalive due on every target, false once it stopped
+  bool round();
+  [[nodiscard]] std::size_t target_count() const;
+
+protected:
+  // wait for the service probe and the keepalives under way and let `process_events` take them, false once it stopped
+  bool settle();
+};
+
+} // namespace ds::test
+
+#endif // DO_NOT_SLEEP_TEST_DRIVER_H_
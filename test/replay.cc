@@ -0,0 +1,69 @@
+// Records a history of two accesses an hour apart and replays it with monitor IO (fanotify): each access wakes the
+// dir up and keeps it awake for `keep_awake`, a keepalive every interval.
+//
+//   replay
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include "do_not_sleep/history.h"
+#include "do_not_sleep/replay.h"
+#include "do_not_sleep/util.h"
+
+#include "driver.h"
+
+namespace {
+
+constexpr std::int64_t MINUTE_MS{60 * 1000};
+
+// records events at given times
+class Recorder : public ds::History {
+public:
+  using History::History;
+  using History::append;
+};
+
+} // namespace
+
+int main() {
+  ds::test::PolicySetup setup{"monitor_io_fanotify"};
+  if (!setup.good()) {
+    std::fprintf(stderr, "%s\n", setup.skipped.c_str());
+    return 1;
+  }
+  ds::Config& config = setup.config;
+  config.interval = std::chrono::minutes{1};
+  config.keep_awake = std::chrono::minutes{5};
+  const std::string dir = config.dirs.begin()->string();
+  const std::int64_t start_ms = ds::current_time_ms() - 2 * 60 * MINUTE_MS;
+  {
+    Recorder recorder{config.history_dir, config.history_retention};
+    const std::uint32_t device = recorder.device(dir);
+    ds::History::Event event{};
+    event.kind = ds::History::Kind::TRIGGER;
+    event.device = device;
+    event.trigger = ds::History::Trigger::ACCESS;
+    for (const std::int64_t& time_ms : {start_ms, start_ms + 60 * MINUTE_MS}) {
+      event.time_ms = time_ms;
+      recorder.append(event);
+    }
+    // the end of the replay
+    event = ds::History::Event{};
+    event.time_ms = start_ms + 90 * MINUTE_MS;
+    event.kind = ds::History::Kind::KEEPALIVE;
+    event.device = device;
+    event.wake = false;
+    event.result = ds::DeviceWorker::Result::DONE;
+    recorder.append(event);
+  }
+  std::ostringstream report;
+  const bool replayed = ds::Replay{config}.run(config.history_dir, 0, report);
+  std::printf("%s", report.str().c_str());
+  // a wake up and 5 keepalives until it may sleep, twice
+  const std::string expected{": recorded 1 keepalive(s) (0 wake(s), 0 spin-up(s), 0 skipped); replayed 12 keepalive(s) "
+                             "(2 wake(s), 0 skipped) from 0 I/O record(s) and 2 trigger(s)."};
+  return replayed && report.str().find(expected) != std::string::npos ? 0 : 1;
+}
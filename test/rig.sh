@@ -0,0 +1,162 @@
+#!/bin/sh
+# Runs the daemon against a loop device, a dm-delay device and a dm-flakey device, and reports per device the
+# keepalive latency, its jitter against `interval` (from the recorded history) and the syscalls made (with strace).
+#
+#   test/rig.sh path/to/do-not-sleep [seconds]
+#
+# Needs root, exits 77 (skipped) otherwise or if losetup, mkfs.ext4 or mount are missing. The dm devices are skipped
+# if device-mapper or its delay/flakey targets are not available, the syscall counts if strace is missing.
+
+set -u
+
+BIN=$(realpath "${1:?usage: $0 path/to/do-not-sleep [seconds]}")
+SECONDS_PER_DEVICE=${2:-${RIG_SECONDS:-20}}
+INTERVAL=1
+IMAGE_MB=32
+
+skip() {
+  echo "skipped: $*"
+  exit 77
+}
+
+[ "$(id -u)" -eq 0 ] || skip "needs root"
+for tool in losetup mkfs.ext4 mount umount; do
+  command -v "$tool" >/dev/null 2>&1 || skip "$tool not found"
+done
+
+WORK=$(mktemp -d /tmp/do-not-sleep-rig.XXXXXX)
+LOOPS=""
+MAPPED=""
+MOUNTS=""
+FAILED=0
+
+cleanup() {
+  for mnt in $MOUNTS; do
+    umount "$mnt" 2>/dev/null
+  done
+  for name in $MAPPED; do
+    dmsetup remove "$name" 2>/dev/null
+  done
+  for loop in $LOOPS; do
+    losetup -d "$loop" 2>/dev/null
+  done
+  [ -n "${RIG_KEEP:-}" ] || rm -rf "$WORK"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# new loop device over a fresh image in `loop`
+new_loop() {
+  image="$WORK/$1.img"
+  truncate -s "${IMAGE_MB}M" "$image" || return 1
+  loop=$(losetup --find --show "$image") || return 1
+  LOOPS="$LOOPS $loop"
+}
+
+# `dmsetup targets` lists `$1`
+has_target() {
+  command -v dmsetup >/dev/null 2>&1 && dmsetup targets 2>/dev/null | grep -q "^$1 "
+}
+
+# formats and mounts `$2` for scenario `$1`, runs the daemon on it and prints what was measured
+run() {
+  name=$1
+  device=$2
+  mnt="$WORK/mnt-$name"
+  mkdir -p "$mnt" "$WORK/state-$name"
+  if ! mkfs.ext4 -q -F "$device" || ! mount "$device" "$mnt"; then
+    echo "$name: failed to set up $device"
+    FAILED=1
+    return
+  fi
+  MOUNTS="$mnt $MOUNTS"
+  mkdir "$mnt/dir"
+  conf="$WORK/conf-$name"
+  cat >"$conf" <<EOF
+{
+  "dirs": ["$mnt/dir"],
+  "interval": $INTERVAL,
+  "policy": "time_range",
+  "time_range": { "start": [0, 0, 0], "end": [23, 59, 59] },
+  "skip_active": false,
+  "device_classes": {
+    "rotational": { "keepalive": "write" },
+    "solid_state": { "keepalive": "write" },
+    "zoned": { "keepalive": "write" },
+    "usb": { "keepalive": "write" },
+    "other": { "keepalive": "write" }
+  },
+  "state_file": "$WORK/state-$name/state",
+  "history": { "dir": "$WORK/state-$name/history" },
+  "status_page": "/do_not_sleep_rig_$name"
+}
+EOF
+  counts="$WORK/syscalls-$name"
+  if command -v strace >/dev/null 2>&1; then
+    strace -f -c -o "$counts" "$BIN" --config "$conf" >"$WORK/log-$name" 2>&1 &
+  else
+    "$BIN" --config "$conf" >"$WORK/log-$name" 2>&1 &
+  fi
+  pid=$!
+  sleep "$SECONDS_PER_DEVICE"
+  # the daemon itself, strace then prints its counts
+  pkill -P "$pid" 2>/dev/null || kill "$pid"
+  wait "$pid"
+  rm -f "/dev/shm/do_not_sleep_rig_$name"
+
+  "$BIN" history --csv --config "$conf" >"$WORK/history-$name.csv" 2>>"$WORK/log-$name"
+  # time_ms,device,event,reads,writes,wake,result,latency_ms,trigger
+  awk -F, -v name="$name" -v interval_ms=$((INTERVAL * 1000)) '
+    $3 == "keepalive" && $7 == "done" {
+      n++
+      total += $8
+      if ($8 > max) max = $8
+      if (last != "") {
+        gap = $1 - last - interval_ms
+        gaps++
+        jitter += gap < 0 ? -gap : gap
+        if ((gap < 0 ? -gap : gap) > max_jitter) max_jitter = gap < 0 ? -gap : gap
+      }
+      last = $1
+    }
+    $3 == "keepalive" && $7 != "done" { failed++ }
+    END {
+      if (n == 0) {
+        printf "%s: no keepalives recorded\n", name
+        exit 1
+      }
+      printf "%s: %d keepalive(s), %d failed, latency mean %.3fms max %.3fms", name, n, failed, total / n, max
+      printf ", jitter mean %.1fms max %.1fms\n", gaps ? jitter / gaps : 0, max_jitter
+    }' "$WORK/history-$name.csv" || FAILED=1
+
+  if [ -s "$counts" ]; then
+    # the summary line of `strace -c`
+    awk -v name="$name" -v seconds="$SECONDS_PER_DEVICE" '
+      $NF == "total" { calls = $(NF - 2) ~ /^[0-9]+$/ && $(NF - 1) ~ /^[0-9]+$/ ? $(NF - 2) : $(NF - 1) }
+      END { if (calls) printf "%s: %d syscall(s), %.1f per second\n", name, calls, calls / seconds }' "$counts"
+  else
+    echo "$name: syscalls not counted, strace not found"
+  fi
+}
+
+new_loop loop || skip "no loop device"
+run loop "$loop"
+
+if has_target delay; then
+  new_loop delay && size=$(blockdev --getsz "$loop") \
+    && dmsetup create ds-rig-delay --table "0 $size delay $loop 0 50" && MAPPED="$MAPPED ds-rig-delay" \
+    && run delay /dev/mapper/ds-rig-delay
+else
+  echo "delay: skipped, no dm-delay"
+fi
+
+if has_target flakey; then
+  # up 4s, then writes are dropped for 1s: errors would make ext4 abort its journal
+  new_loop flakey && size=$(blockdev --getsz "$loop") \
+    && dmsetup create ds-rig-flakey --table "0 $size flakey $loop 0 4 1 1 drop_writes" \
+    && MAPPED="$MAPPED ds-rig-flakey" && run flakey /dev/mapper/ds-rig-flakey
+else
+  echo "flakey: skipped, no dm-flakey"
+fi
+
+exit $FAILED
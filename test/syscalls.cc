@@ -0,0 +1,199 @@
+// Counts the syscalls of all threads during each scan and keepalive round of a policy with ptrace(2) and checks them
+// against what they are pinned to, so a change that adds syscalls to the steady state shows up here:
+//
+//   syscalls <policy>
+//
+// Exits 77 (skipped) if the policy cannot run here or tracing is not permitted.
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "sys/ptrace.h"
+#include "sys/syscall.h"
+#include "sys/types.h"
+#include "sys/wait.h"
+#include "unistd.h"
+
+#include "driver.h"
+
+namespace {
+
+constexpr int SKIP{77};
+constexpr int ROUNDS{5};
+// first argument of the close(2) the traced child marks phases with, never a file descriptor
+constexpr std::uint64_t MARKER{0x7d500000};
+
+enum Phase : std::uint64_t { NONE, SCAN, ROUND };
+
+// syscalls of a scan and of a keepalive round of each policy over two dirs, futex(2) calls are counted apart: how
+// many a hand-over to a worker takes depends on which thread gets there first
+struct Pin {
+  std::uint64_t scan;
+  std::uint64_t round;
+};
+
+// the keepalive of each dir: openat, pread, pwrite or ftruncate, fdatasync, close, the write of its log line and the
+// write of its worker to the eventfd it returns on; epoll_wait for each look at the policy, and the read of the eventfd
+// once the keepalives are recorded
+const std::map<std::string, Pin> PINS{
+  {"time_range", {.scan = 1, .round = 17}},
+  {"schedule", {.scan = 1, .round = 17}},
+  // a pread of each disk stat, again once the keepalive is recorded
+  {"monitor_io", {.scan = 3, .round = 21}},
+  // a poll; once the keepalives are recorded the accesses they made are read, their fds closed and told by getpid
+  {"monitor_io_fanotify", {.scan = 2, .round = 24}},
+  // socket, connect and epoll_ctl of the probe, the poll waiting for it, a second look with a poll of the connection,
+  // getsockopt and close
+  {"service_available", {.scan = 9, .round = 25}},
+  // a pread of the (empty) io.stat
+  {"cgroup_io", {.scan = 2, .round = 18}},
+  // a poll of the proc connector
+  {"process_present", {.scan = 2, .round = 18}},
+  // sendto and recvfrom of the sock_diag dump
+  {"local_connection", {.scan = 6, .round = 22}},
+};
+constexpr std::uint64_t MAX_FUTEX{24};
+
+void mark(const Phase& phase) {
+  syscall(SYS_close, MARKER + phase);
+}
+
+// the traced side: scans and rounds between marks
+int run(const std::string& policy) {
+  if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) == -1) {
+    std::fprintf(stderr, "skipped: ptrace: %s\n", std::strerror(errno));
+    return SKIP;
+  }
+  // the tracer sets its options before anything else happens
+  raise(SIGSTOP);
+  ds::test::PolicySetup setup{policy};
+  if (!setup.good()) {
+    std::fprintf(stderr, "skipped: %s\n", setup.skipped.c_str());
+    return SKIP;
+  }
+  ds::test::Driver driver{setup.config};
+  // what the host lacks is told by `setup`, past it the policy has to come up
+  if (!driver.open()) {
+    std::fprintf(stderr, "%s: failed to open\n", policy.c_str());
+    return 1;
+  }
+  if (driver.target_count() != 2) {
+    std::fprintf(stderr, "%s: %zu target(s) instead of 2\n", policy.c_str(), driver.target_count());
+    return 1;
+  }
+  // the first look, first keepalives and first scans set things up
+  for (int i = 0; i < 2; i++) {
+    if (!driver.round() || !driver.scan()) {
+      return 1;
+    }
+  }
+  for (int i = 0; i < ROUNDS; i++) {
+    mark(ROUND);
+    const bool kept = driver.round();
+    mark(NONE);
+    mark(SCAN);
+    const bool scanned = driver.scan();
+    mark(NONE);
+    if (!kept || !scanned) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// what one phase did
+struct Count {
+  Phase phase;
+  std::uint64_t total;
+  std::uint64_t futex;
+  std::map<std::uint64_t, std::uint64_t> by_nr;
+};
+
+// the tracer: follows all threads of `child` until it exits, the counts of each phase into `counts`
+int trace(const pid_t& child, std::vector<Count>& counts) {
+  int status{0};
+  if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status)) {
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  }
+  ptrace(PTRACE_SETOPTIONS, child, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+  ptrace(PTRACE_SYSCALL, child, nullptr, nullptr);
+  // threads seen so far, a new one reports an initial SIGSTOP (maybe before its clone event)
+  std::set<pid_t> known{child};
+  Count* current{nullptr};
+  for (;;) {
+    const pid_t tid = waitpid(-1, &status, __WALL);
+    if (tid == -1) {
+      return 1;
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (tid == child) {
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+      }
+      continue;
+    }
+    int signal{0};
+    if (known.insert(tid).second && WSTOPSIG(status) == SIGSTOP) {
+      // the initial stop of a new thread
+    } else if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+      __ptrace_syscall_info info{};
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        if (info.entry.nr == SYS_close && info.entry.args[0] >= MARKER && info.entry.args[0] <= MARKER + ROUND) {
+          const Phase phase = static_cast<Phase>(info.entry.args[0] - MARKER);
+          current = phase == NONE ? nullptr : &counts.emplace_back(Count{.phase = phase, .total = 0, .futex = 0});
+        } else if (current != nullptr) {
+          (info.entry.nr == SYS_futex ? current->futex : current->total)++;
+          current->by_nr[info.entry.nr]++;
+        }
+      }
+    } else if (status >> 8 != (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
+      signal = WSTOPSIG(status);
+    }
+    ptrace(PTRACE_SYSCALL, tid, nullptr, signal);
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 2 || PINS.count(argv[1]) == 0) {
+    std::fprintf(stderr, "usage: %s <policy>\n", argv[0]);
+    return 2;
+  }
+  const std::string policy{argv[1]};
+  const pid_t child = fork();
+  if (child == 0) {
+    _exit(run(policy));
+  }
+  std::vector<Count> counts;
+  const int status = trace(child, counts);
+  if (status != 0) {
+    return status;
+  }
+  const Pin& pin = PINS.at(policy);
+  int failed{0};
+  for (const Count& count : counts) {
+    const std::uint64_t expected = count.phase == SCAN ? pin.scan : pin.round;
+    std::printf("%s: %llu syscall(s) + %llu futex(es):",
+                count.phase == SCAN ? "scan" : "round",
+                static_cast<unsigned long long>(count.total),
+                static_cast<unsigned long long>(count.futex));
+    for (const auto& [nr, calls] : count.by_nr) {
+      std::printf(" %llu x%llu", static_cast<unsigned long long>(nr), static_cast<unsigned long long>(calls));
+    }
+    std::printf("\n");
+    if (count.total != expected || count.futex > MAX_FUTEX) {
+      std::printf("  expected %llu syscall(s) + at most %llu futex(es)\n",
+                  static_cast<unsigned long long>(expected),
+                  static_cast<unsigned long long>(MAX_FUTEX));
+      failed = 1;
+    }
+  }
+  return counts.size() == 2 * ROUNDS ? failed : 1;
+}